@@ -2,8 +2,58 @@
 #include <string>
 #include <cmath> 
 #include <cstdlib> 
+#include <cstring>
+#include <cstdio>
+#include <cctype>
 #include <ctime>   
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <deque>
+#include <atomic>
+#include <type_traits>
 #include <SDL/SDL.h>
+#include "SDL_mixer.h"
+
+// --- Platform File Mapping and Sockets ---
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h> // Before windows.h; link with ws2_32
+#include <windows.h>
+typedef SOCKET NetSocket;
+typedef int NetAddressSize;
+const NetSocket NET_NO_SOCKET = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+typedef int NetSocket;
+typedef socklen_t NetAddressSize;
+const NetSocket NET_NO_SOCKET = -1;
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h> // --hot-reload
+#endif
+
+// --- SIMD Configuration ---
+// Hot loops use SSE2 (always present on x86-64) and AVX2 when the compiler targets it
+// (e.g. -mavx2). Anything else falls back to plain scalar code.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE2 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define USE_AVX2 1
+#endif
 
 // --- Configuration Constants ---
 const int SCREEN_WIDTH = 640;
@@ -18,6 +68,9 @@ const int TARGET_HEIGHT = 100;
 const int PLAYER_VELOCITY = 4; // Speed of the player (horizontal)
 const int PLAYER_START_X = 50; // Initial safe position
 const int PLAYER_START_Y = 150; // Initial safe position
+const int MAX_PLAYERS = 2;       // The local player and, in a networked game, the partner
+const int PLAYER_SPACING = 80;   // The partner starts this far right of the first player
+const int GAME_STATE_PACK_MAX = 256; // Bytes pack_game_state() may write
 
 // Beachball Physics Constants
 const int BALL_WIDTH = 24;    
@@ -36,6 +89,11 @@ const double JUMP_VELOCITY = -12.0;
 const double PLATFORM_GRAVITY = 0.8; 
 const double FREE_ROAM_GRAVITY = 0.5; 
 
+// Sprite Transparency Key (R=0, G=162, B=232)
+const Uint8 TRANSPARENCY_R = 0;
+const Uint8 TRANSPARENCY_G = 162;
+const Uint8 TRANSPARENCY_B = 232;
+
 // Button Configuration
 const int BUTTON_MARGIN = 10;
 
@@ -52,23 +110,410 @@ const int RETRY_BUTTON_HEIGHT = 45;
 const int RETRY_BUTTON_X = TOGGLE_BUTTON_X - RETRY_BUTTON_WIDTH - BUTTON_MARGIN; 
 const int RETRY_BUTTON_Y = TOGGLE_BUTTON_Y; // Keep vertical alignment with margin
 
+// Simulation Timing
+// The simulation advances in fixed ticks; all velocities above are "per tick" at the
+// default rate. --sim-hz runs fewer, longer (or more, shorter) ticks, scaled to match.
+const int SIM_TICKS_PER_SECOND = 60;
+const double SIM_TICK_MS = 1000.0 / SIM_TICKS_PER_SECOND;
+const int MIN_SIM_HZ = 10;
+const int MAX_SIM_HZ = 480;
+const int JUMP_CHECK_RATES[] = {60, 120, 480}; // --sim-hz values whose jumps --jump-check compares
+const int REWIND_SECONDS = 5;                              // How far back the rewind key reaches
+const int REWIND_MAX_STATES = REWIND_SECONDS * MAX_SIM_HZ; // Ring slots for any --sim-hz
+const int MAX_BALL_BOUNCES_PER_TICK = 4; // Wall contacts resolved within one swept ball move
+const double MAX_FRAME_MS = 250.0; // Clamp long stalls so we never try to catch up forever
+const int MAX_FRAMES_PER_SECOND = 120; // Render cap; interpolation keeps motion smooth below it
+const int EVENT_BATCH = 32; // Queued events taken per SDL_PeepEvents call
+const int MOTION_CHECK_ROUNDS = 1000; // Made-up event streams handled by --motion-check
+
+// Headless Benchmark Configuration
+const long HEADLESS_DEFAULT_TICKS = 1000000;
+const unsigned int HEADLESS_SEED = 12345; // Fixed seed so runs are reproducible
+
+// Beachball Stress Mode
+const int STRESS_MAX_BALLS = 1 << 22;
+const int STRESS_SWEEP_START = 1024;
+const int STRESS_SWEEP_TICKS = 200; // Timed ticks per ball count in the sweep
+
+// Collision Kernel Benchmark
+const int COLLISION_BENCH_BOXES = 4096;
+const int COLLISION_BENCH_ROUNDS = 2000;
+
+// Colorkey Blitter Benchmark
+const int BLIT_BENCH_PLACEMENTS = 4000; // Random clipped blits compared against SDL
+const int BLIT_BENCH_ROUNDS = 200;      // Full sprite sets timed per blitter
+
+// Spatial Hash Broad Phase (uniform grid over the occupied part of the world, sized by grid_build())
+const int GRID_CELL_SIZE = 32;
+
+// Job System
+const int MAX_WORKER_THREADS = 64;
+const int BALLS_PER_JOB = 4096;               // Integration chunk
+const int THREAD_BENCH_DEFAULT_MAX = 8;
+const int THREAD_BENCH_DEFAULT_BALLS = 4096;
+
+// Asset Pack (built with --build-pack; atlas pages stored in the display's pixel layout)
+const char* const ASSET_PACK_FILE = "assets.pak";
+const char ASSET_PACK_MAGIC[] = "GCPK";
+const Uint32 ASSET_PACK_VERSION = 2;
+const Uint32 ASSET_PACK_BYTE_ORDER = 0x01020304; // Written natively; a mismatch means another byte order
+const Uint32 ASSET_PACK_ALIGN = 16;              // Atlas pages start on 16-byte boundaries
+const Uint32 ASSET_PACK_RMASK = 0x00FF0000;      // 32bpp XRGB8888
+const Uint32 ASSET_PACK_GMASK = 0x0000FF00;
+const Uint32 ASSET_PACK_BMASK = 0x000000FF;
+const int ASSET_NAME_LENGTH = 32;
+
+// Tile Levels (--level FILE; replaces the platform in gravity mode)
+const char LEVEL_MAGIC[] = "GCLV";
+const Uint32 LEVEL_VERSION = 1;
+const int TILE_SIZE = 32;           // Pixels per tile side
+const Uint32 LEVEL_BYTE_ORDER = 0x01020304; // Written natively, like the asset pack
+const int LEVEL_CHUNK_TILES = 32;   // Chunks are 32x32 tiles, each run-length encoded on its own
+const int LEVEL_BUILD_WIDTH = 120;  // --build-level writes a level of 6x2 screens
+const int LEVEL_BUILD_HEIGHT = 30;
+const int MAX_WORLD_SIZE = 30000;   // World pixels per side (SDL_Rect positions are 16-bit)
+const int LEVEL_MAX_TILES = 1 << 15; // Per side
+const char* const LEVEL_BENCH_FILE = "level_bench.lvl";
+const int LEVEL_BENCH_SIZES[] = {64, 512, 4096}; // Synthetic level sides (tiles) for --level-bench
+const int LEVEL_BENCH_QUERIES = 200000; // Player-sized collision queries per level
+const int LEVEL_BENCH_VIEWS = 2000;     // Screen-sized tile draws per level
+
+// Sprite Atlas
+const int ATLAS_PAGE_SIZE = 1024; // Pages are square; every sprite must fit on one
+const int MAX_ATLAS_PAGES = 4;
+
+// Asset Hot Reload (Linux only: the working directory is watched with inotify)
+const int HOT_RELOAD_POLL_MS = 100;           // How often the watcher checks whether to stop
+const int HOT_RELOAD_EVENT_BUFFER = 4096;     // Bytes of inotify events read at once
+
+// Input Recording (little-endian log: header, then runs of identical ticks)
+const char INPUT_LOG_MAGIC[] = "GCIL";
+const Uint16 INPUT_LOG_VERSION = 3;
+const long INPUT_LOG_TICKS_OFFSET = 16; // Header position of the tick count and final checksum
+
+// Two-Player Lockstep (--host PORT / --join ADDRESS:PORT, UDP)
+const Uint16 NET_MAGIC = 0x4347;        // "GC", first in every packet
+const Uint16 NET_VERSION = 2;
+const int NET_INPUT_DELAY = 3;          // Ticks between sampling local input and simulating it
+const int NET_INPUT_WINDOW = 64;        // Ticks of input kept per player (power of two)
+const int NET_MAX_INPUTS_PER_PACKET = 32; // Unacknowledged inputs resent per packet
+const int NET_SYNC_INTERVAL = 30;       // Ticks between state syncs (desync checks)
+const int NET_SYNC_HISTORY = 8;         // Syncs kept per side, for deltas and comparisons
+const int NET_PACKET_SIZE = 1024;
+const int NET_UDP_OVERHEAD = 28;        // IPv4 + UDP header bytes, counted in the bandwidth
+const Uint32 NET_RESEND_MS = 20;        // Resend this often while nothing new goes out
+const Uint32 NET_HELLO_MS = 100;        // Joining: how often to knock
+const Uint32 NET_CONNECT_TIMEOUT_MS = 30000;
+const Uint32 NET_PEER_TIMEOUT_MS = 5000; // Silence after which the partner counts as gone
+const Uint32 NET_NO_TICK = 0xFFFFFFFF;
+
+// Audio (music streamed from disk; effects synthesized once at startup)
+const char* const MUSIC_FILE = "music.ogg";
+const int AUDIO_FREQUENCY = 44100;
+const int AUDIO_CHANNELS = 2;           // Stereo
+const int AUDIO_CHUNK_SAMPLES = 1024;   // Frames decoded and mixed per callback (~23 ms)
+const int AUDIO_MIX_CHANNELS = 8;       // Effects that can overlap
+const int SOUND_QUEUE_SIZE = 64;        // Power of two
+const double BOUNCE_SOUND_MIN_SPEED = 2.0; // Slower bounces (a ball settling) stay silent, without sparks
+
+// Particle Effects (score bursts and bounce sparks; velocities per 60 Hz tick)
+const int PARTICLE_CAPACITY = 16384;        // Fixed pool; bursts that don't fit are dropped
+const int PARTICLE_DRAW_BUDGET = 4096;      // Particles drawn per frame at most; more alive are thinned evenly
+const float PARTICLE_LIFE_TICKS = 45.0f;
+const float PARTICLE_GRAVITY = 0.15f;
+const int PARTICLE_SIZE = 2;                // Pixels per side, until the last third of a particle's life
+const int PARTICLE_SCORE_BURST = 96;
+const float PARTICLE_SCORE_SPREAD = 5.0f;
+const float PARTICLE_BOUNCE_PER_SPEED = 3.0f; // Sparks per unit of bounce speed...
+const int PARTICLE_BOUNCE_MAX = 32;           // ... up to this many
+const float PARTICLE_BOUNCE_CARRY = 0.5f;     // Share of the ball's new velocity the sparks take along
+const float PARTICLE_BOUNCE_SPREAD = 2.0f;
+const int PARTICLE_BENCH_TICKS = 2000;
+const int PARTICLE_BENCH_FRAMES = 2000;
+
+// UI Widget Hit Grid
+const int MAX_WIDGETS = 64;   // One bit each in a grid cell's mask
+const int UI_GRID_CELL_SIZE = 32;
+const int UI_GRID_COLUMNS = (SCREEN_WIDTH + UI_GRID_CELL_SIZE - 1) / UI_GRID_CELL_SIZE;
+const int UI_GRID_ROWS = (SCREEN_HEIGHT + UI_GRID_CELL_SIZE - 1) / UI_GRID_CELL_SIZE;
+const int UI_GRID_CELLS = UI_GRID_COLUMNS * UI_GRID_ROWS;
+
+// Dirty Rectangle Rendering
+const int MAX_SPRITE_RECTS = 8; // Moving sprites tracked per frame (players, target, ball, cursor, ...)
+
+// Frame Timing HUD (toggled with F3)
+const SDLKey HUD_TOGGLE_KEY = SDLK_F3;
+const SDLKey REWIND_KEY = SDLK_BACKSPACE; // Held: step back through the last ticks
+const int FRAME_HISTORY = 256;       // Frames kept in the timing ring buffer
+const int HUD_FONT_SCALE = 2;        // Screen pixels per font pixel (font is 3x5)
+const int HUD_CHAR_ADVANCE = 4 * HUD_FONT_SCALE;
+const int HUD_LINE_HEIGHT = 7 * HUD_FONT_SCALE;
+const int HUD_PADDING = 6;
+const int HUD_GRAPH_WIDTH = 200;     // One pixel column per frame
+const int HUD_GRAPH_HEIGHT = 48;
+const float HUD_GRAPH_PIXELS_PER_MS = 1.5f;
+const int HUD_WIDTH = HUD_GRAPH_WIDTH + 2 * HUD_PADDING;
+const int HUD_HEIGHT = 6 * HUD_LINE_HEIGHT + HUD_GRAPH_HEIGHT + 3 * HUD_PADDING;
+const int HUD_X = BUTTON_MARGIN;
+const int HUD_Y = SCREEN_HEIGHT - HUD_HEIGHT - BUTTON_MARGIN;
+
 // --- Global Variables ---
 SDL_Surface* gScreen = NULL;
-SDL_Surface* gTextSurface = NULL; 
-SDL_Surface* gSignSurface = NULL; 
-SDL_Surface* gCursorSurface = NULL; 
-SDL_Surface* gCursorClickSurface = NULL; 
-SDL_Surface* gPlayerRightSurface = NULL; 
-SDL_Surface* gPlayerLeftSurface = NULL;  
-SDL_Surface* gBallSurface = NULL;        
-SDL_Surface* gTargetSurface = NULL; // Surface for the target image
-
-// Surfaces for Platformer mode
-SDL_Surface* gPlatformSurface = NULL;
-SDL_Surface* gPlatformLoseSurface = NULL;
-SDL_Surface* gButtonOnSurface = NULL;
-SDL_Surface* gButtonOffSurface = NULL;
-SDL_Surface* gButtonRetrySurface = NULL; 
+
+// Every sprite the game loads
+enum SpriteId {
+    SPRITE_TEXT,
+    SPRITE_SIGN,
+    SPRITE_CURSOR,
+    SPRITE_CURSOR_CLICK,
+    SPRITE_BALL,
+    SPRITE_TARGET,
+    SPRITE_PLAYER_RIGHT,
+    SPRITE_PLAYER_LEFT,
+    // Platformer mode
+    SPRITE_PLATFORM,
+    SPRITE_PLATFORM_LOSE,
+    SPRITE_BUTTON_ON,
+    SPRITE_BUTTON_OFF,
+    SPRITE_BUTTON_RETRY,
+    // Directional arrows and music state (not drawn yet)
+    SPRITE_FL_UP,
+    SPRITE_FL_UPRIGHT,
+    SPRITE_FL_RIGHT,
+    SPRITE_FL_DOWNRIGHT,
+    SPRITE_FL_DOWN,
+    SPRITE_FL_LEFTDOWN,
+    SPRITE_FL_LEFT,
+    SPRITE_FL_UPLEFT,
+    SPRITE_PAUSE,
+    SPRITE_PLAYING,
+    SPRITE_COUNT
+};
+
+// Source file and transparent color of each sprite, by SpriteId
+struct SpriteSource {
+    const char* file;
+    Uint8 keyR, keyG, keyB;
+};
+const SpriteSource SPRITE_SOURCES[SPRITE_COUNT] = {
+    {"text.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"sign.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"cursor.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"cursor_click.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"beachball.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"target.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"player_right.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"player_left.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"platform.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"platformlose.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"but_grav_on.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"but_grav_off.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"but_grav_retry.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"FL_UP.bmp", 255, 255, 255}, // The arrows are drawn on white
+    {"FL_UPRIGHT.bmp", 255, 255, 255},
+    {"FL_RIGHT.bmp", 255, 255, 255},
+    {"FL_DOWNRIGHT.bmp", 255, 255, 255},
+    {"FL_DOWN.bmp", 255, 255, 255},
+    {"FL_LEFTDOWN.bmp", 255, 255, 255},
+    {"FL_LEFT.bmp", 255, 255, 255},
+    {"FL_UPLEFT.bmp", 255, 255, 255},
+    {"pause.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B},
+    {"playing.bmp", TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B}
+};
+
+// --- Sprite Atlas ---
+// Sprites are packed onto a few large pages (shelf by shelf, left to right) and
+// drawn as sub-rects of them. A page has one color key for all its sprites.
+struct Sprite {
+    bool loaded;
+    int page;          // Into gAtlas.pages
+    SDL_Rect source;   // Where on the page
+};
+Sprite gSprites[SPRITE_COUNT];
+long gSpritesVersion = 0; // Bumped whenever sprites are swapped in
+
+struct Atlas {
+    SDL_Surface* pages[MAX_ATLAS_PAGES];
+    int pageCount;
+    int openPage;      // Page still taking sprites, -1 for none
+    int shelfX;        // Next free column on the open shelf
+    int shelfY;        // Top of the open shelf
+    int shelfHeight;   // Tallest sprite on it so far
+};
+Atlas gAtlas = {{NULL}, 0, -1, 0, 0, 0};
+
+// --- Asset Pack ---
+// File layout: PackHeader, PackPage[pageCount], PackSprite[spriteCount], then
+// each atlas page's pixel rows.
+struct PackHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 byteOrder;
+    Uint32 pageCount;
+    Uint32 spriteCount;
+    Uint32 Rmask, Gmask, Bmask; // Pixel layout of every page in the pack
+    Uint32 colorKey;            // Transparent pixel value on every page
+    Uint32 reserved;
+};
+
+struct PackPage {
+    Uint32 width;
+    Uint32 height;
+    Uint32 pitch;  // Bytes per row
+    Uint32 offset; // Of the first pixel row, from the start of the file
+};
+
+struct PackSprite {
+    char name[ASSET_NAME_LENGTH]; // Source BMP file name
+    Uint32 page;
+    Uint32 x, y, w, h;            // Source rect on the page
+};
+
+struct MappedFile {
+    Uint8* data;
+    size_t size;
+};
+MappedFile gAssetPack = {NULL, 0}; // Pack atlas pages point into this mapping
+
+// --- Tile Levels ---
+// File layout: LevelHeader, LevelChunkEntry[chunkColumns * chunkRows] (row-major),
+// then the chunks' runs: (count, tile) byte pairs. Opening a level only maps it;
+// a chunk is decoded the first time anything looks at one of its tiles, so the
+// cost of a frame depends on what's near the player and the screen, not on the
+// size of the level.
+enum TileType {
+    TILE_EMPTY = 0,
+    TILE_SOLID = 1,    // Blocks from every side
+    TILE_PLATFORM = 2, // One-way: can only be landed on from above
+    TILE_TYPE_COUNT
+};
+
+struct LevelHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 byteOrder;
+    Uint32 width, height;             // In tiles
+    Uint32 chunkColumns, chunkRows;
+    Uint32 reserved;
+};
+
+struct LevelChunkEntry {
+    Uint32 offset; // Of the chunk's runs, from the start of the file (0: all empty)
+    Uint32 size;   // Bytes of runs
+};
+
+struct Level {
+    MappedFile file;
+    const LevelChunkEntry* chunkTable;
+    int width, height;                // In tiles; 0 when no level is loaded
+    int chunkColumns, chunkRows;
+    std::atomic<Uint8*>* chunks;      // Decoded tiles per chunk, NULL until first touched
+    SDL_mutex* decodeLock;            // The renderer may touch chunks from its own thread
+    std::atomic<int> chunksDecoded;
+};
+Level gLevel;
+
+// What recordings (and network partners) compare to tell they play the same level
+struct LevelFingerprint {
+    Uint32 width, height;             // In tiles; 0 without a level
+    Uint32 hash;                      // FNV-1a of the whole file; 0 without a level
+};
+Uint8 gEmptyChunk[LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES]; // Shared by all-empty (and damaged) chunks
+
+// --- Startup Timing ---
+const std::chrono::steady_clock::time_point gLaunchTime = std::chrono::steady_clock::now();
+struct StartupStats {
+    const char* mediaSource; // "asset pack" or "loose BMPs"
+    double mediaMs;          // Time spent in load_media()
+    double firstFrameMs;     // Launch until the first frame was presented
+    double fullyLoadedMs;    // Launch until the last sprite was swapped in
+};
+StartupStats gStartupStats = {"none", 0.0, 0.0, 0.0};
+
+// --- Asynchronous Asset Loading ---
+// A loader thread decodes the sprites and queues them; the main thread swaps them
+// in between frames and draws fallback shapes until then.
+struct LoadedSprite {
+    int id;          // SpriteId
+    int page;
+    SDL_Rect source;
+};
+
+struct AssetLoader {
+    SDL_Thread* thread;
+    SDL_mutex* lock;                       // Guards finished, done and failed
+    std::vector<LoadedSprite> finished;    // Waiting for the main thread
+    std::vector<LoadedSprite> installing;  // Main thread's side of the swap
+    bool done;                             // The loader thread has finished
+    bool failed;                           // ... and not every sprite loaded
+    bool looseAssets;
+    bool delivered[SPRITE_COUNT];          // Loader thread only
+    std::atomic<bool> cancel;              // Asks the loader to stop early
+};
+AssetLoader gAssetLoader;
+
+// --- Asset Hot Reload ---
+// A watcher thread waits on inotify for BMPs being saved, decodes and converts just
+// those files, and queues them. Between frames the main thread copies each one into
+// the sprite's previous atlas spot, once no frame draws from it any more, or else
+// into fresh atlas space, and repoints its sprite; every other sprite is left alone.
+struct ReloadedSprite {
+    int id;                 // SpriteId
+    SDL_Surface* surface;   // Converted to the screen format; freed after installing
+    std::chrono::steady_clock::time_point changed; // When the save was noticed
+};
+
+struct HotReload {
+    SDL_Thread* thread;
+    SDL_mutex* lock;                         // Guards finished
+    std::vector<ReloadedSprite> finished;    // Waiting for the main thread
+    std::vector<ReloadedSprite> installing;  // Main thread's side of the swap
+    int watchFd;                             // inotify instance, -1 when not watching
+    std::atomic<bool> cancel;                // Asks the watcher to stop
+    long reloads;                            // Sprites swapped in (main thread)
+    double worstMs;                          // Slowest save-to-swap time
+    Sprite spare[SPRITE_COUNT];              // Each sprite's spot before its last reload (loaded if any)
+    long spareVersion[SPRITE_COUNT];         // First gSpritesVersion that no longer draws from it
+};
+HotReload gHotReload;
+
+// --- Audio ---
+// The game thread never calls SDL_mixer while playing: it queues sound ids on a
+// single-producer ring, and an audio thread hands them to the mixer (whose calls
+// take the audio device lock). Music is streamed by the mixer itself.
+enum SoundId {
+    SOUND_SCORE,
+    SOUND_BOUNCE,
+    SOUND_LOSS,
+    SOUND_COUNT
+};
+
+struct SoundQueue {
+    Uint8 ids[SOUND_QUEUE_SIZE];
+    std::atomic<unsigned> head;     // Next slot to write (game thread)
+    std::atomic<unsigned> tail;     // Next slot to read (audio thread)
+};
+
+struct Audio {
+    bool enabled;
+    Mix_Music* music;
+    Mix_Chunk* chunks[SOUND_COUNT];
+    std::vector<Sint16> samples[SOUND_COUNT]; // PCM the chunks point into
+    SoundQueue queue;
+    SDL_Thread* thread;
+    SDL_sem* wake;                  // Posted once per queued sound
+    std::atomic<bool> quit;
+};
+Audio gAudio;
+
+struct AudioStats {
+    long queued;                    // Sounds queued by the game thread
+    long dropped;                   // ... and dropped because the queue was full
+    double totalUs;                 // Game thread time spent queuing
+    double worstUs;
+    double startupMs;               // Opening the device, loading, synthesizing
+};
+AudioStats gAudioStats = {0, 0, 0.0, 0.0, 0.0};
 
 // Player Direction Enum
 enum {
@@ -76,47 +521,713 @@ enum {
     PLAYER_FACING_LEFT
 };
 
-// Game State
-int gScore = 0; 
+// --- Game State ---
+// Everything a simulation tick reads and writes, apart from the stress-mode ball
+// pool and the (read-only) level, kept in one trivially copyable struct so a whole
+// tick can be saved or restored with one memcpy (see the rewind ring).
+struct PlayerState {
+    int x;
+    int y;
+    double velY;
+    int direction;          // PLAYER_FACING_*
+    bool onGround;
+    bool targetColliding;
+    double subX;            // Fraction of a pixel walked but not applied yet (see scaled_move())
+    double subY;            // ... and walked or fallen
+};
+
+// Keys that steer each player in update_state()'s key array; a networked partner's
+// input is put on the second set
+struct PlayerKeys {
+    SDLKey left, right, up, down;
+};
+const PlayerKeys PLAYER_KEYS[MAX_PLAYERS] = {
+    {SDLK_LEFT, SDLK_RIGHT, SDLK_UP, SDLK_DOWN},
+    {SDLK_a, SDLK_d, SDLK_w, SDLK_s}
+};
+
+struct GameState {
+    int score;
+
+    // Cursor as the simulation sees it (set per tick)
+    int mouseX;
+    int mouseY;
+    int followerX;      // Top-left corner that centers the cursor image
+    int followerY;
+    bool mouseDown;
+
+    // Camera: top-left of the view, in the world
+    int cameraX;
+    int cameraY;
+
+    // Players: the local one, plus the partner in a networked game
+    PlayerState players[MAX_PLAYERS];
+    int playerCount;
+
+    // Target (Image/Box)
+    int targetX;
+    int targetY;
+
+    // Beachball
+    double ballX;
+    double ballY;
+    double ballVelX;
+    double ballVelY;
+    bool ballGrabbed;
+
+    // Platformer Mode
+    bool gravityOn;
+    bool platformLoss;
+
+    Uint32 randomState; // Game RNG state, see game_random()
+};
+GameState gState = {
+    0,
+    SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, false,
+    0, 0,
+    {{PLAYER_START_X, PLAYER_START_Y, 0.0, PLAYER_FACING_RIGHT, false, false, 0.0, 0.0},
+     {PLAYER_START_X + PLAYER_SPACING, PLAYER_START_Y, 0.0, PLAYER_FACING_RIGHT, false, false, 0.0, 0.0}},
+    1,
+    SCREEN_WIDTH - 150, SCREEN_HEIGHT - 150,
+    300.0, 50.0, 3.0, 0.0, false,
+    false, false,
+    1
+};
+static_assert(std::is_trivial<GameState>::value, "GameState is saved and restored with plain copies");
+
+// World
+// Simulation positions are world coordinates. The world is the screen, or the level
+// when one is loaded; the camera follows the player and stays inside the world. The
+// cursor, the buttons and the HUD stay in screen coordinates.
+int gWorldWidth = SCREEN_WIDTH;
+int gWorldHeight = SCREEN_HEIGHT;
+
+// Rewind: the state at the start of each of the last REWIND_SECONDS of ticks
+struct RewindRing {
+    GameState states[REWIND_MAX_STATES];
+    int capacity;   // REWIND_SECONDS of ticks at the current rate
+    int newest;     // Slot of the latest saved state
+    int count;      // Saved states, up to capacity
+    long rewound;   // Ticks stepped back so far
+};
+RewindRing gRewind;
+
+// --- UI Widgets ---
+// Buttons register a rect, a visibility predicate, the sprite to draw and a click
+// callback. Clicks are resolved through a coarse grid of per-cell widget masks, so
+// the cost doesn't grow with the number of widgets. Visibility and sprites may only
+// depend on UiState: the cached background (which the widgets are drawn into) is
+// rebuilt exactly when that changes.
+struct UiState {
+    bool gravityOn;
+    bool platformLoss;
+};
+
+struct Widget {
+    SDL_Rect rect;
+    bool (*visible)(const UiState& ui);
+    int (*sprite)(const UiState& ui); // SpriteId to draw
+    void (*onClick)();
+};
+Widget gWidgets[MAX_WIDGETS];       // Later widgets are on top
+int gWidgetCount = 0;
+Uint64 gWidgetGrid[UI_GRID_CELLS];  // Bit i set: widget i covers part of the cell
+
+// Stress-Mode Ball Pool
+// Extra beachballs stored as structure-of-arrays, so the integrator can move
+// several balls per SIMD instruction. The original ball (gState.ballX...) is separate.
+struct BallPool {
+    int count;
+    float* x;
+    float* y;
+    float* velX;
+    float* velY;
+    int grabbed; // Index of the ball held by the cursor, or -1
+};
+BallPool gBallPool = {0, NULL, NULL, NULL, NULL, -1};
+
+// Particle Effects
+// Score bursts and bounce sparks, in a fixed-capacity pool stored as structure-of-
+// arrays like the ball pool. Live particles stay packed at the front: a dead one is
+// replaced by the last. Purely cosmetic, so outside GameState: they never change
+// the checksum, and they draw from their own random numbers.
+enum ParticleColor {
+    PARTICLE_GOLD,      // Score
+    PARTICLE_SPARK,     // Bounce
+    PARTICLE_COLOR_COUNT
+};
+const Uint8 PARTICLE_RGB[PARTICLE_COLOR_COUNT][3] = {{255, 200, 40}, {255, 245, 210}};
+
+struct ParticlePool {
+    int capacity;
+    int count;
+    float* x;           // World position
+    float* y;
+    float* velX;
+    float* velY;
+    float* life;        // Ticks left (at 60 Hz)
+    Uint8* color;       // ParticleColor
+    Uint32 random;      // xorshift state for particle_random()
+};
+ParticlePool gParticles = {0, 0, NULL, NULL, NULL, NULL, NULL, NULL, 2463534242u};
+
+struct ParticleStats {
+    long spawned;
+    long dropped;       // Pool full
+    int peak;           // Most alive at once
+    long updates;
+    double updateMs;
+    long frames;        // Frames with particles
+    long drawn;
+    long thinned;       // Skipped to stay within PARTICLE_DRAW_BUDGET
+    double drawMs;
+};
+ParticleStats gParticleStats = {0, 0, 0, 0, 0.0, 0, 0, 0, 0.0};
+
+// Spatial Hash
+// Grid ids for the non-ball entries (balls use their pool index)
+enum {
+    GRID_ID_PLAYER = -1,
+    GRID_ID_TARGET = -2
+};
+
+// Where an entry sits among its object's cells. Two objects first share the cell
+// where, between them, both flags are set; pairs are counted only there.
+enum {
+    GRID_FIRST_COLUMN = 1,
+    GRID_FIRST_ROW = 2,
+    GRID_FIRST_CELL = GRID_FIRST_COLUMN | GRID_FIRST_ROW
+};
+
+// What a grid query looks for (the querying player is never among it)
+enum GridQuery {
+    GRID_QUERY_TARGET,
+    GRID_QUERY_BALLS
+};
+
+struct BallPair {
+    int a; // Lower pool index
+    int b;
+};
+
+struct SpatialGrid {
+    int left, top;               // World position of cell (0, 0), a multiple of GRID_CELL_SIZE
+    int columns;                 // Cells across everything staged, within the world
+    int rows;                    // ... and down
+    std::vector<int> cellStart;  // columns * rows + 1 offsets: cell k owns entries [cellStart[k], cellStart[k + 1])
+    std::vector<int> x, y, w, h; // Entry boxes, grouped by cell
+    std::vector<int> id;         // Pool index or GRID_ID_*
+    std::vector<Uint8> first;    // GRID_FIRST_* flags: is this its object's first column / row of cells?
+    std::vector<int> cellFill;   // Build scratch
+    std::vector<int> objX, objY, objW, objH, objId; // Build staging, one per object
+    std::vector<int> playerHits; // Per-tick scratch
+    std::vector<std::vector<BallPair> > chunkPairs; // Ball pairs found per job chunk (grid row)
+};
+SpatialGrid gGrid;
+bool gBallCollisions = true; // Ball-ball collisions in the pool (off: integration only)
+
+struct CollisionStats {
+    long long pairsTested;     // Distinct pairs the broad phase handed to the narrow phase
+    long long pairsHit;        // ...and how many of them overlapped
+    long long bruteForcePairs; // Tests an all-pairs check would have run
+};
+CollisionStats gCollisionStats = {0, 0, 0};
+std::vector<CollisionStats> gChunkStats; // Per job chunk (grid row), sized with the grid
+
+// --- Job System ---
+// Small work-stealing pool built on SDL threads. Each worker owns a deque: it pops
+// its own newest job, and when that is empty steals the oldest job of another.
+typedef void (*JobFunction)(void* context, int begin, int end);
+
+struct Job {
+    JobFunction fn;
+    void* context;
+    int begin;
+    int end;
+};
+
+struct WorkerQueue {
+    SDL_mutex* lock;
+    std::deque<Job> jobs;
+};
+
+struct JobSystem {
+    int threadCount;                  // Including the main thread (worker 0)
+    std::vector<WorkerQueue*> queues; // One per worker
+    std::vector<SDL_Thread*> threads;
+    SDL_sem* wake;                    // Posted to wake sleeping workers
+    SDL_sem* batchDone;               // Posted when the last job of a batch finishes
+    std::atomic<int> pending;         // Jobs of the current batch not finished yet
+    std::atomic<bool> quit;
+    std::atomic<long> steals;
+};
+JobSystem gJobs;
+
+// Previous-tick positions (rendering interpolates between these and the current ones)
+int gPrevPlayerX[MAX_PLAYERS] = {PLAYER_START_X, PLAYER_START_X + PLAYER_SPACING};
+int gPrevPlayerY[MAX_PLAYERS] = {PLAYER_START_Y, PLAYER_START_Y};
+double gPrevBallX = 300.0;
+double gPrevBallY = 50.0;
+int gPrevCameraX = 0;
+int gPrevCameraY = 0;
+
+// Tick length (see --sim-hz)
+int gSimHz = SIM_TICKS_PER_SECOND;
+double gTickMs = SIM_TICK_MS;
+double gTickScale = 1.0; // Tick length in default-rate ticks; scales every per-tick velocity
+
+// --- Simulation Statistics ---
+struct SimStats {
+    long ticks;
+    double totalMs;
+    double worstMs;
+};
+SimStats gSimStats = {0, 0.0, 0.0};
+
+// Dirty-rect renderer state: what was on screen after the last frame
+bool gDirtyRectMode = false;
+SDL_Rect gLastSpriteRects[MAX_SPRITE_RECTS];
+int gLastSpriteRectCount = 0;
+bool gDrawnGravityOn = false;
+bool gDrawnPlatformLoss = false;
+int gDrawnViewX = 0;
+int gDrawnViewY = 0;
+
+// Composited background (everything draw_background() draws), redrawn only when
+// the state it depends on changes
+struct BackgroundCache {
+    SDL_Surface* surface;
+    bool valid;        // Cleared when sprites change under it
+    bool gravityOn;    // State it was composed for
+    bool platformLoss;
+    int viewX, viewY;  // Camera position it was composed for
+    long hits;         // Restores served from the cache
+    long rebuilds;     // Times it was recomposed
+};
+BackgroundCache gBackground = {NULL, false, false, false, 0, 0, 0, 0};
+
+// Frame presentation prepared by render_scene() for present_frame()
+bool gPresentFull = true;
+SDL_Rect gPresentRects[MAX_SPRITE_RECTS * 2];
+int gPresentRectCount = 0;
+
+// --- Frame Phase Timing ---
+// Each main loop iteration is split into phases that are timed separately and
+// kept in a fixed ring buffer, shown by the F3 overlay.
+enum FramePhase {
+    PHASE_EVENTS,
+    PHASE_UPDATE,
+    PHASE_RENDER,
+    PHASE_PRESENT,
+    PHASE_COUNT,
+    PHASE_TOTAL = PHASE_COUNT // Extra column: the whole frame (without the cap delay)
+};
+const char* const PHASE_NAMES[PHASE_COUNT + 1] = {"EVENTS", "UPDATE", "RENDER", "PRESENT", "FRAME"};
+const Uint8 HUD_PHASE_RGB[PHASE_COUNT + 1][3] = {
+    {240, 200, 60}, {80, 220, 80}, {80, 150, 255}, {230, 90, 230}, {230, 230, 230}
+};
+
+struct FrameTimings {
+    float ms[FRAME_HISTORY][PHASE_COUNT + 1];
+    int next;  // Slot for the next frame
+    int count; // Filled slots (up to FRAME_HISTORY)
+};
+FrameTimings gFrameTimings;
+bool gShowTimingHud = false;
+
+// HUD font: 3x5 glyphs, one octal digit per row (top row first, 4 = left pixel)
+const char* const HUD_FONT_CHARS = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:-/%";
+const int HUD_FONT_GLYPHS[] = {
+    075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075711,
+    025755, 065656, 034443, 065556, 074647, 074644, 034553, 055755, 072227, 011152,
+    055655, 044447, 057755, 065555, 025552, 065644, 025573, 065655, 034216, 072222,
+    055557, 055552, 055775, 055255, 055222, 071247,
+    000002, 002020, 000700, 011244, 051245
+};
+
+// --- Render Statistics ---
+struct RenderStats {
+    long frames;
+    long fullRedraws;
+    double pixelsPresented; // Summed over all frames
+    long spritesDrawn;
+    long spritesCulled;     // Outside the view, skipped before blitting
+};
+RenderStats gRenderStats = {0, 0, 0.0, 0, 0};
+
+// --- Render Snapshot ---
+// Everything the renderer reads, copied out of the game state once per frame, so
+// drawing never looks at live simulation globals. With --render-thread the
+// snapshots go through a triple buffer to a render thread: the main thread keeps
+// simulating the next ticks while the last snapshot is drawn and presented.
+struct RenderSnapshot {
+    double alpha;                 // Interpolation factor between the previous and the current tick
+    int playerCount;
+    int playerX[MAX_PLAYERS], playerY[MAX_PLAYERS], prevPlayerX[MAX_PLAYERS], prevPlayerY[MAX_PLAYERS];
+    int playerDirection[MAX_PLAYERS];
+    double ballX, ballY, prevBallX, prevBallY;
+    bool ballGrabbed;
+    int cameraX, cameraY, prevCameraX, prevCameraY;
+    int targetX, targetY;
+    int followerX, followerY;
+    bool mouseDown;
+    bool gravityOn;
+    bool platformLoss;
+    int score;
+    int poolCount;
+    const float* poolX;           // gBallPool's arrays, or poolCopyX/Y when handed to another thread
+    const float* poolY;
+    std::vector<float> poolCopyX, poolCopyY;
+    ParticlePool particles;       // Points at gParticles' arrays, or the copies below
+    std::vector<float> particleCopy;
+    std::vector<Uint8> particleColorCopy;
+    Sprite sprites[SPRITE_COUNT];
+    long spritesVersion;          // gSpritesVersion when the sprites were copied
+    bool showHud;
+    float phaseMs[PHASE_COUNT];   // EVENTS and UPDATE, measured on the main thread
+    std::chrono::steady_clock::time_point inputTime; // When this frame's input was read
+    bool lateLatch;               // Re-read the live mouse right before drawing the cursor (not when replaying)
+};
+
+// Triple buffer: the main thread fills slots[writing] and swaps it with ready;
+// the render thread swaps ready with slots[reading] when SNAPSHOT_FRESH is set.
+const int SNAPSHOT_FRESH = 4; // Flag bit in ready, above the slot index
+struct RenderPipeline {
+    RenderSnapshot slots[3];
+    int writing;                  // Main thread only
+    int reading;                  // Render thread only
+    std::atomic<int> ready;       // Latest published slot (| SNAPSHOT_FRESH until taken)
+    SDL_Thread* thread;           // NULL when rendering on the main thread
+    SDL_sem* published;           // Posted once per published snapshot
+    SDL_mutex* videoLock;         // SDL 1.2 video isn't thread-safe: event pumping and presenting take turns
+    std::atomic<bool> quit;
+};
+RenderPipeline gPipeline;
+
+// Renderer-side state (render thread, or main thread without one)
+Sprite gRenderSprites[SPRITE_COUNT]; // Copied from the snapshot when its version changes
+long gDrawnSpritesVersion = -1;
+int gViewX = 0; // Camera of the frame being drawn (interpolated)
+int gViewY = 0;
+std::chrono::steady_clock::time_point gCursorSampleTime; // When the drawn cursor position was read
+
+// --- Pipeline Statistics ---
+struct PipelineStats {
+    bool renderThread;
+    long loops;                   // Main loop iterations (snapshots produced)
+    double wallMs;                // Main loop run time
+    std::vector<float> latencyMs; // Input read -> frame presented, per frame
+    std::vector<float> cursorLatencyMs; // Cursor position read -> frame presented, per frame
+    long motionEvents;            // SDL_MOUSEMOTION events received
+    long motionUpdates;           // ... collapsed into this many position updates
+};
+PipelineStats gPipelineStats;
+
+// --- Tick Input ---
+// Everything the player does, reduced to what one simulation tick needs. Live
+// input, the headless script and replays all produce these.
+enum {
+    INPUT_LEFT = 1 << 0,
+    INPUT_RIGHT = 1 << 1,
+    INPUT_UP = 1 << 2,
+    INPUT_DOWN = 1 << 3,
+    INPUT_PRESS = 1 << 4,      // Left button went down (at mouseX/Y)
+    INPUT_RELEASE = 1 << 5,    // Left button went up
+    INPUT_MOUSE_MOVED = 1 << 6, // mouseX/Y is a new cursor position
+    INPUT_REWIND = 1 << 7       // Step back one saved tick instead of simulating
+};
+
+struct TickInput {
+    Uint8 flags; // INPUT_* flags
+    Sint16 mouseX;
+    Sint16 mouseY;
+};
+TickInput gPendingInput = {0, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2}; // Collected by handle_events() until the next tick
+
+struct InputLog {
+    FILE* file;
+    bool recording;
+    bool replaying;
+    Uint32 seed;
+    Uint32 ticks;     // Ticks recorded so far, or ticks in the replay
+    Uint32 checksum;  // Replay: final state checksum stored in the log
+    Uint32 position;  // Replay: ticks read so far
+    TickInput run;    // Current run of identical ticks
+    int runLength;    // Recording: ticks in the run; replay: ticks left in it
+};
+InputLog gInputLog = {NULL, false, false, 0, 0, 0, 0, {0, 0, 0}, 0};
+
+// --- Networked Two-Player Mode ---
+// Deterministic lockstep: both peers run the whole simulation, and a tick only runs
+// once both players' input for it has arrived. Input is sampled NET_INPUT_DELAY
+// ticks before the tick it is for, which hides most of the round trip. Every
+// packet repeats the inputs the peer hasn't acknowledged yet, so a lost packet
+// needs no retransmission of its own. Every NET_SYNC_INTERVAL ticks each side
+// also sends its packed state, delta-compressed against the last one the other
+// side acknowledged, with its checksum; the receiver compares it with its own
+// state for that tick to catch desyncs. The host is the first player and owns the
+// mouse (ball, buttons); the guest is the partner and steers with its keys.
+enum NetPacketType {
+    NET_HELLO,      // Guest -> host: version and level fingerprint
+    NET_WELCOME,    // Host -> guest: version, seed, the options that change the sim and level fingerprint
+    NET_TICK,       // Either way: acks, inputs and maybe a state sync
+    NET_BYE         // Either way: leaving
+};
 
-// Follower (Cursor Image) variables
-int gFollowerX = SCREEN_WIDTH / 2;
-int gFollowerY = SCREEN_HEIGHT / 2;
-bool gIsMouseDown = false; 
+struct NetReader {
+    const Uint8* data;
+    const Uint8* end;
+    bool ok;        // Cleared by reading past the end
+};
 
-// Player variables
-int gPlayerX = PLAYER_START_X;
-int gPlayerY = PLAYER_START_Y;
-bool gTargetColliding = false; 
-int gPlayerDirection = PLAYER_FACING_RIGHT; 
+struct NetSync {
+    Uint32 tick;                        // State after this many ticks (NET_NO_TICK: empty slot)
+    Uint32 checksum;                    // game_state_checksum() of it
+    int size;
+    Uint8 bytes[4 + GAME_STATE_PACK_MAX]; // ball_pool_checksum(), then pack_game_state()
+};
 
-// Target (Image/Box) variables
-int gTargetX = SCREEN_WIDTH - 150;
-int gTargetY = SCREEN_HEIGHT - 150;
+struct NetSession {
+    bool active;
+    bool host;
+    bool socketOpen;
+    NetSocket socket;
+    sockaddr_in peer;
+    Uint8 welcome[32];                          // Host: sent again if the guest's HELLOs keep coming
+    int welcomeSize;
+    Uint32 tick;                                // Next tick to simulate
+    TickInput localInputs[NET_INPUT_WINDOW];    // By tick % NET_INPUT_WINDOW
+    std::chrono::steady_clock::time_point sampled[NET_INPUT_WINDOW]; // When each local input was read
+    Uint32 localCount;                          // Local inputs sampled so far
+    TickInput remoteInputs[NET_INPUT_WINDOW];
+    Uint32 remoteCount;                         // Partner inputs received, in order
+    Uint32 peerInputAck;                        // Local inputs the partner has
+    Uint32 peerSendTime;                        // Latest send time from the partner, echoed back
+    Uint32 lastEcho;                            // Latest of our send times it echoed
+    Uint32 lastSendMs;
+    Uint32 lastReceiveMs;
+    NetSync ownSyncs[NET_SYNC_HISTORY];         // By (tick / NET_SYNC_INTERVAL) % NET_SYNC_HISTORY
+    NetSync peerSyncs[NET_SYNC_HISTORY];
+    Uint32 newestSync;                          // Newest own sync (NET_NO_TICK: none yet)
+    Uint32 peerSyncAck;                         // Newest own sync the partner has decoded
+    Uint32 syncAck;                             // Newest partner sync decoded here
+    Uint32 lastCompared;                        // Newest sync tick checked against our own
+    bool peerLeft;
 
-// Beachball Physics Variables
-double gBallX = 300.0;
-double gBallY = 50.0;
-double gBallVelX = 3.0;
-double gBallVelY = 0.0; 
+    // Statistics
+    Uint32 startMs;
+    long bytesSent, bytesReceived;
+    long packetsSent, packetsReceived;
+    long syncsSent, syncBytesSent;              // Syncs put in packets, and their encoded size
+    long syncsCompared, desyncs;
+    std::vector<float> latencyMs;               // Per tick: local input read to simulated
+    double stallMs;                             // Time spent waiting for the partner's input
+    bool stalled;
+    std::chrono::steady_clock::time_point stallStart;
+    double rttTotalMs;
+    long rttSamples;
+};
+NetSession gNet;
 
-// Platformer Mode & Interaction States
-bool gGravityOn = false;        
-bool gPlatformLoss = false;     
-double gPlayerVelY = 0.0;       
-bool gIsOnGround = false;       
-bool gBallGrabbed = false;      
+// --- Command Line Options ---
+struct LaunchOptions {
+    bool headless;        // Run the simulation without a window and benchmark it
+    long headlessTicks;   // Number of ticks to run in headless mode
+    bool dirtyRects;      // Only redraw and present the areas that changed
+    bool looseAssets;     // Skip the asset pack and load the BMP files
+    bool buildPack;       // Write the asset pack and exit
+    int stressBalls;      // Extra beachballs for stress mode (0 = off)
+    bool stressSweep;     // Find how many pool balls the sim can handle per tick
+    bool ballCollisions;  // Collide pool balls with each other
+    bool collisionBench;  // Cross-check and time the batched collision kernel
+    bool blitBench;       // Cross-check and time the colorkey blitter
+    bool motionCheck;     // Check that queued mouse motion reaches the next tick
+    bool jumpCheck;       // Check that a jump peaks as high at every --sim-hz
+    bool renderThread;    // Draw and present on a separate thread
+    bool noAudio;         // Don't open the audio device
+    int threads;          // Threads for the physics step (1 = main thread only)
+    int simHz;            // Simulation ticks per second
+    bool threadBench;     // Measure physics scaling from 1 to N threads
+    const char* recordPath; // Write the session's input to this log
+    const char* replayPath; // Play this input log back instead of live input
+    const char* levelPath;  // Tile level to play in gravity mode instead of the platform
+    const char* buildLevelPath; // Write a synthetic one-screen level here and exit
+    bool levelBench;      // Time level loading, collision and drawing on large levels
+    bool particleBench;   // Time the particle update and the budgeted particle drawing
+    bool hotReload;       // Reload sprite BMPs when they are saved
+    int hostPort;         // Host a two-player game on this UDP port (0 = no)
+    const char* joinAddress; // Join a two-player game at ADDRESS:PORT
+};
 
 // --- Function Declarations ---
 bool init();
-bool load_media();
+bool load_media(bool looseAssets);
+bool load_loose_media();
+SDL_Surface* decode_sprite_file(int id);
+void deliver_sprite(int id, int page, const SDL_Rect& source);
+int asset_loader_main(void* data);
+bool start_asset_loader(bool looseAssets);
+void install_sprite(const LoadedSprite& loaded);
+bool poll_asset_loader();
+void stop_asset_loader();
+int sprite_for_file(const char* name);
+int hot_reload_main(void* data);
+bool start_hot_reload();
+bool renderer_done_with_sprites(long version);
+void poll_hot_reload();
+void stop_hot_reload();
+bool map_file(const char* path, MappedFile& mapped);
+void unmap_file(MappedFile& mapped);
+bool load_media_from_pack(const char* path);
+int build_asset_pack(const char* path);
+bool level_open(const char* path);
+void level_close();
+bool level_fingerprint(const char* path, LevelFingerprint& print);
+bool same_level(const LevelFingerprint& a, const LevelFingerprint& b);
+void print_level(std::ostream& out, const LevelFingerprint& print);
+void net_write_level(Uint8*& out, const LevelFingerprint& print);
+LevelFingerprint net_read_level(NetReader& in);
+Uint8* decode_level_chunk(const LevelChunkEntry& entry);
+const Uint8* level_chunk(int chunkX, int chunkY);
+int level_tile(int tileX, int tileY);
+int tile_floor(int pixel);
+bool level_tiles_hit(int firstColumn, int firstRow, int lastColumn, int lastRow, int typeMask);
+bool level_box_hits(int x, int y, int w, int h, int typeMask);
+bool level_collide_player(PlayerState& player, int startX, double moveY);
+void draw_level_tiles(SDL_Surface* target, int viewX, int viewY);
+int synthetic_tile(int x, int y, int height);
+bool build_synthetic_level(const char* path, int width, int height);
+int run_level_bench();
+void free_media();
+bool atlas_add(Atlas& atlas, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int& page, SDL_Rect& rect);
+bool atlas_replace(Atlas& atlas, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int page, SDL_Rect& rect);
+void atlas_copy(SDL_Surface* target, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int x, int y);
+void atlas_free(Atlas& atlas);
+bool blit_colorkey_32(const SDL_Surface* src, const SDL_Rect& source, SDL_Surface* dst, int x, int y);
+bool draw_sprite(int id, int x, int y);
+SDL_Rect sprite_bounds(int id, int x, int y);
+void print_startup_stats();
+void synthesize_sounds(int frequency, int channels);
+int audio_thread_main(void* data);
+bool audio_start();
+void audio_stop();
+void play_sound(SoundId id);
+void ball_bounce_feedback(double speed, double x, double y);
+void print_audio_stats();
 void handle_events(bool& running);
+void handle_left_click(int x, int y);
+void handle_left_release();
+int register_widget(const SDL_Rect& rect, bool (*visible)(const UiState&), int (*sprite)(const UiState&), void (*onClick)());
+int widget_at(int x, int y, const UiState& ui);
+void draw_widgets(const UiState& ui);
+void register_widgets();
+void place_players(int x, int y);
+void seed_game_random(Uint32 seed);
+Uint32 game_random();
+TickInput take_live_input(const Uint8* keystates);
+void apply_tick_input(const TickInput& input, Uint8* keystates);
+bool input_log_record(const char* path, Uint32 seed, const LaunchOptions& options);
+bool input_log_replay(const char* path, LaunchOptions& options);
+void input_log_write(const TickInput& input);
+bool input_log_read(TickInput& input);
+bool input_log_close(Uint32 finalChecksum);
+Uint32 net_now_ms();
+void net_write(Uint8*& out, Uint32 value, int bytes);
+Uint32 net_read(NetReader& in, int bytes);
+bool net_open_socket(int port);
+void net_send_packet(const Uint8* packet, int size);
+int net_receive_packet(Uint8* packet, bool anySender);
+bool net_connect(LaunchOptions& options, Uint32& seed);
+int net_delta_encode(const Uint8* bytes, const Uint8* base, int size, Uint8* out);
+bool net_delta_decode(NetReader& in, const Uint8* base, int size, Uint8* bytes);
+NetSync* net_find_sync(NetSync* history, Uint32 tick);
+void net_send_tick();
+void net_handle_tick(NetReader& in);
+void net_compare_sync(Uint32 tick);
+bool net_poll();
+bool net_take_inputs(TickInput& first, TickInput& partner);
+void net_end_tick();
+void apply_partner_input(const TickInput& input, Uint8* keystates);
+void net_close();
+void print_net_stats();
 bool check_collision(const SDL_Rect& A, const SDL_Rect& B);
+Uint32 collide_box_batch(int ax, int ay, int aw, int ah,
+                         const int* x, const int* y, const int* w, const int* h, int count);
 void move_target_randomly(); 
+bool sweep_box(double x, double y, int w, int h, double moveX, double moveY, const SDL_Rect& target,
+               double& time, int& normalX, int& normalY);
+double wall_hit_time(double position, double move, double low, double high);
+bool bounce_off_player(const PlayerState& player, double& ballX, double& ballY, double& velX, double& velY);
+bool sweep_ball_against_player(int index, double startX, double startY);
 void update_ball_physics();
-void update_state();
-void render_scene();
+bool ball_pool_create(int count);
+void ball_pool_destroy();
+void integrate_balls(int begin, int end);
+void integrate_balls_job(void* context, int begin, int end);
+void find_ball_pairs_job(void* context, int begin, int end);
+void update_ball_pool();
+bool particle_pool_create(int capacity);
+void particle_pool_destroy();
+float particle_random();
+void emit_particles(float x, float y, int count, float velX, float velY, float spread, int color);
+void update_particles();
+int draw_particles(SDL_Surface* target, const ParticlePool& particles, double alpha, int viewX, int viewY, int budget, SDL_Rect& area);
+void print_particle_stats();
+void grid_build();
+void grid_find_ball_pairs(int cellBegin, int cellEnd, std::vector<BallPair>& pairs, CollisionStats& stats);
+void collide_ball_pool();
+bool grid_player_hits_target();
+void print_collision_stats();
+Uint32 fnv1a(Uint32 hash, const void* data, size_t size);
+Uint32 ball_pool_checksum();
+Uint32 game_state_checksum();
+int pack_game_state(Uint8* out);
+int find_pool_ball_at(int x, int y);
+void save_previous_state();
+void rewind_save();
+bool rewind_step();
+void set_sim_rate(int hz);
+void set_world_size(int width, int height);
+void update_camera();
+bool on_screen(int x, int y, int w, int h);
+int scaled_move(double speed, double& remainder);
+void update_player(PlayerState& player, const PlayerKeys& keys, const Uint8* keystates);
+void update_state(const Uint8* keystates);
+void draw_background(const RenderSnapshot& frame);
+void restore_background(const RenderSnapshot& frame, const SDL_Rect* area);
+int draw_sprites(const RenderSnapshot& frame, SDL_Rect* bounds);
+void capture_snapshot(RenderSnapshot& frame, double alpha, bool copyPool);
+void render_scene(const RenderSnapshot& frame);
+void present_frame();
+void draw_frame(const RenderSnapshot& frame);
+int render_thread_main(void* data);
+bool render_thread_start();
+void render_thread_stop();
+void publish_snapshot();
+void print_pipeline_stats();
+void print_render_stats();
+float lap_ms(std::chrono::steady_clock::time_point& mark);
+void record_frame_timings(const float* phaseMs);
+void timing_summary(int column, float& current, float& average, float& p99);
+void draw_hud_text(const char* text, int x, int y, Uint32 color);
+SDL_Rect draw_timing_hud();
+void print_frame_timings();
 void clean_up();
+bool job_system_start(int threadCount);
+void job_system_stop();
+void parallel_for(JobFunction fn, void* context, int count, int chunkSize);
+void reset_game_state();
+bool parse_args(int argc, char* args[], LaunchOptions& options);
+TickInput script_input(int script, bool firstTick);
+int run_headless(long ticks);
+int run_stress_sweep();
+int run_collision_bench();
+int run_blit_bench();
+int run_motion_check();
+int run_jump_check();
+int run_particle_bench();
+int run_thread_bench(int maxThreads, int balls);
+void print_sim_stats();
 
 /**
  * @brief Initializes the SDL video subsystem, creates the window.
@@ -145,530 +1256,5758 @@ bool init() {
  * @brief Cleans up and shuts down SDL.
  */
 void clean_up() {
-    if (gTextSurface != NULL) SDL_FreeSurface(gTextSurface);
-    if (gSignSurface != NULL) SDL_FreeSurface(gSignSurface); 
-    if (gCursorSurface != NULL) SDL_FreeSurface(gCursorSurface);
-    if (gCursorClickSurface != NULL) SDL_FreeSurface(gCursorClickSurface); 
-    if (gPlayerRightSurface != NULL) SDL_FreeSurface(gPlayerRightSurface); 
-    if (gPlayerLeftSurface != NULL) SDL_FreeSurface(gPlayerLeftSurface);   
-    if (gBallSurface != NULL) SDL_FreeSurface(gBallSurface);     
-    if (gTargetSurface != NULL) SDL_FreeSurface(gTargetSurface); 
-    if (gPlatformSurface != NULL) SDL_FreeSurface(gPlatformSurface);
-    if (gPlatformLoseSurface != NULL) SDL_FreeSurface(gPlatformLoseSurface);
-    if (gButtonOnSurface != NULL) SDL_FreeSurface(gButtonOnSurface);
-    if (gButtonOffSurface != NULL) SDL_FreeSurface(gButtonOffSurface);
-    if (gButtonRetrySurface != NULL) SDL_FreeSurface(gButtonRetrySurface); 
+    render_thread_stop();
+    audio_stop();
+    stop_hot_reload();
+    stop_asset_loader();
+    free_media();
+    if (gBackground.surface != NULL) SDL_FreeSurface(gBackground.surface);
+    gBackground.surface = NULL;
+    ball_pool_destroy();
+    particle_pool_destroy();
+    job_system_stop();
+    level_close();
+    net_close();
 
     SDL_Quit();
     std::cout << "Cleanup complete." << std::endl;
 }
 
 /**
- * @brief Loads all necessary media: images.
+ * @brief Loads all necessary media: images. Uses the memory-mapped asset pack
+ *        when there is a usable one, otherwise the loose BMP files. Runs on the
+ *        loader thread; every finished sprite goes to deliver_sprite().
+ */
+bool load_media(bool looseAssets) {
+    auto start = std::chrono::steady_clock::now();
+    bool success = !looseAssets && load_media_from_pack(ASSET_PACK_FILE);
+    gStartupStats.mediaSource = success ? "asset pack" : "loose BMPs";
+    if (!success) {
+        success = load_loose_media();
+    }
+    gStartupStats.mediaMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return success;
+}
+
+/**
+ * @brief Loads every sprite not delivered yet from its own BMP file, converts it
+ *        to the display format and packs it into the atlas (the fallback when
+ *        the asset pack is missing or incomplete).
  */
-bool load_media() {
+bool load_loose_media() {
     bool success = true;
 
     // --- Transparency Key Correction ---
     // Using the specific Blue color provided: R=0, G=162, B=232
-    const Uint8 BLUE_R = 0;
-    const Uint8 BLUE_G = 162;
-    const Uint8 BLUE_B = 232;
-    Uint32 transparency_key = SDL_MapRGB(gScreen->format, BLUE_R, BLUE_G, BLUE_B); 
+    Uint32 transparency_key = SDL_MapRGB(gScreen->format, TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B); 
     
-    // --- Helper function for loading BMPs ---
-    auto load_and_optimize = [](const char* filename, SDL_Surface*& surface, Uint32 colorKey) -> bool {
-        surface = SDL_LoadBMP(filename);
-        if (surface == NULL) {
-            std::cerr << "ERROR: Failed to load " << filename << "! SDL Error: " << SDL_GetError() << std::endl;
-            return false;
-        }
-        SDL_Surface* optimized = SDL_DisplayFormat(surface);
-        SDL_FreeSurface(surface);
-        surface = optimized;
-        
-        // Apply the specified color key for transparency
-        if (colorKey != 0) {
-            SDL_SetColorKey(surface, SDL_SRCCOLORKEY, colorKey);
+    for (int id = 0; id < SPRITE_COUNT && !gAssetLoader.cancel; ++id) {
+        if (gAssetLoader.delivered[id]) continue;
+        const SpriteSource& source = SPRITE_SOURCES[id];
+
+        SDL_Surface* optimized = decode_sprite_file(id);
+        if (optimized == NULL) {
+            success = false;
+            continue;
         }
-        return true;
-    };
-    
-    // Load all assets using the specific blue transparency key
-    success &= load_and_optimize("text.bmp", gTextSurface, transparency_key);
-    success &= load_and_optimize("sign.bmp", gSignSurface, transparency_key);
-    success &= load_and_optimize("cursor.bmp", gCursorSurface, transparency_key); 
-    success &= load_and_optimize("cursor_click.bmp", gCursorClickSurface, transparency_key); 
-    success &= load_and_optimize("beachball.bmp", gBallSurface, transparency_key); 
-    success &= load_and_optimize("target.bmp", gTargetSurface, transparency_key);
-    success &= load_and_optimize("player_right.bmp", gPlayerRightSurface, transparency_key); 
-    success &= load_and_optimize("player_left.bmp", gPlayerLeftSurface, transparency_key);
-    success &= load_and_optimize("platform.bmp", gPlatformSurface, transparency_key);
-    success &= load_and_optimize("platformlose.bmp", gPlatformLoseSurface, transparency_key);
-    success &= load_and_optimize("but_grav_on.bmp", gButtonOnSurface, transparency_key);
-    success &= load_and_optimize("but_grav_off.bmp", gButtonOffSurface, transparency_key);
-    success &= load_and_optimize("but_grav_retry.bmp", gButtonRetrySurface, transparency_key); 
 
-    if (!success) {
-        std::cerr << "FATAL: One or more required images failed to load." << std::endl;
+        Uint32 spriteKey = SDL_MapRGB(gScreen->format, source.keyR, source.keyG, source.keyB);
+        int page;
+        SDL_Rect rect;
+        if (atlas_add(gAtlas, optimized, spriteKey, transparency_key, page, rect)) {
+            deliver_sprite(id, page, rect);
+        } else {
+            std::cerr << "ERROR: No room for " << source.file << " in the sprite atlas!" << std::endl;
+            success = false;
+        }
+        SDL_FreeSurface(optimized);
     }
-    
+
     return success; 
 }
 
 /**
- * @brief Handles user input and system events.
+ * @brief Loads one sprite's BMP and converts it to the screen format. Safe to call
+ *        off the main thread.
+ * @return The converted surface (the caller frees it), or NULL after printing why.
  */
-void handle_events(bool& running) {
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
-            running = false;
-        }
-        
-        // --- Mouse Button Tracking ---
-        if (event.type == SDL_MOUSEBUTTONDOWN) {
-            if (event.button.button == SDL_BUTTON_LEFT) { 
-                gIsMouseDown = true;
-                
-                // 1. Check for Gravity Toggle Button Click (Only available if NOT in loss state)
-                SDL_Rect toggleRect = {TOGGLE_BUTTON_X, TOGGLE_BUTTON_Y, TOGGLE_BUTTON_WIDTH, TOGGLE_BUTTON_HEIGHT};
-                if (!gPlatformLoss && 
-                    event.button.x >= toggleRect.x && event.button.x < toggleRect.x + toggleRect.w &&
-                    event.button.y >= toggleRect.y && event.button.y < toggleRect.y + toggleRect.h) 
-                {
-                    gGravityOn = !gGravityOn; // Toggle gravity mode
-                    
-                    // Reset platformer state when changing mode
-                    gPlatformLoss = false;
-                    gPlayerVelY = 0.0;
-                    gIsOnGround = false;
-                    gPlayerX = PLAYER_START_X; // Reset player to safe start point
-                    gPlayerY = PLAYER_START_Y;
-                    
-                    // Reset ball physics if switching off gravity and ball isn't grabbed
-                    if (!gGravityOn && !gBallGrabbed) {
-                        gBallVelY = 0.0;
-                    }
-                }
-
-                // 2. Check for Retry Button Click (Only available if IN loss state)
-                if (gPlatformLoss) {
-                    SDL_Rect retryRect = {RETRY_BUTTON_X, RETRY_BUTTON_Y, RETRY_BUTTON_WIDTH, RETRY_BUTTON_HEIGHT};
-                    
-                    if (event.button.x >= retryRect.x && event.button.x < retryRect.x + retryRect.w &&
-                        event.button.y >= retryRect.y && event.button.y < retryRect.y + retryRect.h) 
-                    {
-                        // Reset the loss state and player position
-                        gPlatformLoss = false;
-                        gPlayerX = PLATFORM_X + (PLATFORM_WIDTH / 2) - (PLAYER_WIDTH / 2); // Start near the platform center
-                        gPlayerY = PLATFORM_Y - PLAYER_HEIGHT - 10; // Start slightly above the platform
-                        gPlayerVelY = 0.0;
-                        gIsOnGround = false;
-                    }
-                }
-                
-                // 3. Check for Beachball Grab
-                // Only allow grabbing if we are not in the loss state
-                if (!gPlatformLoss) {
-                    SDL_Rect ballBox = {(Sint16)gBallX, (Sint16)gBallY, (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT};
-                    SDL_Rect clickArea = {(Sint16)event.button.x, (Sint16)event.button.y, 1, 1}; 
-                    
-                    if (check_collision(ballBox, clickArea)) {
-                        gBallGrabbed = true;
-                        gBallVelX = 0.0; // Stop ball physics when grabbed
-                        gBallVelY = 0.0;
-                    }
-                }
-            }
-        } else if (event.type == SDL_MOUSEBUTTONUP) {
-            if (event.button.button == SDL_BUTTON_LEFT) {
-                gIsMouseDown = false;
-                gBallGrabbed = false; // Release the ball
-            }
-        }
+SDL_Surface* decode_sprite_file(int id) {
+    const char* file = SPRITE_SOURCES[id].file;
+    SDL_Surface* loaded = SDL_LoadBMP(file);
+    if (loaded == NULL) {
+        std::cerr << "ERROR: Failed to load " << file << "! SDL Error: " << SDL_GetError() << std::endl;
+        return NULL;
+    }
+    // (SDL_ConvertSurface rather than SDL_DisplayFormat: this runs off the main thread)
+    SDL_Surface* optimized = SDL_ConvertSurface(loaded, gScreen->format, SDL_SWSURFACE);
+    SDL_FreeSurface(loaded);
+    if (optimized == NULL) {
+        std::cerr << "ERROR: Failed to convert " << file << "! SDL Error: " << SDL_GetError() << std::endl;
+    }
+    return optimized;
+}
 
-        // --- Follower (Mouse) Position Logic ---
-        if (event.type == SDL_MOUSEMOTION) {
-            int mouseX = event.motion.x;
-            int mouseY = event.motion.y;
-            
-            if (gCursorSurface != NULL) {
-                // gFollowerX/Y is calculated to be the top-left corner needed to center the cursor image
-                int cursorWidth = gCursorSurface->w;
-                int cursorHeight = gCursorSurface->h;
-                
-                gFollowerX = mouseX - (cursorWidth / 2);
-                gFollowerY = mouseY - (cursorHeight / 2);
-            }
-        }
+/**
+ * @brief Frees the atlas pages, then the asset pack they may point into.
+ */
+void free_media() {
+    atlas_free(gAtlas);
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        gSprites[id].loaded = false;
     }
+    unmap_file(gAssetPack);
 }
 
 /**
- * @brief Performs AABB (Axis-Aligned Bounding Box) collision detection.
+ * @brief Copies a sprite (32bpp, in the atlas pixel layout) onto the next free
+ *        spot of the atlas, opening a new shelf or page when it doesn't fit. The
+ *        sprite's own transparent color becomes the page-wide atlas key.
+ * @return false if the sprite is too big or all pages are used.
  */
-bool check_collision(const SDL_Rect& A, const SDL_Rect& B) {
-    if (A.y + A.h <= B.y) return false; 
-    if (A.y >= B.y + B.h) return false; 
-    if (A.x + A.w <= B.x) return false; 
-    if (A.x >= B.x + B.w) return false; 
-    
+bool atlas_add(Atlas& atlas, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int& page, SDL_Rect& rect) {
+    const SDL_PixelFormat* format = sprite->format;
+    int w = sprite->w;
+    int h = sprite->h;
+    if (format->BytesPerPixel != 4 || w > ATLAS_PAGE_SIZE || h > ATLAS_PAGE_SIZE) return false;
+
+    // 1. Next spot on this shelf, else a new shelf, else a new page
+    if (atlas.openPage >= 0 && atlas.shelfX + w > ATLAS_PAGE_SIZE) {
+        atlas.shelfX = 0;
+        atlas.shelfY += atlas.shelfHeight;
+        atlas.shelfHeight = 0;
+    }
+    if (atlas.openPage < 0 || atlas.shelfY + h > ATLAS_PAGE_SIZE) {
+        if (atlas.pageCount == MAX_ATLAS_PAGES) return false;
+        SDL_Surface* surface = SDL_CreateRGBSurface(SDL_SWSURFACE, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, 32,
+                                                    format->Rmask, format->Gmask, format->Bmask, 0);
+        if (surface == NULL) return false;
+        SDL_FillRect(surface, NULL, atlasKey);
+        SDL_SetColorKey(surface, SDL_SRCCOLORKEY, atlasKey);
+        atlas.pages[atlas.pageCount] = surface;
+        atlas.openPage = atlas.pageCount++;
+        atlas.shelfX = 0;
+        atlas.shelfY = 0;
+        atlas.shelfHeight = 0;
+    }
+
+    // 2. Copy the pixels
+    atlas_copy(atlas.pages[atlas.openPage], sprite, spriteKey, atlasKey, atlas.shelfX, atlas.shelfY);
+
+    page = atlas.openPage;
+    SDL_Rect placed = {(Sint16)atlas.shelfX, (Sint16)atlas.shelfY, (Uint16)w, (Uint16)h};
+    rect = placed;
+    atlas.shelfX += w;
+    atlas.shelfHeight = std::max(atlas.shelfHeight, h);
     return true;
 }
 
 /**
- * @brief Moves the target box to a random, safe location on screen.
+ * @brief Copies a sprite over an area of an atlas page that held an older image,
+ *        keeping its top-left corner; rect shrinks to the sprite's size. The
+ *        caller makes sure nothing draws from that area any more.
+ * @return false (copying nothing) if the sprite isn't 32bpp or doesn't fit in rect.
  */
-void move_target_randomly() {
-    int maxX = SCREEN_WIDTH - TARGET_WIDTH;
-    int maxY = SCREEN_HEIGHT - TARGET_HEIGHT;
-    
-    gTargetX = rand() % maxX;
-    gTargetY = rand() % maxY;
+bool atlas_replace(Atlas& atlas, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int page, SDL_Rect& rect) {
+    if (sprite->format->BytesPerPixel != 4 || sprite->w > rect.w || sprite->h > rect.h) return false;
+    atlas_copy(atlas.pages[page], sprite, spriteKey, atlasKey, rect.x, rect.y);
+    rect.w = (Uint16)sprite->w;
+    rect.h = (Uint16)sprite->h;
+    return true;
 }
 
 /**
- * @brief Updates the position and velocity of the beachball based on physics.
+ * @brief Copies a 32bpp sprite onto an atlas page at (x, y), turning its own
+ *        transparent color into the page-wide atlas key.
  */
-void update_ball_physics() {
-    if (gBallGrabbed) {
-        // Ball follows the cursor (centered on the cursor image)
-        if (gCursorSurface != NULL) {
-            gBallX = gFollowerX + (gCursorSurface->w / 2) - (BALL_WIDTH / 2);
-            gBallY = gFollowerY + (gCursorSurface->h / 2) - (BALL_HEIGHT / 2);
+void atlas_copy(SDL_Surface* target, const SDL_Surface* sprite, Uint32 spriteKey, Uint32 atlasKey, int x, int y) {
+    const SDL_PixelFormat* format = sprite->format;
+    Uint32 colorMask = format->Rmask | format->Gmask | format->Bmask;
+    for (int row = 0; row < sprite->h; ++row) {
+        const Uint32* src = (const Uint32*)((const Uint8*)sprite->pixels + row * sprite->pitch);
+        Uint32* dst = (Uint32*)((Uint8*)target->pixels + (y + row) * target->pitch) + x;
+        for (int col = 0; col < sprite->w; ++col) {
+            dst[col] = (src[col] & colorMask) == spriteKey ? atlasKey : src[col];
         }
-        
-        // Clamp to screen bounds
-        if (gBallX < 0) gBallX = 0;
-        if (gBallX + BALL_WIDTH > SCREEN_WIDTH) gBallX = SCREEN_WIDTH - BALL_WIDTH;
-        if (gBallY < 0) gBallY = 0;
-        if (gBallY + BALL_HEIGHT > SCREEN_HEIGHT) gBallY = SCREEN_HEIGHT - BALL_HEIGHT;
-        
-        return; 
     }
+}
 
-    // 1. Apply Gravity to Y Velocity
-    gBallVelY += FREE_ROAM_GRAVITY;
+/**
+ * @brief Frees every page of an atlas and empties it.
+ */
+void atlas_free(Atlas& atlas) {
+    for (int p = 0; p < atlas.pageCount; ++p) {
+        SDL_FreeSurface(atlas.pages[p]);
+        atlas.pages[p] = NULL;
+    }
+    atlas.pageCount = 0;
+    atlas.openPage = -1;
+}
 
-    // 2. Update Position
-    gBallX += gBallVelX;
-    gBallY += gBallVelY;
-    
-    // 3. Screen Edge Collision (Walls)
-    
-    // Horizontal Bounds
-    if (gBallX < 0) {
-        gBallX = 0;
-        gBallVelX *= -BOUNCE_FACTOR;
-    } else if (gBallX + BALL_WIDTH > SCREEN_WIDTH) {
-        gBallX = SCREEN_WIDTH - BALL_WIDTH;
-        gBallVelX *= -BOUNCE_FACTOR;
-    }
-
-    // Vertical Bounds
-    if (gBallY < 0) { // Top edge
-        gBallY = 0;
-        gBallVelY *= -BOUNCE_FACTOR;
-    } else if (gBallY + BALL_HEIGHT > SCREEN_HEIGHT) { // Bottom edge
-        gBallY = SCREEN_HEIGHT - BALL_HEIGHT;
-        gBallVelY *= -BOUNCE_FACTOR;
-        if (std::abs(gBallVelY) < FREE_ROAM_GRAVITY) {
-            gBallVelY = 0; 
-        }
+/**
+ * @brief Colorkey blit specialized for 32bpp surfaces of the same pixel layout
+ *        (what the atlas pages and the screen use). Copies every source pixel
+ *        that isn't the color key, eight (AVX2) or four (SSE2) at a time, and
+ *        clips to the destination clip rect like SDL_BlitSurface does. Output is
+ *        identical to SDL's: keyed pixels are skipped, the unused byte is 0.
+ * @return false (drawing nothing) if the surfaces don't qualify; the caller
+ *         then uses SDL_BlitSurface.
+ */
+bool blit_colorkey_32(const SDL_Surface* src, const SDL_Rect& source, SDL_Surface* dst, int x, int y) {
+    const SDL_PixelFormat* sf = src->format;
+    const SDL_PixelFormat* df = dst->format;
+    if (sf->BytesPerPixel != 4 || df->BytesPerPixel != 4 || sf->Amask != 0 || df->Amask != 0 ||
+        sf->Rmask != df->Rmask || sf->Gmask != df->Gmask || sf->Bmask != df->Bmask ||
+        (src->flags & (SDL_SRCCOLORKEY | SDL_SRCALPHA | SDL_RLEACCEL)) != SDL_SRCCOLORKEY ||
+        SDL_MUSTLOCK(src) || SDL_MUSTLOCK(dst)) {
+        return false;
     }
-    
-    // 4. Player Collision (AABB) - Check only if not in Platform Loss mode
-    if (!gPlatformLoss) {
-        SDL_Rect playerBox = {(Sint16)gPlayerX, (Sint16)gPlayerY, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
-        SDL_Rect ballBox = {(Sint16)gBallX, (Sint16)gBallY, (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT}; 
-        
-        if (check_collision(playerBox, ballBox)) {
-            // Simple bounce logic (simplified for AABB)
-            int playerCenterX = gPlayerX + PLAYER_WIDTH / 2;
-            int playerCenterY = gPlayerY + PLAYER_HEIGHT / 2;
-            int ballCenterX = (int)gBallX + BALL_WIDTH / 2;
-            int ballCenterY = (int)gBallY + BALL_HEIGHT / 2;
-
-            int dx = ballCenterX - playerCenterX;
-            int dy = ballCenterY - playerCenterY;
-            
-            if (std::abs(dx) > std::abs(dy)) {
-                gBallVelX = std::copysign(gBallVelX * -BOUNCE_FACTOR, (double)dx);
-                if (dx > 0) gBallX = gPlayerX + PLAYER_WIDTH;
-                else gBallX = gPlayerX - BALL_WIDTH;
-            } else {
-                gBallVelY = std::copysign(gBallVelY * -BOUNCE_FACTOR, (double)dy);
-                if (dy > 0) gBallY = gPlayerY + PLAYER_HEIGHT;
-                else gBallY = gPlayerY - BALL_HEIGHT;
+
+    // 1. Clip the source rect to the source surface, then to the destination clip rect
+    int sx = source.x, sy = source.y, w = source.w, h = source.h;
+    if (sx < 0) { x -= sx; w += sx; sx = 0; }
+    if (sy < 0) { y -= sy; h += sy; sy = 0; }
+    w = std::min(w, src->w - sx);
+    h = std::min(h, src->h - sy);
+    const SDL_Rect& clip = dst->clip_rect;
+    if (x < clip.x) { sx += clip.x - x; w -= clip.x - x; x = clip.x; }
+    if (y < clip.y) { sy += clip.y - y; h -= clip.y - y; y = clip.y; }
+    w = std::min(w, clip.x + clip.w - x);
+    h = std::min(h, clip.y + clip.h - y);
+    if (w <= 0 || h <= 0) return true;
+
+    // 2. Copy row by row
+    const Uint32 key = sf->colorkey;
+    const Uint32 colorMask = sf->Rmask | sf->Gmask | sf->Bmask;
+    for (int row = 0; row < h; ++row) {
+        const Uint32* s = (const Uint32*)((const Uint8*)src->pixels + (sy + row) * src->pitch) + sx;
+        Uint32* d = (Uint32*)((Uint8*)dst->pixels + (y + row) * dst->pitch) + x;
+        int i = 0;
+
+#if defined(USE_AVX2)
+        {
+            const __m256i vKey = _mm256_set1_epi32((int)key);
+            const __m256i vMask = _mm256_set1_epi32((int)colorMask);
+            for (; i + 8 <= w; i += 8) {
+                __m256i pixels = _mm256_loadu_si256((const __m256i*)(s + i));
+                __m256i keyed = _mm256_cmpeq_epi32(pixels, vKey);
+                int keyedBits = _mm256_movemask_ps(_mm256_castsi256_ps(keyed));
+                if (keyedBits == 0xFF) continue; // All transparent (common around sprite edges)
+                pixels = _mm256_and_si256(pixels, vMask);
+                if (keyedBits != 0) {
+                    __m256i under = _mm256_loadu_si256((const __m256i*)(d + i));
+                    pixels = _mm256_blendv_epi8(pixels, under, keyed);
+                }
+                _mm256_storeu_si256((__m256i*)(d + i), pixels);
             }
         }
+#endif
+
+#if defined(USE_SSE2)
+        {
+            const __m128i vKey = _mm_set1_epi32((int)key);
+            const __m128i vMask = _mm_set1_epi32((int)colorMask);
+            for (; i + 4 <= w; i += 4) {
+                __m128i pixels = _mm_loadu_si128((const __m128i*)(s + i));
+                __m128i keyed = _mm_cmpeq_epi32(pixels, vKey);
+                int keyedBits = _mm_movemask_ps(_mm_castsi128_ps(keyed));
+                if (keyedBits == 0xF) continue;
+                pixels = _mm_and_si128(pixels, vMask);
+                if (keyedBits != 0) {
+                    // No blendv before SSE4.1: (keyed & under) | (~keyed & pixels)
+                    __m128i under = _mm_loadu_si128((const __m128i*)(d + i));
+                    pixels = _mm_or_si128(_mm_and_si128(keyed, under), _mm_andnot_si128(keyed, pixels));
+                }
+                _mm_storeu_si128((__m128i*)(d + i), pixels);
+            }
+        }
+#endif
+
+        // Remainder (or everything, without SIMD)
+        for (; i < w; ++i) {
+            if (s[i] != key) d[i] = s[i] & colorMask;
+        }
     }
+    return true;
 }
 
 /**
- * @brief Updates the positions of all game objects and checks for collisions.
+ * @brief Draws a sprite with its top-left corner at (x, y).
+ * @return false (drawing nothing) if the sprite hasn't loaded yet.
  */
-void update_state() {
-    Uint8 *keystates = SDL_GetKeyState(NULL);
-    
-    if (!gGravityOn) {
-        // ------------------------------------------------
-        // A. FREE-ROAM MODE (Existing Movement Logic)
-        // ------------------------------------------------
-        
-        bool isHorizontal = keystates[SDLK_LEFT] || keystates[SDLK_RIGHT];
-        bool isVertical = keystates[SDLK_UP] || keystates[SDLK_DOWN];
-        double speedScale = (isHorizontal && isVertical) ? 0.707 : 1.0; 
-        
-        int moveX = 0;
-        int moveY = 0;
+bool draw_sprite(int id, int x, int y) {
+    const Sprite& sprite = gRenderSprites[id];
+    if (!sprite.loaded) return false;
+    SDL_Surface* page = gAtlas.pages[sprite.page];
+    if (!blit_colorkey_32(page, sprite.source, gScreen, x, y)) {
+        SDL_Rect source = sprite.source;
+        SDL_Rect dest = {(Sint16)x, (Sint16)y, 0, 0};
+        SDL_BlitSurface(page, &source, gScreen, &dest);
+    }
+    return true;
+}
 
-        if (keystates[SDLK_UP]) moveY -= PLAYER_VELOCITY;
-        if (keystates[SDLK_DOWN]) moveY += PLAYER_VELOCITY;
-        
-        if (keystates[SDLK_LEFT]) {
-            moveX -= PLAYER_VELOCITY;
-            gPlayerDirection = PLAYER_FACING_LEFT;
-        }
-        if (keystates[SDLK_RIGHT]) {
-            moveX += PLAYER_VELOCITY;
-            gPlayerDirection = PLAYER_FACING_RIGHT;
+/**
+ * @brief Screen area a sprite covers when drawn at (x, y).
+ */
+SDL_Rect sprite_bounds(int id, int x, int y) {
+    SDL_Rect bounds = {(Sint16)x, (Sint16)y, gRenderSprites[id].source.w, gRenderSprites[id].source.h};
+    return bounds;
+}
+
+/**
+ * @brief Whether a w x h box at screen position (x, y) shows on the screen at all.
+ */
+bool on_screen(int x, int y, int w, int h) {
+    return x < SCREEN_WIDTH && y < SCREEN_HEIGHT && x + w > 0 && y + h > 0;
+}
+
+/**
+ * @brief Maps a whole file into memory (copy-on-write, so the pages are shared
+ *        with the OS file cache until something writes to them).
+ */
+bool map_file(const char* path, MappedFile& mapped) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    DWORD size = GetFileSize(file, NULL);
+    HANDLE mapping = size > 0 ? CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL) : NULL;
+    void* data = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0) : NULL;
+    if (mapping != NULL) CloseHandle(mapping); // The view keeps the mapping alive
+    CloseHandle(file);
+    if (data == NULL) return false;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // The mapping stays valid after the descriptor is closed
+    if (data == MAP_FAILED) return false;
+    size_t size = (size_t)info.st_size;
+#endif
+    mapped.data = (Uint8*)data;
+    mapped.size = size;
+    return true;
+}
+
+/**
+ * @brief Releases a mapping made by map_file().
+ */
+void unmap_file(MappedFile& mapped) {
+    if (mapped.data == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+#else
+    munmap(mapped.data, mapped.size);
+#endif
+    mapped.data = NULL;
+    mapped.size = 0;
+}
+
+/**
+ * @brief Wraps the atlas pages around their pixels in the mapped pack, without
+ *        copying, and delivers the sprites. Fails if the pack is missing, damaged
+ *        or was built for a different pixel layout than the screen; sprites
+ *        missing from the pack are left for load_loose_media().
+ */
+bool load_media_from_pack(const char* path) {
+    if (!map_file(path, gAssetPack)) {
+        std::cerr << "No asset pack " << path << ", loading loose BMPs" << std::endl;
+        return false;
+    }
+
+    const PackHeader* header = (const PackHeader*)gAssetPack.data;
+    const SDL_PixelFormat* format = gScreen->format;
+    bool valid = gAssetPack.size >= sizeof(PackHeader) &&
+                 memcmp(header->magic, ASSET_PACK_MAGIC, 4) == 0 &&
+                 header->version == ASSET_PACK_VERSION &&
+                 header->byteOrder == ASSET_PACK_BYTE_ORDER &&
+                 header->pageCount <= (Uint32)(MAX_ATLAS_PAGES - gAtlas.pageCount) &&
+                 gAssetPack.size >= sizeof(PackHeader) + (size_t)header->pageCount * sizeof(PackPage) +
+                                    (size_t)header->spriteCount * sizeof(PackSprite);
+    const PackPage* pages = (const PackPage*)(gAssetPack.data + sizeof(PackHeader));
+    for (Uint32 p = 0; valid && p < header->pageCount; ++p) {
+        valid = pages[p].pitch >= pages[p].width * 4 &&
+                pages[p].offset + (size_t)pages[p].pitch * pages[p].height <= gAssetPack.size;
+    }
+    if (!valid) {
+        std::cerr << "ERROR: " << path << " is not a valid asset pack, loading loose BMPs" << std::endl;
+        unmap_file(gAssetPack);
+        return false;
+    }
+    if (format->BytesPerPixel != 4 || format->Rmask != header->Rmask ||
+        format->Gmask != header->Gmask || format->Bmask != header->Bmask) {
+        std::cerr << "Asset pack layout doesn't match the display, loading loose BMPs" << std::endl;
+        unmap_file(gAssetPack);
+        return false;
+    }
+
+    // 1. Atlas pages straight from the mapping
+    int firstPage = gAtlas.pageCount;
+    for (Uint32 p = 0; p < header->pageCount; ++p) {
+        SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(gAssetPack.data + pages[p].offset, pages[p].width, pages[p].height, 32,
+                                                        pages[p].pitch, header->Rmask, header->Gmask, header->Bmask, 0);
+        if (surface == NULL) return false; // Loose loading adds its own pages after these
+        SDL_SetColorKey(surface, SDL_SRCCOLORKEY, header->colorKey);
+        gAtlas.pages[gAtlas.pageCount++] = surface;
+    }
+
+    // 2. Sprites: a page and a rect each
+    const PackSprite* sprites = (const PackSprite*)(pages + header->pageCount);
+    bool success = true;
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        const PackSprite* entry = NULL;
+        for (Uint32 e = 0; e < header->spriteCount; ++e) {
+            if (strncmp(sprites[e].name, SPRITE_SOURCES[id].file, ASSET_NAME_LENGTH) == 0) entry = &sprites[e];
+        }
+        if (entry == NULL || entry->page >= header->pageCount ||
+            entry->x + entry->w > pages[entry->page].width || entry->y + entry->h > pages[entry->page].height) {
+            std::cerr << "ERROR: " << SPRITE_SOURCES[id].file << " is missing from " << path << std::endl;
+            success = false;
+            continue;
+        }
+        SDL_Rect rect = {(Sint16)entry->x, (Sint16)entry->y, (Uint16)entry->w, (Uint16)entry->h};
+        deliver_sprite(id, firstPage + entry->page, rect);
+    }
+    return success;
+}
+
+/**
+ * @brief Offline packer: converts the loose BMPs to the 32bpp XRGB8888 layout of
+ *        the display, packs them into atlas pages and writes the pages and the
+ *        sprite rects to one file that load_media_from_pack() can map directly.
+ */
+int build_asset_pack(const char* path) {
+    // A 1x1 surface stands in for the display layout (SDL_ConvertSurface wants a format)
+    SDL_Surface* layout = SDL_CreateRGBSurface(SDL_SWSURFACE, 1, 1, 32, ASSET_PACK_RMASK, ASSET_PACK_GMASK, ASSET_PACK_BMASK, 0);
+    if (layout == NULL) return 1;
+    Uint32 colorKey = SDL_MapRGB(layout->format, TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B);
+
+    // 1. Load everything
+    std::vector<SDL_Surface*> converted;
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        SDL_Surface* loaded = SDL_LoadBMP(SPRITE_SOURCES[id].file);
+        if (loaded == NULL) {
+            std::cerr << "ERROR: Failed to load " << SPRITE_SOURCES[id].file << "! SDL Error: " << SDL_GetError() << std::endl;
+            break;
+        }
+        SDL_Surface* surface = SDL_ConvertSurface(loaded, layout->format, SDL_SWSURFACE);
+        SDL_FreeSurface(loaded);
+        if (surface == NULL) break;
+        converted.push_back(surface);
+    }
+
+    // 2. Pack them tallest first, so the shelves waste little height
+    Atlas atlas;
+    memset(&atlas, 0, sizeof(atlas));
+    atlas.openPage = -1;
+    Sprite placed[SPRITE_COUNT];
+    bool complete = (int)converted.size() == SPRITE_COUNT;
+    if (complete) {
+        int order[SPRITE_COUNT];
+        for (int id = 0; id < SPRITE_COUNT; ++id) order[id] = id;
+        std::stable_sort(order, order + SPRITE_COUNT, [&converted](int a, int b) {
+            return converted[a]->h > converted[b]->h;
+        });
+        for (int i = 0; i < SPRITE_COUNT && complete; ++i) {
+            int id = order[i];
+            const SpriteSource& source = SPRITE_SOURCES[id];
+            Uint32 spriteKey = SDL_MapRGB(layout->format, source.keyR, source.keyG, source.keyB);
+            complete = atlas_add(atlas, converted[id], spriteKey, colorKey, placed[id].page, placed[id].source);
+            if (!complete) std::cerr << "ERROR: No room for " << source.file << " in the sprite atlas!" << std::endl;
+        }
+    }
+
+    FILE* file = complete ? fopen(path, "wb") : NULL;
+    bool written = file != NULL;
+    if (complete && file == NULL) {
+        std::cerr << "ERROR: Could not create " << path << std::endl;
+    }
+    if (written) {
+        // 3. Header, page table (each page cut to the height in use) and sprite table
+        PackHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ASSET_PACK_MAGIC, 4);
+        header.version = ASSET_PACK_VERSION;
+        header.byteOrder = ASSET_PACK_BYTE_ORDER;
+        header.pageCount = atlas.pageCount;
+        header.spriteCount = SPRITE_COUNT;
+        header.Rmask = ASSET_PACK_RMASK;
+        header.Gmask = ASSET_PACK_GMASK;
+        header.Bmask = ASSET_PACK_BMASK;
+        header.colorKey = colorKey;
+        fwrite(&header, sizeof(header), 1, file);
+
+        PackPage pages[MAX_ATLAS_PAGES];
+        Uint32 offset = sizeof(PackHeader) + atlas.pageCount * sizeof(PackPage) + SPRITE_COUNT * sizeof(PackSprite);
+        for (int p = 0; p < atlas.pageCount; ++p) {
+            int usedHeight = 0;
+            for (int id = 0; id < SPRITE_COUNT; ++id) {
+                if (placed[id].page == p) usedHeight = std::max(usedHeight, placed[id].source.y + placed[id].source.h);
+            }
+            offset = (offset + ASSET_PACK_ALIGN - 1) & ~(ASSET_PACK_ALIGN - 1);
+            pages[p].width = ATLAS_PAGE_SIZE;
+            pages[p].height = usedHeight;
+            pages[p].pitch = ATLAS_PAGE_SIZE * 4;
+            pages[p].offset = offset;
+            offset += pages[p].pitch * pages[p].height;
+        }
+        fwrite(pages, sizeof(PackPage), atlas.pageCount, file);
+
+        for (int id = 0; id < SPRITE_COUNT; ++id) {
+            PackSprite entry;
+            memset(&entry, 0, sizeof(entry));
+            strncpy(entry.name, SPRITE_SOURCES[id].file, ASSET_NAME_LENGTH - 1);
+            entry.page = placed[id].page;
+            entry.x = placed[id].source.x;
+            entry.y = placed[id].source.y;
+            entry.w = placed[id].source.w;
+            entry.h = placed[id].source.h;
+            fwrite(&entry, sizeof(entry), 1, file);
+        }
+
+        // 4. Page pixels
+        for (int p = 0; p < atlas.pageCount; ++p) {
+            static const Uint8 padding[ASSET_PACK_ALIGN] = {0};
+            long position = ftell(file);
+            fwrite(padding, 1, (size_t)((ASSET_PACK_ALIGN - position % ASSET_PACK_ALIGN) % ASSET_PACK_ALIGN), file);
+            fwrite(atlas.pages[p]->pixels, pages[p].pitch, pages[p].height, file);
+        }
+        std::cout << "Packed " << SPRITE_COUNT << " sprites onto " << atlas.pageCount << " atlas page(s) in "
+                  << path << " (" << ftell(file) << " bytes)" << std::endl;
+        fclose(file);
+    }
+
+    for (size_t i = 0; i < converted.size(); ++i) SDL_FreeSurface(converted[i]);
+    atlas_free(atlas);
+    SDL_FreeSurface(layout);
+    return written ? 0 : 1;
+}
+
+/**
+ * @brief Maps a level file and checks its header and chunk table. No tiles are
+ *        decoded here (see level_chunk()).
+ */
+bool level_open(const char* path) {
+    if (!map_file(path, gLevel.file)) {
+        std::cerr << "ERROR: Could not open level " << path << std::endl;
+        return false;
+    }
+
+    const LevelHeader* header = (const LevelHeader*)gLevel.file.data;
+    bool valid = gLevel.file.size >= sizeof(LevelHeader) &&
+                 memcmp(header->magic, LEVEL_MAGIC, 4) == 0 &&
+                 header->version == LEVEL_VERSION &&
+                 header->byteOrder == LEVEL_BYTE_ORDER &&
+                 header->width >= 1 && header->width <= (Uint32)LEVEL_MAX_TILES &&
+                 header->height >= 1 && header->height <= (Uint32)LEVEL_MAX_TILES &&
+                 header->chunkColumns == (header->width + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES &&
+                 header->chunkRows == (header->height + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES &&
+                 gLevel.file.size >= sizeof(LevelHeader) +
+                                     (size_t)header->chunkColumns * header->chunkRows * sizeof(LevelChunkEntry);
+    if (!valid) {
+        std::cerr << "ERROR: " << path << " is not a valid level!" << std::endl;
+        unmap_file(gLevel.file);
+        return false;
+    }
+
+    gLevel.chunkTable = (const LevelChunkEntry*)(gLevel.file.data + sizeof(LevelHeader));
+    gLevel.width = header->width;
+    gLevel.height = header->height;
+    gLevel.chunkColumns = header->chunkColumns;
+    gLevel.chunkRows = header->chunkRows;
+    int chunkCount = gLevel.chunkColumns * gLevel.chunkRows;
+    gLevel.chunks = new std::atomic<Uint8*>[chunkCount];
+    for (int i = 0; i < chunkCount; ++i) gLevel.chunks[i] = NULL;
+    gLevel.decodeLock = SDL_CreateMutex();
+    gLevel.chunksDecoded = 0;
+    return true;
+}
+
+/**
+ * @brief Frees the decoded chunks and unmaps the level.
+ */
+void level_close() {
+    if (gLevel.width == 0) return;
+    for (int i = 0; i < gLevel.chunkColumns * gLevel.chunkRows; ++i) {
+        if (gLevel.chunks[i] != gEmptyChunk) delete[] gLevel.chunks[i].load();
+    }
+    delete[] gLevel.chunks;
+    gLevel.chunks = NULL;
+    SDL_DestroyMutex(gLevel.decodeLock);
+    gLevel.decodeLock = NULL;
+    unmap_file(gLevel.file);
+    gLevel.width = 0;
+    gLevel.height = 0;
+}
+
+/**
+ * @brief Identifies the level file at path (NULL for none) by its size and a hash
+ *        of all its bytes. Works before level_open(), which checks the file.
+ * @return false (after printing why) if the file can't be read.
+ */
+bool level_fingerprint(const char* path, LevelFingerprint& print) {
+    LevelFingerprint none = {0, 0, 0};
+    print = none;
+    if (path == NULL) return true;
+
+    MappedFile file = {NULL, 0};
+    if (!map_file(path, file)) {
+        std::cerr << "ERROR: Could not open level " << path << std::endl;
+        return false;
+    }
+    if (file.size >= sizeof(LevelHeader)) {
+        const LevelHeader* header = (const LevelHeader*)file.data;
+        print.width = header->width;
+        print.height = header->height;
+    }
+    print.hash = fnv1a(2166136261u, file.data, file.size);
+    unmap_file(file);
+    return true;
+}
+
+bool same_level(const LevelFingerprint& a, const LevelFingerprint& b) {
+    return a.width == b.width && a.height == b.height && a.hash == b.hash;
+}
+
+/**
+ * @brief Writes a fingerprint for error messages, e.g. "a 20x15 level (hash f30d3d71)".
+ */
+void print_level(std::ostream& out, const LevelFingerprint& print) {
+    if (print.hash == 0) {
+        out << "no level";
+    } else {
+        out << "a " << print.width << "x" << print.height << " level (hash "
+            << std::hex << print.hash << std::dec << ")";
+    }
+}
+
+/**
+ * @brief Expands one chunk's runs. Damaged chunks come out empty (with a message),
+ *        so a bad file can't take the game down mid-level.
+ */
+Uint8* decode_level_chunk(const LevelChunkEntry& entry) {
+    const int tileCount = LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES;
+    if (entry.offset == 0) return gEmptyChunk;
+    if (entry.size % 2 != 0 || (size_t)entry.offset + entry.size > gLevel.file.size) {
+        std::cerr << "ERROR: Level chunk at " << entry.offset << " is out of bounds!" << std::endl;
+        return gEmptyChunk;
+    }
+
+    Uint8* tiles = new Uint8[tileCount];
+    const Uint8* runs = gLevel.file.data + entry.offset;
+    int filled = 0;
+    for (Uint32 i = 0; i < entry.size; i += 2) {
+        int count = runs[i];
+        Uint8 tile = runs[i + 1];
+        if (count == 0 || filled + count > tileCount || tile >= TILE_TYPE_COUNT) break;
+        memset(tiles + filled, tile, count);
+        filled += count;
+    }
+    if (filled != tileCount) {
+        std::cerr << "ERROR: Level chunk at " << entry.offset << " is damaged!" << std::endl;
+        delete[] tiles;
+        return gEmptyChunk;
+    }
+    return tiles;
+}
+
+/**
+ * @brief The tiles of a chunk (row-major), decoded on first use. Safe to call
+ *        from the main and the render thread at once.
+ */
+const Uint8* level_chunk(int chunkX, int chunkY) {
+    int index = chunkY * gLevel.chunkColumns + chunkX;
+    Uint8* tiles = gLevel.chunks[index].load(std::memory_order_acquire);
+    if (tiles != NULL) return tiles;
+
+    SDL_LockMutex(gLevel.decodeLock);
+    tiles = gLevel.chunks[index].load(std::memory_order_relaxed);
+    if (tiles == NULL) {
+        tiles = decode_level_chunk(gLevel.chunkTable[index]);
+        gLevel.chunks[index].store(tiles, std::memory_order_release);
+        gLevel.chunksDecoded++;
+    }
+    SDL_UnlockMutex(gLevel.decodeLock);
+    return tiles;
+}
+
+/**
+ * @brief Tile at (tileX, tileY); everything outside the level is empty.
+ */
+int level_tile(int tileX, int tileY) {
+    if (tileX < 0 || tileY < 0 || tileX >= gLevel.width || tileY >= gLevel.height) return TILE_EMPTY;
+    const Uint8* tiles = level_chunk(tileX / LEVEL_CHUNK_TILES, tileY / LEVEL_CHUNK_TILES);
+    return tiles[(tileY % LEVEL_CHUNK_TILES) * LEVEL_CHUNK_TILES + tileX % LEVEL_CHUNK_TILES];
+}
+
+/**
+ * @brief Tile row or column holding a pixel coordinate (rounds down, also
+ *        left of / above the level).
+ */
+int tile_floor(int pixel) {
+    return pixel >= 0 ? pixel / TILE_SIZE : -((TILE_SIZE - 1 - pixel) / TILE_SIZE);
+}
+
+/**
+ * @brief Whether any tile in the inclusive tile rect has one of the types in
+ *        typeMask (bits 1 << TileType).
+ */
+bool level_tiles_hit(int firstColumn, int firstRow, int lastColumn, int lastRow, int typeMask) {
+    firstColumn = std::max(firstColumn, 0);
+    firstRow = std::max(firstRow, 0);
+    lastColumn = std::min(lastColumn, gLevel.width - 1);
+    lastRow = std::min(lastRow, gLevel.height - 1);
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            if (typeMask & (1 << level_tile(column, row))) return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Whether the w x h box at (x, y) overlaps a tile with a type in typeMask.
+ */
+bool level_box_hits(int x, int y, int w, int h, int typeMask) {
+    return level_tiles_hit(tile_floor(x), tile_floor(y), tile_floor(x + w - 1), tile_floor(y + h - 1), typeMask);
+}
+
+/**
+ * @brief Platformer collision against the level, in place of the platform. Only
+ *        the tile rows and columns the player's box moves into are looked at,
+ *        nearest first, so the first hit is the time of impact.
+ * @param player The player to move.
+ * @param startX Player X before this tick's horizontal move (already applied).
+ * @param moveY Vertical move for this tick, with the carried fraction (not applied yet).
+ * @return true if the player landed or bumped its head; false if the vertical
+ *         move is free, and the caller applies it.
+ */
+bool level_collide_player(PlayerState& player, int startX, double moveY) {
+    // 1. Horizontal: solid tiles stop the player at their edge
+    int firstRow = tile_floor(player.y);
+    int lastRow = tile_floor(player.y + PLAYER_HEIGHT - 1);
+    if (player.x > startX) {
+        for (int column = tile_floor(startX + PLAYER_WIDTH - 1) + 1; column <= tile_floor(player.x + PLAYER_WIDTH - 1); ++column) {
+            if (level_tiles_hit(column, firstRow, column, lastRow, 1 << TILE_SOLID)) {
+                player.x = column * TILE_SIZE - PLAYER_WIDTH;
+                player.subX = 0.0;
+                break;
+            }
+        }
+    } else if (player.x < startX) {
+        for (int column = tile_floor(startX) - 1; column >= tile_floor(player.x); --column) {
+            if (level_tiles_hit(column, firstRow, column, lastRow, 1 << TILE_SOLID)) {
+                player.x = (column + 1) * TILE_SIZE;
+                player.subX = 0.0;
+                break;
+            }
+        }
+    }
+
+    // 2. Vertical
+    int firstColumn = tile_floor(player.x);
+    int lastColumn = tile_floor(player.x + PLAYER_WIDTH - 1);
+    if (moveY >= 0.0) {
+        // Falling (or resting): land on the first tile top the feet reach
+        int bottom = player.y + PLAYER_HEIGHT;
+        int lastTop = tile_floor((int)std::floor(bottom + moveY));
+        for (int row = tile_floor(bottom + TILE_SIZE - 1); row <= lastTop; ++row) {
+            if (level_tiles_hit(firstColumn, row, lastColumn, row, (1 << TILE_SOLID) | (1 << TILE_PLATFORM))) {
+                player.y = row * TILE_SIZE - PLAYER_HEIGHT;
+                player.velY = 0.0;
+                player.onGround = true;
+                return true;
+            }
+        }
+    } else {
+        // Rising: bump the head on the first solid tile bottom (platforms let it through)
+        int newTop = player.y + (int)moveY;
+        for (int row = tile_floor(player.y) - 1; row >= tile_floor(newTop + TILE_SIZE - 1) - 1; --row) {
+            if (level_tiles_hit(firstColumn, row, lastColumn, row, 1 << TILE_SOLID)) {
+                player.y = (row + 1) * TILE_SIZE;
+                player.velY = 0.0;
+                player.onGround = false;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Draws the level tiles that intersect the view: the screen-sized window
+ *        at (viewX, viewY) in level pixels.
+ */
+void draw_level_tiles(SDL_Surface* target, int viewX, int viewY) {
+    int firstColumn = std::max(0, tile_floor(viewX));
+    int lastColumn = std::min(gLevel.width - 1, tile_floor(viewX + SCREEN_WIDTH - 1));
+    int firstRow = std::max(0, tile_floor(viewY));
+    int lastRow = std::min(gLevel.height - 1, tile_floor(viewY + SCREEN_HEIGHT - 1));
+    Uint32 dirt = SDL_MapRGB(target->format, 185, 122, 87);
+    Uint32 grass = SDL_MapRGB(target->format, 34, 177, 76);
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            int tile = level_tile(column, row);
+            if (tile == TILE_EMPTY) continue;
+            SDL_Rect rect = {(Sint16)(column * TILE_SIZE - viewX), (Sint16)(row * TILE_SIZE - viewY), TILE_SIZE, TILE_SIZE};
+            if (tile == TILE_SOLID) {
+                SDL_FillRect(target, &rect, dirt);
+                if (level_tile(column, row - 1) == TILE_SOLID) continue;
+            }
+            rect.h = TILE_SIZE / 4; // Grass on top
+            SDL_FillRect(target, &rect, grass);
+        }
+    }
+}
+
+/**
+ * @brief Tile of the synthetic level (see build_synthetic_level()) at (x, y).
+ */
+int synthetic_tile(int x, int y, int height) {
+    if (y >= height - 2) return TILE_SOLID; // Ground
+    Uint32 cell[2] = {(Uint32)x / 8, (Uint32)y};
+    if (y % 6 == 5) {
+        return fnv1a(HEADLESS_SEED, cell, sizeof(cell)) % 3 == 0 ? TILE_PLATFORM : TILE_EMPTY;
+    }
+    if (y % 6 == 2 || y % 6 == 3) {
+        Uint32 block[2] = {(Uint32)x / 2, (Uint32)y / 2};
+        return fnv1a(HEADLESS_SEED + 1, block, sizeof(block)) % 17 == 0 ? TILE_SOLID : TILE_EMPTY;
+    }
+    return TILE_EMPTY;
+}
+
+/**
+ * @brief Writes a synthetic width x height level: ground along the bottom, rows of
+ *        one-way platforms and scattered solid blocks. One chunk is encoded at a
+ *        time, so size only costs disk space.
+ */
+bool build_synthetic_level(const char* path, int width, int height) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        std::cerr << "ERROR: Could not create " << path << std::endl;
+        return false;
+    }
+
+    LevelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEVEL_MAGIC, 4);
+    header.version = LEVEL_VERSION;
+    header.byteOrder = LEVEL_BYTE_ORDER;
+    header.width = width;
+    header.height = height;
+    header.chunkColumns = (width + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+    header.chunkRows = (height + LEVEL_CHUNK_TILES - 1) / LEVEL_CHUNK_TILES;
+    std::vector<LevelChunkEntry> table(header.chunkColumns * header.chunkRows);
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(&table[0], sizeof(LevelChunkEntry), table.size(), file); // Patched below
+
+    std::vector<Uint8> runs;
+    for (Uint32 chunkY = 0; chunkY < header.chunkRows; ++chunkY) {
+        for (Uint32 chunkX = 0; chunkX < header.chunkColumns; ++chunkX) {
+            // Runs of up to 255 equal tiles, row-major; tiles past the level edge are empty
+            runs.clear();
+            bool empty = true;
+            for (int i = 0; i < LEVEL_CHUNK_TILES * LEVEL_CHUNK_TILES; ++i) {
+                int x = chunkX * LEVEL_CHUNK_TILES + i % LEVEL_CHUNK_TILES;
+                int y = chunkY * LEVEL_CHUNK_TILES + i / LEVEL_CHUNK_TILES;
+                Uint8 tile = (x < width && y < height) ? (Uint8)synthetic_tile(x, y, height) : (Uint8)TILE_EMPTY;
+                empty = empty && tile == TILE_EMPTY;
+                if (!runs.empty() && runs[runs.size() - 1] == tile && runs[runs.size() - 2] < 255) {
+                    runs[runs.size() - 2]++;
+                } else {
+                    runs.push_back(1);
+                    runs.push_back(tile);
+                }
+            }
+            if (empty) continue;
+            LevelChunkEntry& entry = table[chunkY * header.chunkColumns + chunkX];
+            entry.offset = (Uint32)ftell(file);
+            entry.size = (Uint32)runs.size();
+            fwrite(&runs[0], 1, runs.size(), file);
+        }
+    }
+
+    long size = ftell(file);
+    fseek(file, sizeof(LevelHeader), SEEK_SET);
+    fwrite(&table[0], sizeof(LevelChunkEntry), table.size(), file);
+    bool written = !ferror(file);
+    fclose(file);
+    if (!written) {
+        std::cerr << "ERROR: Could not write " << path << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << width << "x" << height << " tile level " << path << " (" << size << " bytes)" << std::endl;
+    return true;
+}
+
+/**
+ * @brief Level benchmark: builds synthetic levels from 64x64 up to 4096x4096 tiles
+ *        and times opening each one, player-sized collision queries and drawing a
+ *        screen of tiles, with the player and view wandering around the level.
+ *        Flat numbers across the sizes mean only nearby chunks are paid for.
+ */
+int run_level_bench() {
+    SDL_Surface* target = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, 32, ASSET_PACK_RMASK, ASSET_PACK_GMASK, ASSET_PACK_BMASK, 0);
+    if (target == NULL) return 1;
+    srand(HEADLESS_SEED);
+    std::cout << "Level benchmark (" << TILE_SIZE << " px tiles, " << LEVEL_CHUNK_TILES << "x" << LEVEL_CHUNK_TILES
+              << " tile chunks)" << std::endl;
+
+    long mismatches = 0;
+    for (size_t s = 0; s < sizeof(LEVEL_BENCH_SIZES) / sizeof(LEVEL_BENCH_SIZES[0]); ++s) {
+        int size = LEVEL_BENCH_SIZES[s];
+        if (!build_synthetic_level(LEVEL_BENCH_FILE, size, size)) {
+            SDL_FreeSurface(target);
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (!level_open(LEVEL_BENCH_FILE)) {
+            SDL_FreeSurface(target);
+            return 1;
+        }
+        double openMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // 1. Collision queries along a random walk
+        int levelPixels = size * TILE_SIZE;
+        int x = levelPixels / 2;
+        int y = levelPixels / 2;
+        long hits = 0;
+        start = std::chrono::steady_clock::now();
+        for (int q = 0; q < LEVEL_BENCH_QUERIES; ++q) {
+            x = std::min(std::max(x + rand() % 17 - 8, 0), levelPixels - PLAYER_WIDTH);
+            y = std::min(std::max(y + rand() % 17 - 8, 0), levelPixels - PLAYER_HEIGHT);
+            if (level_box_hits(x, y, PLAYER_WIDTH, PLAYER_HEIGHT, (1 << TILE_SOLID) | (1 << TILE_PLATFORM))) hits++;
+        }
+        double queryNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / LEVEL_BENCH_QUERIES;
+
+        // 2. Screens of tiles around the walk
+        start = std::chrono::steady_clock::now();
+        for (int v = 0; v < LEVEL_BENCH_VIEWS; ++v) {
+            x = std::min(std::max(x + rand() % 17 - 8, 0), levelPixels - PLAYER_WIDTH);
+            y = std::min(std::max(y + rand() % 17 - 8, 0), levelPixels - PLAYER_HEIGHT);
+            draw_level_tiles(target, x - SCREEN_WIDTH / 2, y - SCREEN_HEIGHT / 2);
+        }
+        double viewUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / LEVEL_BENCH_VIEWS;
+        int walkChunks = gLevel.chunksDecoded;
+
+        // 3. Cross-check decoded tiles against the generator (decodes chunks everywhere)
+        for (int q = 0; q < LEVEL_BENCH_QUERIES / 100; ++q) {
+            int tileX = rand() % size;
+            int tileY = rand() % size;
+            if (level_tile(tileX, tileY) != synthetic_tile(tileX, tileY, size)) mismatches++;
+        }
+
+        std::cout << "  " << size << "x" << size << " tiles: open " << openMs << " ms, " << queryNs << " ns/collision query ("
+                  << hits << " hits), " << viewUs << " us/screen drawn, " << walkChunks << " of "
+                  << gLevel.chunkColumns * gLevel.chunkRows << " chunks decoded" << std::endl;
+        level_close();
+    }
+    remove(LEVEL_BENCH_FILE);
+    SDL_FreeSurface(target);
+
+    if (mismatches > 0) {
+        std::cerr << "ERROR: " << mismatches << " decoded tiles don't match the synthetic level!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands a finished sprite from the loader thread to the main thread.
+ */
+void deliver_sprite(int id, int page, const SDL_Rect& source) {
+    gAssetLoader.delivered[id] = true;
+    LoadedSprite loaded = {id, page, source};
+    SDL_LockMutex(gAssetLoader.lock);
+    gAssetLoader.finished.push_back(loaded);
+    SDL_UnlockMutex(gAssetLoader.lock);
+}
+
+/**
+ * @brief Loader thread body: runs load_media() and records how it went.
+ */
+int asset_loader_main(void*) {
+    bool success = load_media(gAssetLoader.looseAssets);
+
+    SDL_LockMutex(gAssetLoader.lock);
+    gAssetLoader.failed = !success;
+    gAssetLoader.done = true;
+    SDL_UnlockMutex(gAssetLoader.lock);
+    return 0;
+}
+
+/**
+ * @brief Starts decoding the sprites on a background thread. The game runs (with
+ *        fallback rectangles) while they arrive through poll_asset_loader().
+ */
+bool start_asset_loader(bool looseAssets) {
+    gAssetLoader.lock = SDL_CreateMutex();
+    gAssetLoader.looseAssets = looseAssets;
+    gAssetLoader.thread = SDL_CreateThread(asset_loader_main, NULL);
+    if (gAssetLoader.thread == NULL) {
+        std::cerr << "ERROR: Could not start the asset loader! SDL Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Marks a delivered sprite as loaded. Main thread only.
+ */
+void install_sprite(const LoadedSprite& loaded) {
+    Sprite& sprite = gSprites[loaded.id];
+    sprite.page = loaded.page;
+    sprite.source = loaded.source;
+    sprite.loaded = true;
+    if (loaded.id == SPRITE_CURSOR) {
+        // The cursor may have moved before its image was there to center
+        gState.followerX = gState.mouseX - (sprite.source.w / 2);
+        gState.followerY = gState.mouseY - (sprite.source.h / 2);
+    }
+}
+
+/**
+ * @brief Swaps in every sprite the loader has finished since the last call.
+ *        Called by the main thread once per frame.
+ * @return false if loading failed.
+ */
+bool poll_asset_loader() {
+    if (gAssetLoader.thread == NULL) return true;
+
+    SDL_LockMutex(gAssetLoader.lock);
+    gAssetLoader.installing.swap(gAssetLoader.finished);
+    bool done = gAssetLoader.done;
+    bool failed = gAssetLoader.failed;
+    SDL_UnlockMutex(gAssetLoader.lock);
+
+    for (size_t i = 0; i < gAssetLoader.installing.size(); ++i) {
+        install_sprite(gAssetLoader.installing[i]);
+    }
+    if (!gAssetLoader.installing.empty()) {
+        gSpritesVersion++; // The renderer redraws everything, background included
+        gAssetLoader.installing.clear();
+    }
+
+    if (done) {
+        // Everything delivered before done was set has been installed above
+        SDL_WaitThread(gAssetLoader.thread, NULL);
+        gAssetLoader.thread = NULL;
+        if (!failed) gStartupStats.fullyLoadedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - gLaunchTime).count();
+    }
+    return !failed;
+}
+
+/**
+ * @brief Stops the loader (if it is still running). Its atlas pages are freed by
+ *        free_media() whether or not their sprites were installed.
+ */
+void stop_asset_loader() {
+    if (gAssetLoader.thread != NULL) {
+        gAssetLoader.cancel = true;
+        SDL_WaitThread(gAssetLoader.thread, NULL);
+        gAssetLoader.thread = NULL;
+    }
+    gAssetLoader.finished.clear();
+    if (gAssetLoader.lock != NULL) SDL_DestroyMutex(gAssetLoader.lock);
+    gAssetLoader.lock = NULL;
+}
+
+/**
+ * @brief Finds the sprite loaded from a file name.
+ * @return The SpriteId, or -1 if no sprite uses that file.
+ */
+int sprite_for_file(const char* name) {
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        if (strcmp(SPRITE_SOURCES[id].file, name) == 0) return id;
+    }
+    return -1;
+}
+
+/**
+ * @brief Watcher thread body: waits for sprite BMPs to be saved and queues each
+ *        one, already decoded and converted, for poll_hot_reload().
+ */
+int hot_reload_main(void*) {
+#ifdef __linux__
+    alignas(inotify_event) char buffer[HOT_RELOAD_EVENT_BUFFER];
+    while (!gHotReload.cancel) {
+        pollfd waiting = {gHotReload.watchFd, POLLIN, 0};
+        if (poll(&waiting, 1, HOT_RELOAD_POLL_MS) <= 0) continue;
+        ssize_t length = read(gHotReload.watchFd, buffer, sizeof(buffer));
+        if (length <= 0) continue;
+        std::chrono::steady_clock::time_point changed = std::chrono::steady_clock::now();
+
+        // 1. Which sprites were saved (one save can raise several events)
+        bool saved[SPRITE_COUNT] = {false};
+        for (ssize_t offset = 0; offset < length; ) {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            if (event->len > 0) {
+                int id = sprite_for_file(event->name);
+                if (id >= 0) saved[id] = true;
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+
+        // 2. Decode just those; a half-written file fails here and the old image stays
+        for (int id = 0; id < SPRITE_COUNT; ++id) {
+            if (!saved[id]) continue;
+            SDL_Surface* surface = decode_sprite_file(id);
+            if (surface == NULL) continue;
+            ReloadedSprite reloaded = {id, surface, changed};
+            SDL_LockMutex(gHotReload.lock);
+            gHotReload.finished.push_back(reloaded);
+            SDL_UnlockMutex(gHotReload.lock);
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief Starts watching the working directory for changed sprite BMPs.
+ * @return false if the platform or the system can't watch it (the game runs on).
+ */
+bool start_hot_reload() {
+    gHotReload.watchFd = -1;
+#ifdef __linux__
+    gHotReload.watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (gHotReload.watchFd < 0 || inotify_add_watch(gHotReload.watchFd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "ERROR: Could not watch the asset directory: " << strerror(errno) << std::endl;
+        if (gHotReload.watchFd >= 0) close(gHotReload.watchFd);
+        gHotReload.watchFd = -1;
+        return false;
+    }
+    gHotReload.lock = SDL_CreateMutex();
+    gHotReload.thread = SDL_CreateThread(hot_reload_main, NULL);
+    if (gHotReload.thread == NULL) {
+        std::cerr << "ERROR: Could not start the hot reload watcher! SDL Error: " << SDL_GetError() << std::endl;
+        stop_hot_reload();
+        return false;
+    }
+    std::cout << "Hot reload: watching the sprite BMPs for changes" << std::endl;
+    return true;
+#else
+    std::cerr << "--hot-reload needs inotify (Linux only), ignoring it" << std::endl;
+    return false;
+#endif
+}
+
+/**
+ * @brief Tells whether no frame being drawn, or still to be drawn, uses sprites
+ *        from before version. Without a render thread nothing draws between
+ *        frames; with one, every snapshot slot must be that new.
+ */
+bool renderer_done_with_sprites(long version) {
+    if (gPipeline.thread == NULL) return true;
+    for (int s = 0; s < 3; ++s) {
+        if (gPipeline.slots[s].spritesVersion < version) return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Swaps in every sprite the watcher has re-decoded since the last call.
+ *        Called by the main thread once per frame, after poll_asset_loader().
+ *        The new pixels go over the sprite's spot from before its last reload
+ *        when they fit there and the renderer is done with it, else into fresh
+ *        atlas space; either way a frame the render thread is still drawing
+ *        never sees a half-copied sprite. Saving the same image again and again
+ *        thus flips between two spots instead of filling the atlas.
+ */
+void poll_hot_reload() {
+    // The loader thread may still be adding to the atlas; reloads wait for it
+    if (gHotReload.thread == NULL || gAssetLoader.thread != NULL) return;
+
+    SDL_LockMutex(gHotReload.lock);
+    gHotReload.installing.swap(gHotReload.finished);
+    SDL_UnlockMutex(gHotReload.lock);
+    if (gHotReload.installing.empty()) return;
+
+    Uint32 atlasKey = SDL_MapRGB(gScreen->format, TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B);
+    for (size_t i = 0; i < gHotReload.installing.size(); ++i) {
+        ReloadedSprite& reloaded = gHotReload.installing[i];
+        const SpriteSource& source = SPRITE_SOURCES[reloaded.id];
+        Uint32 spriteKey = SDL_MapRGB(gScreen->format, source.keyR, source.keyG, source.keyB);
+        LoadedSprite loaded = {reloaded.id, 0, {0, 0, 0, 0}};
+
+        // 1. The spot from before the last reload if it's free and big enough, else a new one
+        Sprite& spare = gHotReload.spare[reloaded.id];
+        bool placed = false;
+        if (spare.loaded && renderer_done_with_sprites(gHotReload.spareVersion[reloaded.id])) {
+            loaded.page = spare.page;
+            loaded.source = spare.source;
+            placed = atlas_replace(gAtlas, reloaded.surface, spriteKey, atlasKey, loaded.page, loaded.source);
+        }
+        if (!placed) placed = atlas_add(gAtlas, reloaded.surface, spriteKey, atlasKey, loaded.page, loaded.source);
+
+        // 2. The spot it replaces is free once the renderer moves past this version
+        if (placed) {
+            spare = gSprites[reloaded.id];
+            gHotReload.spareVersion[reloaded.id] = gSpritesVersion + 1;
+            install_sprite(loaded);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reloaded.changed).count();
+            gHotReload.reloads++;
+            gHotReload.worstMs = std::max(gHotReload.worstMs, ms);
+            std::cout << "Reloaded " << source.file << " in " << ms << " ms" << std::endl;
+        } else {
+            std::cerr << "ERROR: No room to reload " << source.file << " in the sprite atlas!" << std::endl;
+        }
+        SDL_FreeSurface(reloaded.surface);
+    }
+    gHotReload.installing.clear();
+    gSpritesVersion++; // The renderer redraws everything, background included
+}
+
+/**
+ * @brief Stops the watcher and drops any reloads it had not handed over.
+ */
+void stop_hot_reload() {
+    if (gHotReload.thread != NULL) {
+        gHotReload.cancel = true;
+        SDL_WaitThread(gHotReload.thread, NULL);
+        gHotReload.thread = NULL;
+    }
+#ifdef __linux__
+    if (gHotReload.watchFd >= 0) close(gHotReload.watchFd);
+#endif
+    gHotReload.watchFd = -1;
+    for (size_t i = 0; i < gHotReload.finished.size(); ++i) {
+        SDL_FreeSurface(gHotReload.finished[i].surface);
+    }
+    gHotReload.finished.clear();
+    if (gHotReload.lock != NULL) SDL_DestroyMutex(gHotReload.lock);
+    gHotReload.lock = NULL;
+}
+
+/**
+ * @brief Synthesizes the sound effects as 16-bit PCM in the mixer's output format
+ *        (no effect files ship with the game): a rising blip for a score, a short
+ *        low thump for a bounce and a long falling slide for a loss.
+ */
+void synthesize_sounds(int frequency, int channels) {
+    struct Tone {
+        double startHz, endHz; // Pitch slides linearly between these
+        double seconds;
+        double decay;          // Envelope: exp(-decay * t)
+        bool square;           // Square wave, otherwise sine
+    };
+    const Tone TONES[SOUND_COUNT] = {
+        {660.0, 1320.0, 0.12, 20.0, true},  // SOUND_SCORE
+        {220.0, 110.0, 0.05, 60.0, false},  // SOUND_BOUNCE
+        {440.0, 110.0, 0.60, 3.0, true}     // SOUND_LOSS
+    };
+    const double TWO_PI = 6.283185307179586;
+
+    for (int id = 0; id < SOUND_COUNT; ++id) {
+        const Tone& tone = TONES[id];
+        int frames = (int)(tone.seconds * frequency);
+        std::vector<Sint16>& pcm = gAudio.samples[id];
+        pcm.resize((size_t)frames * channels);
+        double phase = 0.0;
+        for (int f = 0; f < frames; ++f) {
+            double t = (double)f / frequency;
+            phase += TWO_PI * (tone.startHz + (tone.endHz - tone.startHz) * t / tone.seconds) / frequency;
+            double wave = tone.square ? (std::sin(phase) >= 0.0 ? 1.0 : -1.0) : std::sin(phase);
+            Sint16 value = (Sint16)(wave * std::exp(-tone.decay * t) * 0.3 * 32767.0);
+            for (int c = 0; c < channels; ++c) pcm[(size_t)f * channels + c] = value;
+        }
+        gAudio.chunks[id] = Mix_QuickLoad_RAW((Uint8*)&pcm[0], (Uint32)(pcm.size() * sizeof(Sint16)));
+    }
+}
+
+/**
+ * @brief Audio thread body: passes every queued sound to the mixer.
+ */
+int audio_thread_main(void*) {
+    SoundQueue& queue = gAudio.queue;
+    while (true) {
+        SDL_SemWait(gAudio.wake);
+        if (gAudio.quit) break;
+        unsigned tail = queue.tail;
+        while (tail != queue.head) {
+            Mix_Chunk* chunk = gAudio.chunks[queue.ids[tail % SOUND_QUEUE_SIZE]];
+            if (chunk != NULL) Mix_PlayChannel(-1, chunk, 0);
+            queue.tail = ++tail;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Opens the audio device, starts the music streaming from MUSIC_FILE,
+ *        prepares the effects and starts the audio thread.
+ * @return false if there is no audio; the game then runs silent.
+ */
+bool audio_start() {
+    auto start = std::chrono::steady_clock::now();
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "No audio: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    if ((Mix_Init(MIX_INIT_OGG) & MIX_INIT_OGG) == 0) {
+        std::cerr << "ERROR: No Ogg Vorbis support! Mix Error: " << Mix_GetError() << std::endl;
+    }
+    // Small mixing chunks: effects start within one chunk, and the music is decoded
+    // a chunk at a time as it plays instead of all up front
+    if (Mix_OpenAudio(AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, AUDIO_CHANNELS, AUDIO_CHUNK_SAMPLES) < 0) {
+        std::cerr << "No audio: " << Mix_GetError() << std::endl;
+        Mix_Quit();
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+    gAudio.enabled = true;
+    Mix_AllocateChannels(AUDIO_MIX_CHANNELS);
+
+    // 1. Music (Mix_LoadMUS only opens the file and its decoder)
+    gAudio.music = Mix_LoadMUS(MUSIC_FILE);
+    if (gAudio.music == NULL) {
+        std::cerr << "ERROR: Failed to load " << MUSIC_FILE << "! Mix Error: " << Mix_GetError() << std::endl;
+    } else if (Mix_PlayMusic(gAudio.music, -1) < 0) {
+        std::cerr << "ERROR: Could not play " << MUSIC_FILE << "! Mix Error: " << Mix_GetError() << std::endl;
+    }
+
+    // 2. Effects, in whatever format the device gave us
+    int frequency, channels;
+    Uint16 format;
+    Mix_QuerySpec(&frequency, &format, &channels);
+    if (format == AUDIO_S16SYS) {
+        synthesize_sounds(frequency, channels);
+    } else {
+        std::cerr << "Audio device isn't 16-bit, playing without sound effects" << std::endl;
+    }
+
+    // 3. The thread that plays them
+    gAudio.quit = false;
+    gAudio.wake = SDL_CreateSemaphore(0);
+    gAudio.thread = SDL_CreateThread(audio_thread_main, NULL);
+    if (gAudio.thread == NULL) {
+        std::cerr << "ERROR: Could not start the audio thread! SDL Error: " << SDL_GetError() << std::endl;
+        audio_stop();
+        return false;
+    }
+    gAudioStats.startupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+/**
+ * @brief Stops the audio thread and the music, frees the sounds and closes the
+ *        audio device. Safe to call when audio never started.
+ */
+void audio_stop() {
+    if (gAudio.thread != NULL) {
+        gAudio.quit = true;
+        SDL_SemPost(gAudio.wake);
+        SDL_WaitThread(gAudio.thread, NULL);
+        gAudio.thread = NULL;
+    }
+    if (gAudio.wake != NULL) SDL_DestroySemaphore(gAudio.wake);
+    gAudio.wake = NULL;
+    if (!gAudio.enabled) return;
+
+    gAudio.enabled = false;
+    Mix_HaltChannel(-1);
+    Mix_HaltMusic();
+    if (gAudio.music != NULL) Mix_FreeMusic(gAudio.music);
+    gAudio.music = NULL;
+    for (int id = 0; id < SOUND_COUNT; ++id) {
+        if (gAudio.chunks[id] != NULL) Mix_FreeChunk(gAudio.chunks[id]);
+        gAudio.chunks[id] = NULL;
+        std::vector<Sint16>().swap(gAudio.samples[id]);
+    }
+    Mix_CloseAudio();
+    Mix_Quit();
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+/**
+ * @brief Queues a sound effect from the game thread. Never blocks: the sound is
+ *        dropped if the audio thread is SOUND_QUEUE_SIZE sounds behind.
+ */
+void play_sound(SoundId id) {
+    if (!gAudio.enabled) return;
+    auto start = std::chrono::steady_clock::now();
+
+    SoundQueue& queue = gAudio.queue;
+    unsigned head = queue.head;
+    if (head - queue.tail >= (unsigned)SOUND_QUEUE_SIZE) {
+        gAudioStats.dropped++;
+    } else {
+        queue.ids[head % SOUND_QUEUE_SIZE] = (Uint8)id;
+        queue.head = head + 1;
+        SDL_SemPost(gAudio.wake);
+    }
+
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    gAudioStats.queued++;
+    gAudioStats.totalUs += us;
+    gAudioStats.worstUs = std::max(gAudioStats.worstUs, us);
+}
+
+/**
+ * @brief Bounce sound and sparks for the main beachball hitting something at
+ *        (x, y) in the world, if it hit hard enough to notice. The sparks fly
+ *        off with part of the ball's new velocity.
+ */
+void ball_bounce_feedback(double speed, double x, double y) {
+    speed = std::abs(speed);
+    if (speed < BOUNCE_SOUND_MIN_SPEED) return;
+    play_sound(SOUND_BOUNCE);
+    int sparks = std::min(PARTICLE_BOUNCE_MAX, (int)(speed * PARTICLE_BOUNCE_PER_SPEED));
+    emit_particles((float)x, (float)y, sparks, (float)gState.ballVelX * PARTICLE_BOUNCE_CARRY,
+                   (float)gState.ballVelY * PARTICLE_BOUNCE_CARRY, PARTICLE_BOUNCE_SPREAD, PARTICLE_SPARK);
+}
+
+/**
+ * @brief Prints what audio keeps in memory and how long the game thread spent
+ *        on it.
+ */
+void print_audio_stats() {
+    if (!gAudio.enabled) return;
+
+    long effectBytes = 0;
+    for (int id = 0; id < SOUND_COUNT; ++id) effectBytes += (long)(gAudio.samples[id].size() * sizeof(Sint16));
+    long musicFileBytes = 0;
+    FILE* file = fopen(MUSIC_FILE, "rb");
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        musicFileBytes = ftell(file);
+        fclose(file);
+    }
+    long mixBytes = (long)AUDIO_CHUNK_SAMPLES * AUDIO_CHANNELS * sizeof(Sint16);
+    std::cout << "Audio: music streamed from " << MUSIC_FILE << " (" << musicFileBytes / 1024 << " KB on disk, "
+              << AUDIO_CHUNK_SAMPLES << " frames decoded per mix), effects " << effectBytes / 1024
+              << " KB, mix buffer " << mixBytes / 1024 << " KB, startup " << gAudioStats.startupMs << " ms" << std::endl;
+    std::cout << "  game thread: " << gAudioStats.queued << " sounds queued (" << gAudioStats.dropped << " dropped), avg "
+              << (gAudioStats.queued > 0 ? gAudioStats.totalUs / gAudioStats.queued : 0.0)
+              << " us, worst " << gAudioStats.worstUs << " us" << std::endl;
+}
+
+/**
+ * @brief Prints how long startup took and where the sprites came from.
+ */
+void print_startup_stats() {
+    std::cout << "Startup: first frame after " << gStartupStats.firstFrameMs << " ms, ";
+    if (gStartupStats.fullyLoadedMs > 0.0) {
+        std::cout << "fully loaded after " << gStartupStats.fullyLoadedMs << " ms";
+    } else {
+        std::cout << "still loading at exit";
+    }
+    std::cout << " (" << gStartupStats.mediaSource << ", loader busy " << gStartupStats.mediaMs << " ms)" << std::endl;
+
+    // How well the sprites filled the atlas
+    long pagePixels = 0;
+    long spritePixels = 0;
+    for (int p = 0; p < gAtlas.pageCount; ++p) {
+        pagePixels += (long)gAtlas.pages[p]->w * gAtlas.pages[p]->h;
+    }
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        if (gSprites[id].loaded) spritePixels += (long)gSprites[id].source.w * gSprites[id].source.h;
+    }
+    if (pagePixels > 0) {
+        std::cout << "Sprite atlas: " << gAtlas.pageCount << " page(s), "
+                  << (100.0 * spritePixels / pagePixels) << "% filled" << std::endl;
+    }
+    if (gHotReload.reloads > 0) {
+        std::cout << "Hot reload: " << gHotReload.reloads << " sprite(s) swapped in, slowest "
+                  << gHotReload.worstMs << " ms after the save" << std::endl;
+    }
+}
+
+/**
+ * @brief Handles user input and system events: everything one SDL_PumpEvents()
+ *        queued, in order, a batch at a time. Mouse motion collapses into the
+ *        latest position (a button event carries its own, and the later one
+ *        wins). Nothing pumps again before the next frame, so motion that arrives
+ *        meanwhile waits in the queue instead of being dropped.
+ */
+void handle_events(bool& running) {
+    SDL_Event events[EVENT_BATCH];
+    SDL_PumpEvents();
+    int count;
+    bool moved = false;
+    while ((count = SDL_PeepEvents(events, EVENT_BATCH, SDL_GETEVENT, SDL_ALLEVENTS)) > 0) {
+        for (int i = 0; i < count; ++i) {
+            const SDL_Event& event = events[i];
+            if (event.type == SDL_QUIT || (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE)) {
+                running = false;
+            }
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == HUD_TOGGLE_KEY) {
+                gShowTimingHud = !gShowTimingHud;
+            }
+
+            // --- Mouse Tracking ---
+            // Collected here and applied at the next tick boundary by apply_tick_input()
+            if (event.type == SDL_MOUSEMOTION) {
+                gPendingInput.mouseX = event.motion.x;
+                gPendingInput.mouseY = event.motion.y;
+                gPipelineStats.motionEvents++;
+                moved = true;
+            } else if (event.type == SDL_MOUSEBUTTONDOWN) {
+                if (event.button.button == SDL_BUTTON_LEFT) { 
+                    gPendingInput.flags |= INPUT_PRESS;
+                    gPendingInput.mouseX = event.button.x;
+                    gPendingInput.mouseY = event.button.y;
+                }
+            } else if (event.type == SDL_MOUSEBUTTONUP) {
+                if (event.button.button == SDL_BUTTON_LEFT) {
+                    gPendingInput.flags |= INPUT_RELEASE;
+                }
+            }
+        }
+    }
+    if (moved) {
+        gPendingInput.flags |= INPUT_MOUSE_MOVED;
+        gPipelineStats.motionUpdates++;
+    }
+}
+
+/**
+ * @brief Handles a left mouse button press at (x, y): buttons and ball grab.
+ *        Shared by the SDL event path and the headless input script.
+ */
+void handle_left_click(int x, int y) {
+    gState.mouseDown = true;
+    
+    // 1. Buttons (the topmost visible widget under the click)
+    UiState ui = {gState.gravityOn, gState.platformLoss};
+    int widget = widget_at(x, y, ui);
+    if (widget >= 0) {
+        gWidgets[widget].onClick();
+    }
+    
+    // 2. Check for Beachball Grab
+    // Only allow grabbing if we are not in the loss state
+    // (The click is on the screen; the balls are in the world)
+    if (!gState.platformLoss) {
+        SDL_Rect ballBox = {(Sint16)gState.ballX, (Sint16)gState.ballY, (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT};
+        SDL_Rect clickArea = {(Sint16)(x + gState.cameraX), (Sint16)(y + gState.cameraY), 1, 1}; 
+        
+        if (check_collision(ballBox, clickArea)) {
+            gState.ballGrabbed = true;
+            gState.ballVelX = 0.0; // Stop ball physics when grabbed
+            gState.ballVelY = 0.0;
+        } else if (gBallPool.count > 0) {
+            // Stress mode: grab one of the pool balls instead
+            gBallPool.grabbed = find_pool_ball_at(x + gState.cameraX, y + gState.cameraY);
+        }
+    }
+}
+
+/**
+ * @brief Handles the left mouse button being released.
+ */
+void handle_left_release() {
+    gState.mouseDown = false;
+    gState.ballGrabbed = false; // Release the ball
+    gBallPool.grabbed = -1;
+}
+
+/**
+ * @brief Adds a widget on top of the existing ones and marks the grid cells its
+ *        rect touches.
+ * @return The widget's index, or -1 if MAX_WIDGETS are registered already.
+ */
+int register_widget(const SDL_Rect& rect, bool (*visible)(const UiState&), int (*sprite)(const UiState&), void (*onClick)()) {
+    if (gWidgetCount == MAX_WIDGETS) {
+        std::cerr << "ERROR: Too many widgets (" << MAX_WIDGETS << " max)!" << std::endl;
+        return -1;
+    }
+    int index = gWidgetCount++;
+    Widget& widget = gWidgets[index];
+    widget.rect = rect;
+    widget.visible = visible;
+    widget.sprite = sprite;
+    widget.onClick = onClick;
+
+    int firstColumn = std::max(0, rect.x / UI_GRID_CELL_SIZE);
+    int lastColumn = std::min(UI_GRID_COLUMNS - 1, (rect.x + rect.w - 1) / UI_GRID_CELL_SIZE);
+    int firstRow = std::max(0, rect.y / UI_GRID_CELL_SIZE);
+    int lastRow = std::min(UI_GRID_ROWS - 1, (rect.y + rect.h - 1) / UI_GRID_CELL_SIZE);
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            gWidgetGrid[row * UI_GRID_COLUMNS + column] |= (Uint64)1 << index;
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief Topmost visible widget under (x, y): one grid cell lookup, then only the
+ *        widgets that touch that cell are tested.
+ * @return Widget index, or -1 for none.
+ */
+int widget_at(int x, int y, const UiState& ui) {
+    if (x < 0 || y < 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return -1;
+    Uint64 candidates = gWidgetGrid[(y / UI_GRID_CELL_SIZE) * UI_GRID_COLUMNS + x / UI_GRID_CELL_SIZE];
+    while (candidates != 0) {
+        int index = 63;
+        while ((candidates >> index) == 0) --index; // Highest bit: the topmost widget
+        candidates &= ~((Uint64)1 << index);
+        const Widget& widget = gWidgets[index];
+        if (x >= widget.rect.x && x < widget.rect.x + widget.rect.w &&
+            y >= widget.rect.y && y < widget.rect.y + widget.rect.h && widget.visible(ui)) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Puts every player at rest at (x, y), each next one PLAYER_SPACING
+ *        further right.
+ */
+void place_players(int x, int y) {
+    for (int i = 0; i < MAX_PLAYERS; ++i) {
+        PlayerState& player = gState.players[i];
+        player.x = x + i * PLAYER_SPACING;
+        player.y = y;
+        player.subX = 0.0;
+        player.subY = 0.0;
+        player.velY = 0.0;
+        player.onGround = false;
+    }
+}
+
+/**
+ * @brief Draws every visible widget, bottom to top.
+ */
+void draw_widgets(const UiState& ui) {
+    for (int i = 0; i < gWidgetCount; ++i) {
+        if (gWidgets[i].visible(ui)) {
+            draw_sprite(gWidgets[i].sprite(ui), gWidgets[i].rect.x, gWidgets[i].rect.y);
+        }
+    }
+}
+
+// Gravity Toggle Button: only available if NOT in loss state, so the player must retry first
+bool toggle_button_visible(const UiState& ui) {
+    return !ui.platformLoss;
+}
+
+int toggle_button_sprite(const UiState& ui) {
+    return ui.gravityOn ? SPRITE_BUTTON_ON : SPRITE_BUTTON_OFF;
+}
+
+void on_toggle_gravity() {
+    gState.gravityOn = !gState.gravityOn; // Toggle gravity mode
+    
+    // Reset platformer state when changing mode
+    gState.platformLoss = false;
+    place_players(PLAYER_START_X, PLAYER_START_Y); // Reset players to safe start point
+    update_camera();
+    save_previous_state(); // Teleport: don't interpolate from the old position
+    
+    // Reset ball physics if switching off gravity and ball isn't grabbed
+    if (!gState.gravityOn && !gState.ballGrabbed) {
+        gState.ballVelY = 0.0;
+    }
+}
+
+// Retry Button: only available if gravity is on AND we lost
+bool retry_button_visible(const UiState& ui) {
+    return ui.gravityOn && ui.platformLoss;
+}
+
+int retry_button_sprite(const UiState&) {
+    return SPRITE_BUTTON_RETRY;
+}
+
+void on_retry() {
+    // Reset the loss state and player position
+    gState.platformLoss = false;
+    place_players(PLATFORM_X + (PLATFORM_WIDTH / 2) - (PLAYER_WIDTH / 2), // Start near the platform center
+                  PLATFORM_Y - PLAYER_HEIGHT - 10);                      // ... slightly above it
+    update_camera();
+    save_previous_state();
+}
+
+/**
+ * @brief Registers the game's buttons. Called once at startup, headless too
+ *        (scripted input clicks them).
+ */
+void register_widgets() {
+    SDL_Rect retryRect = {RETRY_BUTTON_X, RETRY_BUTTON_Y, RETRY_BUTTON_WIDTH, RETRY_BUTTON_HEIGHT};
+    register_widget(retryRect, retry_button_visible, retry_button_sprite, on_retry);
+    SDL_Rect toggleRect = {TOGGLE_BUTTON_X, TOGGLE_BUTTON_Y, TOGGLE_BUTTON_WIDTH, TOGGLE_BUTTON_HEIGHT};
+    register_widget(toggleRect, toggle_button_visible, toggle_button_sprite, on_toggle_gravity);
+}
+
+/**
+ * @brief Game RNG (xorshift32). Everything the simulation randomizes goes through
+ *        this instead of rand(), so a seed reproduces a session on any platform.
+ */
+void seed_game_random(Uint32 seed) {
+    gState.randomState = seed != 0 ? seed : 0x9E3779B9u; // xorshift must not start at 0
+}
+
+Uint32 game_random() {
+    gState.randomState ^= gState.randomState << 13;
+    gState.randomState ^= gState.randomState >> 17;
+    gState.randomState ^= gState.randomState << 5;
+    return gState.randomState;
+}
+
+/**
+ * @brief Builds this tick's input from the keyboard and the mouse events collected
+ *        by handle_events() since the last tick, and clears the collected edges.
+ */
+TickInput take_live_input(const Uint8* keystates) {
+    TickInput input = gPendingInput;
+    if (keystates[SDLK_LEFT]) input.flags |= INPUT_LEFT;
+    if (keystates[SDLK_RIGHT]) input.flags |= INPUT_RIGHT;
+    if (keystates[SDLK_UP]) input.flags |= INPUT_UP;
+    if (keystates[SDLK_DOWN]) input.flags |= INPUT_DOWN;
+    if (keystates[REWIND_KEY]) input.flags |= INPUT_REWIND;
+
+    gPendingInput.flags = 0; // Keep the mouse position, drop the edges
+    return input;
+}
+
+/**
+ * @brief Applies one tick's input to the game: mouse position, button edges and
+ *        the key array for update_state(). Live play, the headless script and
+ *        replays all go through here.
+ */
+void apply_tick_input(const TickInput& input, Uint8* keystates) {
+    keystates[SDLK_LEFT] = (input.flags & INPUT_LEFT) ? 1 : 0;
+    keystates[SDLK_RIGHT] = (input.flags & INPUT_RIGHT) ? 1 : 0;
+    keystates[SDLK_UP] = (input.flags & INPUT_UP) ? 1 : 0;
+    keystates[SDLK_DOWN] = (input.flags & INPUT_DOWN) ? 1 : 0;
+    keystates[REWIND_KEY] = (input.flags & INPUT_REWIND) ? 1 : 0;
+
+    if (input.flags & (INPUT_MOUSE_MOVED | INPUT_PRESS)) {
+        gState.mouseX = input.mouseX;
+        gState.mouseY = input.mouseY;
+    }
+    if ((input.flags & INPUT_MOUSE_MOVED) && gSprites[SPRITE_CURSOR].loaded) {
+        // gState.followerX/Y is calculated to be the top-left corner needed to center the cursor image
+        gState.followerX = input.mouseX - (gSprites[SPRITE_CURSOR].source.w / 2);
+        gState.followerY = input.mouseY - (gSprites[SPRITE_CURSOR].source.h / 2);
+    }
+
+    // Both edges in one tick: if the button was already down it was released first
+    bool press = (input.flags & INPUT_PRESS) != 0;
+    bool release = (input.flags & INPUT_RELEASE) != 0;
+    if (release && gState.mouseDown) {
+        handle_left_release();
+        release = false;
+    }
+    if (press) handle_left_click(input.mouseX, input.mouseY);
+    if (release) handle_left_release();
+}
+
+/**
+ * @brief Little-endian helpers for the input log, so logs move between machines.
+ */
+void write_u16(FILE* file, Uint16 value) {
+    fputc(value & 0xFF, file);
+    fputc(value >> 8, file);
+}
+
+void write_u32(FILE* file, Uint32 value) {
+    write_u16(file, (Uint16)(value & 0xFFFF));
+    write_u16(file, (Uint16)(value >> 16));
+}
+
+bool read_u16(FILE* file, Uint16& value) {
+    int lo = fgetc(file);
+    int hi = fgetc(file);
+    if (lo == EOF || hi == EOF) return false;
+    value = (Uint16)(lo | (hi << 8));
+    return true;
+}
+
+bool read_u32(FILE* file, Uint32& value) {
+    Uint16 lo, hi;
+    if (!read_u16(file, lo) || !read_u16(file, hi)) return false;
+    value = (Uint32)lo | ((Uint32)hi << 16);
+    return true;
+}
+
+/**
+ * @brief Starts recording to path. The header is written with the seed, the
+ *        options that change the simulation and the level's fingerprint; the
+ *        tick count and final checksum are filled in by input_log_close().
+ */
+bool input_log_record(const char* path, Uint32 seed, const LaunchOptions& options) {
+    LevelFingerprint level;
+    if (!level_fingerprint(options.levelPath, level)) return false;
+    gInputLog.file = fopen(path, "wb");
+    if (gInputLog.file == NULL) {
+        std::cerr << "ERROR: Could not create input log " << path << std::endl;
+        return false;
+    }
+    gInputLog.recording = true;
+    gInputLog.seed = seed;
+    gInputLog.ticks = 0;
+    gInputLog.runLength = 0;
+
+    fwrite(INPUT_LOG_MAGIC, 1, 4, gInputLog.file);
+    write_u16(gInputLog.file, INPUT_LOG_VERSION);
+    write_u16(gInputLog.file, options.ballCollisions ? 1 : 0);
+    write_u32(gInputLog.file, seed);
+    write_u32(gInputLog.file, (Uint32)options.stressBalls);
+    write_u32(gInputLog.file, 0); // Tick count (patched on close)
+    write_u32(gInputLog.file, 0); // Final state checksum (patched on close)
+    write_u32(gInputLog.file, (Uint32)options.simHz);
+    write_u32(gInputLog.file, level.width);
+    write_u32(gInputLog.file, level.height);
+    write_u32(gInputLog.file, level.hash);
+    return true;
+}
+
+/**
+ * @brief Opens path for replay and overrides the simulation options with the
+ *        recorded ones. The level can't be taken over: --level must name the
+ *        one the recording was made on (or be left out if there was none).
+ */
+bool input_log_replay(const char* path, LaunchOptions& options) {
+    gInputLog.file = fopen(path, "rb");
+    if (gInputLog.file == NULL) {
+        std::cerr << "ERROR: Could not open input log " << path << std::endl;
+        return false;
+    }
+
+    char magic[4];
+    Uint16 version, flags;
+    Uint32 stressBalls, simHz;
+    LevelFingerprint recorded;
+    if (fread(magic, 1, 4, gInputLog.file) != 4 || memcmp(magic, INPUT_LOG_MAGIC, 4) != 0 ||
+        !read_u16(gInputLog.file, version) || version != INPUT_LOG_VERSION ||
+        !read_u16(gInputLog.file, flags) || !read_u32(gInputLog.file, gInputLog.seed) ||
+        !read_u32(gInputLog.file, stressBalls) || !read_u32(gInputLog.file, gInputLog.ticks) ||
+        !read_u32(gInputLog.file, gInputLog.checksum) || !read_u32(gInputLog.file, simHz) ||
+        !read_u32(gInputLog.file, recorded.width) || !read_u32(gInputLog.file, recorded.height) ||
+        !read_u32(gInputLog.file, recorded.hash) ||
+        stressBalls > (Uint32)STRESS_MAX_BALLS || simHz < (Uint32)MIN_SIM_HZ || simHz > (Uint32)MAX_SIM_HZ ||
+        gInputLog.ticks == 0) {
+        std::cerr << "ERROR: " << path << " is not a valid input log!" << std::endl;
+        fclose(gInputLog.file);
+        gInputLog.file = NULL;
+        return false;
+    }
+    LevelFingerprint level;
+    if (!level_fingerprint(options.levelPath, level) || !same_level(level, recorded)) {
+        std::cerr << "ERROR: " << path << " was recorded on ";
+        print_level(std::cerr, recorded);
+        std::cerr << (recorded.hash == 0 ? "; replay it without --level" : "; replay it with that --level") << std::endl;
+        fclose(gInputLog.file);
+        gInputLog.file = NULL;
+        return false;
+    }
+
+    gInputLog.replaying = true;
+    gInputLog.position = 0;
+    gInputLog.runLength = 0;
+    options.ballCollisions = (flags & 1) != 0;
+    options.stressBalls = (int)stressBalls;
+    options.simHz = (int)simHz;
+    options.headlessTicks = gInputLog.ticks;
+    std::cout << "Replaying " << path << ": " << gInputLog.ticks << " ticks at " << simHz << " Hz, seed "
+              << gInputLog.seed << std::endl;
+    return true;
+}
+
+/**
+ * @brief Writes out the current run of identical ticks.
+ */
+void input_log_flush_run() {
+    if (gInputLog.runLength == 0) return;
+    write_u16(gInputLog.file, (Uint16)gInputLog.runLength);
+    fputc(gInputLog.run.flags, gInputLog.file);
+    write_u16(gInputLog.file, (Uint16)gInputLog.run.mouseX);
+    write_u16(gInputLog.file, (Uint16)gInputLog.run.mouseY);
+    gInputLog.runLength = 0;
+}
+
+/**
+ * @brief Appends one tick. Identical consecutive ticks are stored as one run.
+ */
+void input_log_write(const TickInput& input) {
+    bool sameAsRun = gInputLog.runLength > 0 && gInputLog.runLength < 0xFFFF &&
+                     input.flags == gInputLog.run.flags &&
+                     input.mouseX == gInputLog.run.mouseX && input.mouseY == gInputLog.run.mouseY;
+    if (!sameAsRun) {
+        input_log_flush_run();
+        gInputLog.run = input;
+    }
+    gInputLog.runLength++;
+    gInputLog.ticks++;
+}
+
+/**
+ * @brief Reads the next tick. Returns false at the end of the recording.
+ */
+bool input_log_read(TickInput& input) {
+    if (gInputLog.position >= gInputLog.ticks) return false;
+    if (gInputLog.runLength == 0) {
+        Uint16 length, x, y;
+        int flags;
+        if (!read_u16(gInputLog.file, length) || (flags = fgetc(gInputLog.file)) == EOF ||
+            !read_u16(gInputLog.file, x) || !read_u16(gInputLog.file, y) || length == 0) {
+            std::cerr << "ERROR: Input log ends early at tick " << gInputLog.position << std::endl;
+            gInputLog.ticks = gInputLog.position;
+            return false;
+        }
+        gInputLog.runLength = length;
+        gInputLog.run.flags = (Uint8)flags;
+        gInputLog.run.mouseX = (Sint16)x;
+        gInputLog.run.mouseY = (Sint16)y;
+    }
+    input = gInputLog.run;
+    gInputLog.runLength--;
+    gInputLog.position++;
+    return true;
+}
+
+/**
+ * @brief Finishes a recording (patching tick count and checksum into the header)
+ *        or a replay (comparing the final state with the recorded one).
+ * @return false if a complete replay did not end in the recorded state.
+ */
+bool input_log_close(Uint32 finalChecksum) {
+    if (gInputLog.file == NULL) return true;
+    bool ok = true;
+
+    if (gInputLog.recording) {
+        input_log_flush_run();
+        long bytes = ftell(gInputLog.file);
+        fseek(gInputLog.file, INPUT_LOG_TICKS_OFFSET, SEEK_SET);
+        write_u32(gInputLog.file, gInputLog.ticks);
+        write_u32(gInputLog.file, finalChecksum);
+        std::cout << "Recorded " << gInputLog.ticks << " ticks in " << bytes << " bytes (seed "
+                  << gInputLog.seed << ", final state " << std::hex << finalChecksum << std::dec << ")" << std::endl;
+    } else if (gInputLog.position < gInputLog.ticks) {
+        std::cout << "Replay stopped after " << gInputLog.position << " of " << gInputLog.ticks << " ticks" << std::endl;
+    } else {
+        ok = finalChecksum == gInputLog.checksum;
+        std::cout << "Replay " << (ok ? "matched" : "DIVERGED from") << " the recording (final state "
+                  << std::hex << finalChecksum << ", recorded " << gInputLog.checksum << std::dec << ")" << std::endl;
+    }
+
+    fclose(gInputLog.file);
+    gInputLog.file = NULL;
+    gInputLog.recording = false;
+    gInputLog.replaying = false;
+    return ok;
+}
+
+/**
+ * @brief Milliseconds since launch, for packet times (usable before SDL is up).
+ */
+Uint32 net_now_ms() {
+    return (Uint32)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - gLaunchTime).count();
+}
+
+/**
+ * @brief Little-endian packet fields of 1, 2 or 4 bytes. Reading past the end
+ *        returns 0 and clears in.ok.
+ */
+void net_write(Uint8*& out, Uint32 value, int bytes) {
+    for (int i = 0; i < bytes; ++i) *out++ = (Uint8)(value >> (8 * i));
+}
+
+Uint32 net_read(NetReader& in, int bytes) {
+    if (in.end - in.data < bytes) {
+        in.ok = false;
+        in.data = in.end;
+        return 0;
+    }
+    Uint32 value = 0;
+    for (int i = 0; i < bytes; ++i) value |= (Uint32)*in.data++ << (8 * i);
+    return value;
+}
+
+/**
+ * @brief Opens the session's non-blocking UDP socket on port (0: any free port).
+ */
+bool net_open_socket(int port) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        std::cerr << "ERROR: Could not start Winsock!" << std::endl;
+        return false;
+    }
+#endif
+    gNet.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (gNet.socket == NET_NO_SOCKET) {
+        std::cerr << "ERROR: Could not create a UDP socket!" << std::endl;
+        return false;
+    }
+    gNet.socketOpen = true;
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((Uint16)port);
+    if (bind(gNet.socket, (const sockaddr*)&local, sizeof(local)) != 0) {
+        std::cerr << "ERROR: Could not bind UDP port " << port << "!" << std::endl;
+        return false;
+    }
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(gNet.socket, FIONBIO, &nonBlocking);
+#else
+    fcntl(gNet.socket, F_SETFL, fcntl(gNet.socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    return true;
+}
+
+void net_send_packet(const Uint8* packet, int size) {
+    sendto(gNet.socket, (const char*)packet, size, 0, (const sockaddr*)&gNet.peer, sizeof(gNet.peer));
+    gNet.bytesSent += size + NET_UDP_OVERHEAD;
+    gNet.packetsSent++;
+    gNet.lastSendMs = net_now_ms();
+}
+
+/**
+ * @brief Takes the next queued packet from the partner, skipping anything that
+ *        isn't ours. A host still waiting for a guest takes whoever knocks.
+ * @return The packet's size, or 0 if none is waiting.
+ */
+int net_receive_packet(Uint8* packet, bool anySender) {
+    for (;;) {
+        sockaddr_in from;
+        NetAddressSize fromSize = sizeof(from);
+        int size = (int)recvfrom(gNet.socket, (char*)packet, NET_PACKET_SIZE, 0, (sockaddr*)&from, &fromSize);
+        if (size <= 0) return 0;
+        if (size < 3 || (packet[0] | (packet[1] << 8)) != NET_MAGIC) continue;
+        if (anySender) {
+            gNet.peer = from;
+        } else if (from.sin_addr.s_addr != gNet.peer.sin_addr.s_addr || from.sin_port != gNet.peer.sin_port) {
+            continue;
+        }
+        gNet.bytesReceived += size + NET_UDP_OVERHEAD;
+        gNet.packetsReceived++;
+        gNet.lastReceiveMs = net_now_ms();
+        return size;
+    }
+}
+
+void net_write_level(Uint8*& out, const LevelFingerprint& print) {
+    net_write(out, print.width, 4);
+    net_write(out, print.height, 4);
+    net_write(out, print.hash, 4);
+}
+
+LevelFingerprint net_read_level(NetReader& in) {
+    LevelFingerprint print;
+    print.width = net_read(in, 4);
+    print.height = net_read(in, 4);
+    print.hash = net_read(in, 4);
+    return print;
+}
+
+/**
+ * @brief Starts a two-player session. The host waits for a guest on its port and
+ *        sends it the seed and the options that change the simulation; the guest
+ *        knocks until it has them and takes them over, as a replay does. The level
+ *        can't be sent along, so both sides refuse to start unless their --level
+ *        fingerprints match.
+ */
+bool net_connect(LaunchOptions& options, Uint32& seed) {
+    gNet.host = options.hostPort != 0;
+    int port = options.hostPort;
+    memset(&gNet.peer, 0, sizeof(gNet.peer));
+    if (!gNet.host) {
+        std::string address = options.joinAddress;
+        size_t colon = address.rfind(':');
+        int joinPort = colon == std::string::npos ? 0 : atoi(address.c_str() + colon + 1);
+        gNet.peer.sin_family = AF_INET;
+        gNet.peer.sin_addr.s_addr = inet_addr(address.substr(0, colon).c_str());
+        gNet.peer.sin_port = htons((Uint16)joinPort);
+        if (colon == std::string::npos || joinPort <= 0 || joinPort > 65535 || gNet.peer.sin_addr.s_addr == INADDR_NONE) {
+            std::cerr << "--join needs ADDRESS:PORT with a numeric IPv4 address" << std::endl;
+            return false;
+        }
+        port = 0;
+    }
+    LevelFingerprint level;
+    if (!level_fingerprint(options.levelPath, level)) return false;
+    if (!net_open_socket(port)) return false;
+
+    // 1. The welcome: everything the guest's simulation must share with the host's
+    Uint8* out = gNet.welcome;
+    net_write(out, NET_MAGIC, 2);
+    net_write(out, NET_WELCOME, 1);
+    net_write(out, NET_VERSION, 2);
+    net_write(out, seed, 4);
+    net_write(out, (Uint32)options.simHz, 4);
+    net_write(out, (Uint32)options.stressBalls, 4);
+    net_write(out, options.ballCollisions ? 1 : 0, 1);
+    net_write_level(out, level);
+    gNet.welcomeSize = (int)(out - gNet.welcome);
+
+    // 2. Meet
+    if (gNet.host) {
+        std::cout << "Waiting for a partner on UDP port " << port << "..." << std::endl;
+    } else {
+        std::cout << "Joining " << options.joinAddress << "..." << std::endl;
+    }
+    Uint8 packet[NET_PACKET_SIZE];
+    Uint32 start = net_now_ms();
+    Uint32 lastHello = start - NET_HELLO_MS;
+    bool connected = false;
+    while (!connected) {
+        Uint32 now = net_now_ms();
+        if (now - start > NET_CONNECT_TIMEOUT_MS) {
+            std::cerr << "ERROR: No partner after " << NET_CONNECT_TIMEOUT_MS / 1000 << " s!" << std::endl;
+            return false;
+        }
+        if (!gNet.host && now - lastHello >= NET_HELLO_MS) {
+            Uint8 hello[20];
+            Uint8* helloEnd = hello;
+            net_write(helloEnd, NET_MAGIC, 2);
+            net_write(helloEnd, NET_HELLO, 1);
+            net_write(helloEnd, NET_VERSION, 2);
+            net_write_level(helloEnd, level);
+            net_send_packet(hello, (int)(helloEnd - hello));
+            lastHello = now;
+        }
+
+        int size;
+        while (!connected && (size = net_receive_packet(packet, gNet.host)) > 0) {
+            NetReader in = {packet + 2, packet + size, true};
+            int type = net_read(in, 1);
+            // Only the handshake packet counts: a host whose welcome to us was lost
+            // already sends ticks, which carry no version. Skip those and knock on.
+            if (type != (gNet.host ? NET_HELLO : NET_WELCOME)) continue;
+            if (net_read(in, 2) != NET_VERSION) {
+                std::cerr << "ERROR: The partner runs a different network version!" << std::endl;
+                return false;
+            }
+            if (gNet.host) {
+                LevelFingerprint guestLevel = net_read_level(in);
+                if (!in.ok) continue;
+                // Welcome it anyway, so the guest learns which level to load
+                net_send_packet(gNet.welcome, gNet.welcomeSize);
+                if (!same_level(guestLevel, level)) {
+                    std::cerr << "ERROR: The partner plays ";
+                    print_level(std::cerr, guestLevel);
+                    std::cerr << ", we play ";
+                    print_level(std::cerr, level);
+                    std::cerr << "!" << std::endl;
+                    return false;
+                }
+                connected = true;
+            } else {
+                Uint32 hostSeed = net_read(in, 4);
+                Uint32 simHz = net_read(in, 4);
+                Uint32 stressBalls = net_read(in, 4);
+                Uint32 ballCollisions = net_read(in, 1);
+                LevelFingerprint hostLevel = net_read_level(in);
+                if (!in.ok) continue;
+                if (simHz < (Uint32)MIN_SIM_HZ || simHz > (Uint32)MAX_SIM_HZ ||
+                    stressBalls > (Uint32)STRESS_MAX_BALLS || ballCollisions > 1) {
+                    std::cerr << "ERROR: The host sent invalid simulation options (" << simHz << " Hz, "
+                              << stressBalls << " stress balls)!" << std::endl;
+                    return false;
+                }
+                if (!same_level(hostLevel, level)) {
+                    std::cerr << "ERROR: The host plays ";
+                    print_level(std::cerr, hostLevel);
+                    std::cerr << ", we play ";
+                    print_level(std::cerr, level);
+                    std::cerr << "; start again with the host's --level" << std::endl;
+                    return false;
+                }
+                seed = hostSeed;
+                options.simHz = (int)simHz;
+                options.stressBalls = (int)stressBalls;
+                options.ballCollisions = ballCollisions != 0;
+                connected = true;
+            }
+        }
+        if (!connected) SDL_Delay(10);
+    }
+
+    // 3. Both sides start at tick 0 with NET_INPUT_DELAY idle ticks already in
+    TickInput idle = {0, 0, 0};
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (int t = 0; t < NET_INPUT_DELAY; ++t) {
+        gNet.localInputs[t] = idle;
+        gNet.remoteInputs[t] = idle;
+        gNet.sampled[t] = now;
+    }
+    gNet.localCount = NET_INPUT_DELAY;
+    gNet.remoteCount = NET_INPUT_DELAY;
+    gNet.peerInputAck = NET_INPUT_DELAY;
+    for (int i = 0; i < NET_SYNC_HISTORY; ++i) {
+        gNet.ownSyncs[i].tick = NET_NO_TICK;
+        gNet.peerSyncs[i].tick = NET_NO_TICK;
+    }
+    gNet.newestSync = NET_NO_TICK;
+    gNet.peerSyncAck = NET_NO_TICK;
+    gNet.syncAck = NET_NO_TICK;
+    gNet.startMs = net_now_ms();
+    gNet.lastReceiveMs = gNet.startMs;
+    gNet.active = true;
+    gState.playerCount = 2;
+    std::cout << "Partner connected: you are player " << (gNet.host ? "1 (keys and mouse)" : "2 (keys)") << std::endl;
+    return true;
+}
+
+/**
+ * @brief Encodes bytes as the runs where they differ from base: a count of equal
+ *        bytes, a count of changed bytes, then the changed bytes, repeated.
+ * @return Encoded size (at most 3 * size).
+ */
+int net_delta_encode(const Uint8* bytes, const Uint8* base, int size, Uint8* out) {
+    Uint8* start = out;
+    int i = 0;
+    while (i < size) {
+        int same = 0;
+        while (i + same < size && same < 255 && bytes[i + same] == base[i + same]) same++;
+        i += same;
+        int changed = 0;
+        while (i + changed < size && changed < 255 && bytes[i + changed] != base[i + changed]) changed++;
+        *out++ = (Uint8)same;
+        *out++ = (Uint8)changed;
+        memcpy(out, bytes + i, changed);
+        out += changed;
+        i += changed;
+    }
+    return (int)(out - start);
+}
+
+/**
+ * @brief Reverses net_delta_encode() against the same base.
+ * @return false if the encoding is damaged.
+ */
+bool net_delta_decode(NetReader& in, const Uint8* base, int size, Uint8* bytes) {
+    memcpy(bytes, base, size);
+    int i = 0;
+    while (i < size) {
+        int same = net_read(in, 1);
+        int changed = net_read(in, 1);
+        if (!in.ok || same + changed == 0 || i + same + changed > size || in.end - in.data < changed) return false;
+        i += same;
+        memcpy(bytes + i, in.data, changed);
+        in.data += changed;
+        i += changed;
+    }
+    return true;
+}
+
+/**
+ * @brief Finds the sync for tick in a history, or NULL if it has been replaced.
+ */
+NetSync* net_find_sync(NetSync* history, Uint32 tick) {
+    if (tick == NET_NO_TICK) return NULL;
+    NetSync& sync = history[(tick / NET_SYNC_INTERVAL) % NET_SYNC_HISTORY];
+    return sync.tick == tick ? &sync : NULL;
+}
+
+/**
+ * @brief Sends the partner what it hasn't acknowledged: our inputs from its ack on
+ *        and our newest state sync, delta-compressed against the newest sync it
+ *        has (or zeros).
+ */
+void net_send_tick() {
+    static const Uint8 zeros[4 + GAME_STATE_PACK_MAX] = {0};
+    Uint8 packet[NET_PACKET_SIZE];
+    Uint8* out = packet;
+    net_write(out, NET_MAGIC, 2);
+    net_write(out, NET_TICK, 1);
+    net_write(out, net_now_ms(), 4);
+    net_write(out, gNet.peerSendTime, 4);
+    net_write(out, gNet.remoteCount, 4); // Acks: the partner's inputs we have...
+    net_write(out, gNet.syncAck, 4);     // ... and its newest sync we decoded
+
+    // 1. Inputs
+    Uint32 first = gNet.peerInputAck;
+    Uint32 count = std::min(gNet.localCount - first, (Uint32)NET_MAX_INPUTS_PER_PACKET);
+    net_write(out, first, 4);
+    net_write(out, count, 1);
+    for (Uint32 i = 0; i < count; ++i) {
+        const TickInput& input = gNet.localInputs[(first + i) % NET_INPUT_WINDOW];
+        net_write(out, input.flags, 1);
+        net_write(out, (Uint16)input.mouseX, 2);
+        net_write(out, (Uint16)input.mouseY, 2);
+    }
+
+    // 2. State sync, until the partner has it
+    const NetSync* sync = net_find_sync(gNet.ownSyncs, gNet.newestSync);
+    bool sendSync = sync != NULL && gNet.peerSyncAck != gNet.newestSync;
+    net_write(out, sendSync ? 1 : 0, 1);
+    if (sendSync) {
+        const NetSync* base = net_find_sync(gNet.ownSyncs, gNet.peerSyncAck);
+        if (base != NULL && base->size != sync->size) base = NULL;
+        net_write(out, sync->tick, 4);
+        net_write(out, base != NULL ? base->tick : NET_NO_TICK, 4);
+        net_write(out, sync->checksum, 4);
+        net_write(out, sync->size, 2);
+        int encoded = net_delta_encode(sync->bytes, base != NULL ? base->bytes : zeros, sync->size, out);
+        out += encoded;
+        gNet.syncsSent++;
+        gNet.syncBytesSent += encoded;
+    }
+    net_send_packet(packet, (int)(out - packet));
+}
+
+/**
+ * @brief Takes in a NET_TICK packet. Packets may come late, twice or out of
+ *        order, so every field only ever moves the session forward.
+ */
+void net_handle_tick(NetReader& in) {
+    Uint32 sendTime = net_read(in, 4);
+    Uint32 echoTime = net_read(in, 4);
+    Uint32 inputAck = net_read(in, 4);
+    Uint32 syncAck = net_read(in, 4);
+    Uint32 first = net_read(in, 4);
+    Uint32 count = net_read(in, 1);
+    if (!in.ok) return;
+
+    // 1. Acks and the round trip
+    if (sendTime > gNet.peerSendTime) gNet.peerSendTime = sendTime;
+    if (echoTime > gNet.lastEcho) {
+        gNet.lastEcho = echoTime;
+        gNet.rttTotalMs += net_now_ms() - echoTime;
+        gNet.rttSamples++;
+    }
+    if (inputAck > gNet.peerInputAck && inputAck <= gNet.localCount) gNet.peerInputAck = inputAck;
+    if (syncAck != NET_NO_TICK && (gNet.peerSyncAck == NET_NO_TICK || syncAck > gNet.peerSyncAck)) {
+        gNet.peerSyncAck = syncAck;
+    }
+
+    // 2. Inputs: keep the ones that continue what we have
+    for (Uint32 i = 0; i < count; ++i) {
+        TickInput input;
+        input.flags = (Uint8)net_read(in, 1);
+        input.mouseX = (Sint16)net_read(in, 2);
+        input.mouseY = (Sint16)net_read(in, 2);
+        if (!in.ok) return;
+        if (first + i == gNet.remoteCount && gNet.remoteCount - gNet.tick < (Uint32)NET_INPUT_WINDOW) {
+            gNet.remoteInputs[gNet.remoteCount % NET_INPUT_WINDOW] = input;
+            gNet.remoteCount++;
+        }
+    }
+
+    // 3. State sync: rebuild it on its base, check it arrived whole, compare
+    if (net_read(in, 1) == 0 || !in.ok) return;
+    static const Uint8 zeros[4 + GAME_STATE_PACK_MAX] = {0};
+    NetSync sync;
+    sync.tick = net_read(in, 4);
+    Uint32 baseTick = net_read(in, 4);
+    sync.checksum = net_read(in, 4);
+    sync.size = (int)net_read(in, 2);
+    if (!in.ok || sync.tick == NET_NO_TICK || sync.size < 4 || sync.size > (int)sizeof(sync.bytes)) return;
+    const NetSync* base = net_find_sync(gNet.peerSyncs, baseTick);
+    if (baseTick != NET_NO_TICK && (base == NULL || base->size != sync.size)) return; // Its next sync will do
+    if (!net_delta_decode(in, base != NULL ? base->bytes : zeros, sync.size, sync.bytes)) return;
+    Uint32 poolHash;
+    memcpy(&poolHash, sync.bytes, sizeof(poolHash));
+    if (fnv1a(poolHash, sync.bytes + 4, sync.size - 4) != sync.checksum) return;
+
+    NetSync& slot = gNet.peerSyncs[(sync.tick / NET_SYNC_INTERVAL) % NET_SYNC_HISTORY];
+    if (slot.tick != NET_NO_TICK && slot.tick >= sync.tick) return; // Have it (or newer) already
+    slot = sync;
+    if (gNet.syncAck == NET_NO_TICK || sync.tick > gNet.syncAck) gNet.syncAck = sync.tick;
+    net_compare_sync(sync.tick);
+}
+
+/**
+ * @brief Compares our state at tick with the partner's, once both are known.
+ */
+void net_compare_sync(Uint32 tick) {
+    if (tick <= gNet.lastCompared) return;
+    const NetSync* own = net_find_sync(gNet.ownSyncs, tick);
+    const NetSync* peer = net_find_sync(gNet.peerSyncs, tick);
+    if (own == NULL || peer == NULL) return;
+    gNet.lastCompared = tick;
+    gNet.syncsCompared++;
+    if (own->size == peer->size && memcmp(own->bytes, peer->bytes, own->size) == 0) return;
+
+    int firstDifference = 0;
+    while (firstDifference < std::min(own->size, peer->size) && own->bytes[firstDifference] == peer->bytes[firstDifference]) firstDifference++;
+    gNet.desyncs++;
+    char line[128];
+    snprintf(line, sizeof(line), "ERROR: Desync at tick %u: state differs from byte %d on (checksum %08x here, %08x on the partner)",
+             (unsigned)tick, firstDifference, (unsigned)own->checksum, (unsigned)peer->checksum);
+    std::cerr << line << std::endl;
+}
+
+/**
+ * @brief Takes in everything the partner sent and keeps our packets flowing.
+ * @return false once the partner has left or gone silent.
+ */
+bool net_poll() {
+    Uint8 packet[NET_PACKET_SIZE];
+    int size;
+    while ((size = net_receive_packet(packet, false)) > 0) {
+        NetReader in = {packet + 2, packet + size, true};
+        int type = net_read(in, 1);
+        if (type == NET_TICK) {
+            net_handle_tick(in);
+        } else if (type == NET_HELLO && gNet.host) {
+            net_send_packet(gNet.welcome, gNet.welcomeSize); // Our welcome was lost
+        } else if (type == NET_BYE) {
+            std::cout << "Partner left." << std::endl;
+            gNet.peerLeft = true;
+            return false;
+        }
+    }
+    Uint32 now = net_now_ms();
+    if (now - gNet.lastReceiveMs > NET_PEER_TIMEOUT_MS) {
+        std::cerr << "ERROR: Partner silent for " << NET_PEER_TIMEOUT_MS / 1000 << " s, giving up." << std::endl;
+        return false;
+    }
+    if (now - gNet.lastSendMs >= NET_RESEND_MS) net_send_tick();
+    return true;
+}
+
+/**
+ * @brief Gets both players' input for the next tick. Samples our own input
+ *        NET_INPUT_DELAY ticks ahead and sends it; waits (returns false) while
+ *        the partner's input for the tick hasn't arrived.
+ */
+bool net_take_inputs(TickInput& first, TickInput& partner) {
+    // 1. Sample ours for tick + NET_INPUT_DELAY, unless the partner is a window behind
+    if (gNet.localCount == gNet.tick + NET_INPUT_DELAY && gNet.localCount - gNet.peerInputAck < (Uint32)NET_INPUT_WINDOW) {
+        TickInput input = take_live_input(SDL_GetKeyState(NULL));
+        input.flags &= ~INPUT_REWIND; // One shared timeline: no rewinding it
+        gNet.localInputs[gNet.localCount % NET_INPUT_WINDOW] = input;
+        gNet.sampled[gNet.localCount % NET_INPUT_WINDOW] = std::chrono::steady_clock::now();
+        gNet.localCount++;
+        net_send_tick();
+    }
+
+    // 2. Wait for theirs
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (gNet.remoteCount <= gNet.tick || gNet.localCount <= gNet.tick) {
+        if (!gNet.stalled) {
+            gNet.stalled = true;
+            gNet.stallStart = now;
+        }
+        return false;
+    }
+    if (gNet.stalled) {
+        gNet.stalled = false;
+        gNet.stallMs += std::chrono::duration<double, std::milli>(now - gNet.stallStart).count();
+    }
+
+    // 3. The host is the first player
+    int slot = gNet.tick % NET_INPUT_WINDOW;
+    first = gNet.host ? gNet.localInputs[slot] : gNet.remoteInputs[slot];
+    partner = gNet.host ? gNet.remoteInputs[slot] : gNet.localInputs[slot];
+    if (gNet.tick >= (Uint32)NET_INPUT_DELAY) {
+        gNet.latencyMs.push_back((float)std::chrono::duration<double, std::milli>(now - gNet.sampled[slot]).count());
+    }
+    gNet.tick++;
+    return true;
+}
+
+/**
+ * @brief After each networked tick: every NET_SYNC_INTERVAL ticks, packs our
+ *        state for the partner and checks it against theirs if already here.
+ */
+void net_end_tick() {
+    if (gNet.tick % NET_SYNC_INTERVAL != 0) return;
+    NetSync& sync = gNet.ownSyncs[(gNet.tick / NET_SYNC_INTERVAL) % NET_SYNC_HISTORY];
+    Uint32 poolHash = ball_pool_checksum();
+    memcpy(sync.bytes, &poolHash, sizeof(poolHash));
+    sync.size = 4 + pack_game_state(sync.bytes + 4);
+    sync.checksum = fnv1a(poolHash, sync.bytes + 4, sync.size - 4);
+    sync.tick = gNet.tick;
+    gNet.newestSync = gNet.tick;
+    net_compare_sync(gNet.tick);
+}
+
+/**
+ * @brief Steers the partner (second player) with its tick input.
+ */
+void apply_partner_input(const TickInput& input, Uint8* keystates) {
+    keystates[PLAYER_KEYS[1].left] = (input.flags & INPUT_LEFT) ? 1 : 0;
+    keystates[PLAYER_KEYS[1].right] = (input.flags & INPUT_RIGHT) ? 1 : 0;
+    keystates[PLAYER_KEYS[1].up] = (input.flags & INPUT_UP) ? 1 : 0;
+    keystates[PLAYER_KEYS[1].down] = (input.flags & INPUT_DOWN) ? 1 : 0;
+}
+
+/**
+ * @brief Says goodbye (twice, in case one is lost) and closes the socket.
+ */
+void net_close() {
+    if (!gNet.socketOpen) return;
+    if (gNet.active && !gNet.peerLeft) {
+        Uint8 bye[3];
+        Uint8* out = bye;
+        net_write(out, NET_MAGIC, 2);
+        net_write(out, NET_BYE, 1);
+        net_send_packet(bye, sizeof(bye));
+        net_send_packet(bye, sizeof(bye));
+    }
+#ifdef _WIN32
+    closesocket(gNet.socket);
+    WSACleanup();
+#else
+    close(gNet.socket);
+#endif
+    gNet.socketOpen = false;
+    gNet.active = false;
+}
+
+/**
+ * @brief Prints traffic, added input latency and sync results of a networked game.
+ */
+void print_net_stats() {
+    if (!gNet.active) return;
+    double seconds = std::max(0.001, (net_now_ms() - gNet.startMs) / 1000.0);
+    Uint8 packed[GAME_STATE_PACK_MAX];
+    int packedSize = 4 + pack_game_state(packed);
+    char line[160];
+    std::cout << "--- Network (" << (gNet.host ? "host" : "guest") << ") ---" << std::endl;
+    snprintf(line, sizeof(line), "Ticks: %u with %d ticks of input delay (%.1f ms)",
+             (unsigned)gNet.tick, NET_INPUT_DELAY, NET_INPUT_DELAY * gTickMs);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof(line), "Sent: %.0f B/s in %.1f packets/s; received: %.0f B/s in %.1f packets/s (UDP/IP headers included)",
+             gNet.bytesSent / seconds, gNet.packetsSent / seconds, gNet.bytesReceived / seconds, gNet.packetsReceived / seconds);
+    std::cout << line << std::endl;
+    if (!gNet.latencyMs.empty()) {
+        std::vector<float> sorted = gNet.latencyMs;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (float ms : sorted) total += ms;
+        snprintf(line, sizeof(line), "Added input latency: %.1f ms avg, %.1f ms p99; %.0f ms stalled waiting for the partner",
+                 total / sorted.size(), sorted[(sorted.size() * 99) / 100], gNet.stallMs);
+        std::cout << line << std::endl;
+    }
+    if (gNet.rttSamples > 0) {
+        snprintf(line, sizeof(line), "Round trip: %.1f ms avg (including the partner's reply delay)", gNet.rttTotalMs / gNet.rttSamples);
+        std::cout << line << std::endl;
+    }
+    snprintf(line, sizeof(line), "State syncs: %ld compared, %ld desyncs; %ld sent at %.0f bytes avg (%d packed)",
+             gNet.syncsCompared, gNet.desyncs, gNet.syncsSent,
+             gNet.syncsSent > 0 ? (double)gNet.syncBytesSent / gNet.syncsSent : 0.0, packedSize);
+    std::cout << line << std::endl;
+}
+
+/**
+ * @brief Performs AABB (Axis-Aligned Bounding Box) collision detection.
+ */
+bool check_collision(const SDL_Rect& A, const SDL_Rect& B) {
+    if (A.y + A.h <= B.y) return false; 
+    if (A.y >= B.y + B.h) return false; 
+    if (A.x + A.w <= B.x) return false; 
+    if (A.x >= B.x + B.w) return false; 
+    
+    return true;
+}
+
+/**
+ * @brief Batched version of check_collision(): tests box A against up to 32 boxes
+ *        stored as packed arrays (x[], y[], w[], h[]) and returns a bitmask with
+ *        bit i set when box i overlaps A. Branch-free; uses AVX2/SSE2 compares
+ *        when available. check_collision() stays the reference implementation.
+ */
+Uint32 collide_box_batch(int ax, int ay, int aw, int ah,
+                         const int* x, const int* y, const int* w, const int* h, int count) {
+    const int aRight = ax + aw;
+    const int aBottom = ay + ah;
+    Uint32 hits = 0;
+    int i = 0;
+
+#if defined(USE_AVX2)
+    {
+        const __m256i vLeft = _mm256_set1_epi32(ax);
+        const __m256i vTop = _mm256_set1_epi32(ay);
+        const __m256i vRight = _mm256_set1_epi32(aRight);
+        const __m256i vBottom = _mm256_set1_epi32(aBottom);
+        for (; i + 8 <= count; i += 8) {
+            __m256i bx = _mm256_loadu_si256((const __m256i*)(x + i));
+            __m256i by = _mm256_loadu_si256((const __m256i*)(y + i));
+            __m256i bRight = _mm256_add_epi32(bx, _mm256_loadu_si256((const __m256i*)(w + i)));
+            __m256i bBottom = _mm256_add_epi32(by, _mm256_loadu_si256((const __m256i*)(h + i)));
+            // Overlap when B.y < A.bottom, A.y < B.bottom, B.x < A.right and A.x < B.right
+            __m256i overlap = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi32(vBottom, by), _mm256_cmpgt_epi32(bBottom, vTop)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(vRight, bx), _mm256_cmpgt_epi32(bRight, vLeft)));
+            hits |= (Uint32)_mm256_movemask_ps(_mm256_castsi256_ps(overlap)) << i;
+        }
+    }
+#endif
+
+#if defined(USE_SSE2)
+    {
+        const __m128i vLeft = _mm_set1_epi32(ax);
+        const __m128i vTop = _mm_set1_epi32(ay);
+        const __m128i vRight = _mm_set1_epi32(aRight);
+        const __m128i vBottom = _mm_set1_epi32(aBottom);
+        for (; i + 4 <= count; i += 4) {
+            __m128i bx = _mm_loadu_si128((const __m128i*)(x + i));
+            __m128i by = _mm_loadu_si128((const __m128i*)(y + i));
+            __m128i bRight = _mm_add_epi32(bx, _mm_loadu_si128((const __m128i*)(w + i)));
+            __m128i bBottom = _mm_add_epi32(by, _mm_loadu_si128((const __m128i*)(h + i)));
+            __m128i overlap = _mm_and_si128(
+                _mm_and_si128(_mm_cmpgt_epi32(vBottom, by), _mm_cmpgt_epi32(bBottom, vTop)),
+                _mm_and_si128(_mm_cmpgt_epi32(vRight, bx), _mm_cmpgt_epi32(bRight, vLeft)));
+            hits |= (Uint32)_mm_movemask_ps(_mm_castsi128_ps(overlap)) << i;
+        }
+    }
+#endif
+
+    // Remainder (or everything, without SIMD), still without branches
+    for (; i < count; ++i) {
+        Uint32 overlap = (Uint32)(y[i] < aBottom) & (Uint32)(ay < y[i] + h[i]) &
+                         (Uint32)(x[i] < aRight) & (Uint32)(ax < x[i] + w[i]);
+        hits |= overlap << i;
+    }
+    return hits;
+}
+
+/**
+ * @brief Index of the lowest set bit (mask must not be 0).
+ */
+inline int lowest_bit_index(Uint32 mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+/**
+ * @brief Moves the target box to a random, safe location in the world.
+ */
+void move_target_randomly() {
+    int maxX = gWorldWidth - TARGET_WIDTH;
+    int maxY = gWorldHeight - TARGET_HEIGHT;
+    
+    gState.targetX = game_random() % maxX;
+    gState.targetY = game_random() % maxY;
+}
+
+/**
+ * @brief Updates the position and velocity of the beachball based on physics.
+ */
+void update_ball_physics() {
+    if (gState.ballGrabbed) {
+        // Ball follows the cursor (centered on the mouse position, which is the
+        // center of the cursor image; the sim doesn't depend on the loaded image)
+        gState.ballX = gState.mouseX + gState.cameraX - (BALL_WIDTH / 2);
+        gState.ballY = gState.mouseY + gState.cameraY - (BALL_HEIGHT / 2);
+        
+        // Clamp to world bounds
+        if (gState.ballX < 0) gState.ballX = 0;
+        if (gState.ballX + BALL_WIDTH > gWorldWidth) gState.ballX = gWorldWidth - BALL_WIDTH;
+        if (gState.ballY < 0) gState.ballY = 0;
+        if (gState.ballY + BALL_HEIGHT > gWorldHeight) gState.ballY = gWorldHeight - BALL_HEIGHT;
+        
+        return; 
+    }
+
+    // 1. Apply Gravity to Y Velocity
+    gState.ballVelY += FREE_ROAM_GRAVITY * gTickScale;
+    double startX = gState.ballX;
+    double startY = gState.ballY;
+
+    // 2-3. Move, bouncing off the world edges (walls) at their time of impact; the
+    //      rest of the move continues with the reflected velocity
+    const double maxX = gWorldWidth - BALL_WIDTH;
+    const double maxY = gWorldHeight - BALL_HEIGHT;
+    double remaining = 1.0; // Fraction of this tick's move still to do
+    for (int i = 0; i < MAX_BALL_BOUNCES_PER_TICK && remaining > 0.0; ++i) {
+        double moveX = gState.ballVelX * gTickScale * remaining;
+        double moveY = gState.ballVelY * gTickScale * remaining;
+        double timeX = wall_hit_time(gState.ballX, moveX, 0.0, maxX);
+        double timeY = wall_hit_time(gState.ballY, moveY, 0.0, maxY);
+        double time = std::min(1.0, std::min(timeX, timeY));
+        gState.ballX += moveX * time;
+        gState.ballY += moveY * time;
+        remaining *= 1.0 - time;
+
+        // Horizontal Bounds
+        if (timeX <= time) {
+            gState.ballX = moveX < 0.0 ? 0.0 : maxX;
+            gState.ballVelX *= -BOUNCE_FACTOR;
+            ball_bounce_feedback(gState.ballVelX, moveX < 0.0 ? 0.0 : gWorldWidth, gState.ballY + BALL_HEIGHT / 2);
+        }
+
+        // Vertical Bounds (top edge, bottom edge)
+        if (timeY <= time) {
+            gState.ballY = moveY < 0.0 ? 0.0 : maxY;
+            gState.ballVelY *= -BOUNCE_FACTOR;
+            ball_bounce_feedback(gState.ballVelY, gState.ballX + BALL_WIDTH / 2, moveY < 0.0 ? 0.0 : gWorldHeight);
+            if (moveY > 0.0 && std::abs(gState.ballVelY) < FREE_ROAM_GRAVITY * gTickScale) {
+                gState.ballVelY = 0; // Resting on the floor
+            }
+        }
+    }
+    gState.ballX = std::min(std::max(gState.ballX, 0.0), maxX); // Out of bounces (or started outside)
+    gState.ballY = std::min(std::max(gState.ballY, 0.0), maxY);
+    
+    // 4. Player Collision (AABB) - Check only if not in Platform Loss mode
+    for (int i = 0; i < gState.playerCount && !gState.platformLoss; ++i) {
+        if (sweep_ball_against_player(i, startX, startY) ||
+            bounce_off_player(gState.players[i], gState.ballX, gState.ballY, gState.ballVelX, gState.ballVelY)) {
+            ball_bounce_feedback(std::max(std::abs(gState.ballVelX), std::abs(gState.ballVelY)),
+                                 gState.ballX + BALL_WIDTH / 2, gState.ballY + BALL_HEIGHT / 2);
+        }
+    }
+}
+
+/**
+ * @brief Swept AABB test: when does the w x h box at (x, y), moving by (moveX, moveY),
+ *        first touch target?
+ * @param[out] time Time of impact as a fraction of the move, 0 to 1.
+ * @param[out] normalX, normalY Side of target that was hit (e.g. normalY = -1: its top).
+ * @return false if the box doesn't reach target during the move, or already
+ *         overlaps it at the start.
+ */
+bool sweep_box(double x, double y, int w, int h, double moveX, double moveY, const SDL_Rect& target,
+               double& time, int& normalX, int& normalY) {
+    // 1. Per axis, the fractions of the move during which the boxes overlap
+    double entryX = -HUGE_VAL, exitX = HUGE_VAL;
+    if (moveX > 0.0) {
+        entryX = (target.x - (x + w)) / moveX;
+        exitX = (target.x + target.w - x) / moveX;
+    } else if (moveX < 0.0) {
+        entryX = (target.x + target.w - x) / moveX;
+        exitX = (target.x - (x + w)) / moveX;
+    } else if (x + w <= target.x || x >= target.x + target.w) {
+        return false; // Never overlaps on this axis
+    }
+
+    double entryY = -HUGE_VAL, exitY = HUGE_VAL;
+    if (moveY > 0.0) {
+        entryY = (target.y - (y + h)) / moveY;
+        exitY = (target.y + target.h - y) / moveY;
+    } else if (moveY < 0.0) {
+        entryY = (target.y + target.h - y) / moveY;
+        exitY = (target.y - (y + h)) / moveY;
+    } else if (y + h <= target.y || y >= target.y + target.h) {
+        return false;
+    }
+
+    // 2. They touch once both axes overlap; the axis that got there last was hit
+    double entry = std::max(entryX, entryY);
+    double exit = std::min(exitX, exitY);
+    if (entry >= exit || entry < 0.0 || entry > 1.0) {
+        return false; // Misses, started overlapping, or doesn't get there this move
+    }
+    time = entry;
+    normalX = 0;
+    normalY = 0;
+    if (entryX > entryY) normalX = moveX > 0.0 ? -1 : 1;
+    else normalY = moveY > 0.0 ? -1 : 1;
+    return true;
+}
+
+/**
+ * @brief Fraction of move after which position leaves [low, high] (clamped to 0 if
+ *        it's outside already), or 2 if it stays inside.
+ */
+double wall_hit_time(double position, double move, double low, double high) {
+    if (move < 0.0 && position + move < low) return std::max(0.0, (low - position) / move);
+    if (move > 0.0 && position + move > high) return std::max(0.0, (high - position) / move);
+    return 2.0;
+}
+
+/**
+ * @brief Sweeps the ball's move this tick (from startX/Y to gState.ballX/Y) against the
+ *        player's, so neither can pass through the other in one long tick. On
+ *        contact the ball is put against the side it hit and bounces off it.
+ * @param index Into gState.players.
+ * @return true if the ball hit the player.
+ */
+bool sweep_ball_against_player(int index, double startX, double startY) {
+    // Relative to the player's box at the start of the tick
+    const PlayerState& player = gState.players[index];
+    SDL_Rect playerBox = {(Sint16)gPrevPlayerX[index], (Sint16)gPrevPlayerY[index], (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
+    double moveX = (gState.ballX - startX) - (player.x - gPrevPlayerX[index]);
+    double moveY = (gState.ballY - startY) - (player.y - gPrevPlayerY[index]);
+    double time;
+    int normalX, normalY;
+    if (!sweep_box(startX, startY, BALL_WIDTH, BALL_HEIGHT, moveX, moveY, playerBox, time, normalX, normalY)) {
+        return false;
+    }
+
+    // Against the player where it is now; the other axis keeps the ball's own move
+    if (normalX != 0) {
+        gState.ballX = normalX > 0 ? player.x + PLAYER_WIDTH : player.x - BALL_WIDTH;
+        gState.ballVelX = std::copysign(gState.ballVelX * BOUNCE_FACTOR, (double)normalX);
+    } else {
+        gState.ballY = normalY > 0 ? player.y + PLAYER_HEIGHT : player.y - BALL_HEIGHT;
+        gState.ballVelY = std::copysign(gState.ballVelY * BOUNCE_FACTOR, (double)normalY);
+    }
+    return true;
+}
+
+/**
+ * @brief Bounces a ball off the player if the two overlap.
+ * @return true if the ball hit the player.
+ */
+bool bounce_off_player(const PlayerState& player, double& ballX, double& ballY, double& velX, double& velY) {
+    SDL_Rect playerBox = {(Sint16)player.x, (Sint16)player.y, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
+    SDL_Rect ballBox = {(Sint16)ballX, (Sint16)ballY, (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT}; 
+    
+    if (!check_collision(playerBox, ballBox)) {
+        return false;
+    }
+
+    // Simple bounce logic (simplified for AABB)
+    int playerCenterX = player.x + PLAYER_WIDTH / 2;
+    int playerCenterY = player.y + PLAYER_HEIGHT / 2;
+    int ballCenterX = (int)ballX + BALL_WIDTH / 2;
+    int ballCenterY = (int)ballY + BALL_HEIGHT / 2;
+
+    int dx = ballCenterX - playerCenterX;
+    int dy = ballCenterY - playerCenterY;
+    
+    if (std::abs(dx) > std::abs(dy)) {
+        velX = std::copysign(velX * -BOUNCE_FACTOR, (double)dx);
+        if (dx > 0) ballX = player.x + PLAYER_WIDTH;
+        else ballX = player.x - BALL_WIDTH;
+    } else {
+        velY = std::copysign(velY * -BOUNCE_FACTOR, (double)dy);
+        if (dy > 0) ballY = player.y + PLAYER_HEIGHT;
+        else ballY = player.y - BALL_HEIGHT;
+    }
+    return true;
+}
+
+/**
+ * @brief Allocates the stress-mode ball pool and scatters the balls over the upper
+ *        half of the screen with random sideways velocities.
+ */
+bool ball_pool_create(int count) {
+    ball_pool_destroy();
+    if (count <= 0) return true;
+
+    // One allocation, split into the four arrays
+    float* storage = new (std::nothrow) float[(size_t)count * 4];
+    if (storage == NULL) {
+        std::cerr << "ERROR: Could not allocate " << count << " pool balls!" << std::endl;
+        return false;
+    }
+    gBallPool.x = storage;
+    gBallPool.y = storage + count;
+    gBallPool.velX = storage + (size_t)count * 2;
+    gBallPool.velY = storage + (size_t)count * 3;
+    gBallPool.count = count;
+    gBallPool.grabbed = -1;
+
+    for (int i = 0; i < count; ++i) {
+        gBallPool.x[i] = (float)(game_random() % (gWorldWidth - BALL_WIDTH));
+        gBallPool.y[i] = (float)(game_random() % (gWorldHeight / 2));
+        gBallPool.velX[i] = (float)((int)(game_random() % 9) - 4);
+        gBallPool.velY[i] = 0.0f;
+    }
+    return true;
+}
+
+/**
+ * @brief Frees the stress-mode ball pool.
+ */
+void ball_pool_destroy() {
+    delete[] gBallPool.x;
+    gBallPool.x = gBallPool.y = gBallPool.velX = gBallPool.velY = NULL;
+    gBallPool.count = 0;
+    gBallPool.grabbed = -1;
+}
+
+/**
+ * @brief Runs a player's bounce for one pool ball (in double precision, like the main ball).
+ */
+bool bounce_pool_ball_off_player(int player, int i) {
+    double x = gBallPool.x[i];
+    double y = gBallPool.y[i];
+    double velX = gBallPool.velX[i];
+    double velY = gBallPool.velY[i];
+    if (!bounce_off_player(gState.players[player], x, y, velX, velY)) {
+        return false;
+    }
+    gBallPool.x[i] = (float)x;
+    gBallPool.y[i] = (float)y;
+    gBallPool.velX[i] = (float)velX;
+    gBallPool.velY[i] = (float)velY;
+    return true;
+}
+
+#if defined(USE_SSE2)
+/**
+ * @brief Per-lane select: mask ? a : b.
+ */
+inline __m128 select_ps(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+/**
+ * @brief Integrates pool balls [begin, end): gravity, movement, wall bounce with
+ *        BOUNCE_FACTOR and floor rest. Same rules as update_ball_physics(), done
+ *        several balls at a time. Collisions are handled afterwards through the grid.
+ */
+void integrate_balls(int begin, int end) {
+    const float step = (float)gTickScale;
+    const float gravity = (float)(FREE_ROAM_GRAVITY * gTickScale);
+    const float bounce = (float)-BOUNCE_FACTOR;
+    const float maxX = (float)(gWorldWidth - BALL_WIDTH);
+    const float maxY = (float)(gWorldHeight - BALL_HEIGHT);
+
+    float* px = gBallPool.x;
+    float* py = gBallPool.y;
+    float* pvx = gBallPool.velX;
+    float* pvy = gBallPool.velY;
+    int i = begin;
+
+#if defined(USE_AVX2)
+    {
+        const __m256 vStep = _mm256_set1_ps(step);
+        const __m256 vGravity = _mm256_set1_ps(gravity);
+        const __m256 vBounce = _mm256_set1_ps(bounce);
+        const __m256 vZero = _mm256_setzero_ps();
+        const __m256 vMaxX = _mm256_set1_ps(maxX);
+        const __m256 vMaxY = _mm256_set1_ps(maxY);
+        const __m256 vSign = _mm256_set1_ps(-0.0f);
+
+        for (; i + 8 <= end; i += 8) {
+            __m256 x = _mm256_loadu_ps(px + i);
+            __m256 y = _mm256_loadu_ps(py + i);
+            __m256 vx = _mm256_loadu_ps(pvx + i);
+            __m256 vy = _mm256_loadu_ps(pvy + i);
+
+            // 1-2. Gravity and movement
+            vy = _mm256_add_ps(vy, vGravity);
+            x = _mm256_add_ps(x, _mm256_mul_ps(vx, vStep));
+            y = _mm256_add_ps(y, _mm256_mul_ps(vy, vStep));
+
+            // 3. Walls: clamp and reflect
+            __m256 hitX = _mm256_or_ps(_mm256_cmp_ps(x, vZero, _CMP_LT_OQ), _mm256_cmp_ps(x, vMaxX, _CMP_GT_OQ));
+            __m256 hitFloor = _mm256_cmp_ps(y, vMaxY, _CMP_GT_OQ);
+            __m256 hitY = _mm256_or_ps(_mm256_cmp_ps(y, vZero, _CMP_LT_OQ), hitFloor);
+            x = _mm256_min_ps(_mm256_max_ps(x, vZero), vMaxX);
+            y = _mm256_min_ps(_mm256_max_ps(y, vZero), vMaxY);
+            vx = _mm256_blendv_ps(vx, _mm256_mul_ps(vx, vBounce), hitX);
+            vy = _mm256_blendv_ps(vy, _mm256_mul_ps(vy, vBounce), hitY);
+
+            // Floor rest: kill tiny bounces
+            __m256 rest = _mm256_and_ps(hitFloor, _mm256_cmp_ps(_mm256_andnot_ps(vSign, vy), vGravity, _CMP_LT_OQ));
+            vy = _mm256_andnot_ps(rest, vy);
+
+            _mm256_storeu_ps(px + i, x);
+            _mm256_storeu_ps(py + i, y);
+            _mm256_storeu_ps(pvx + i, vx);
+            _mm256_storeu_ps(pvy + i, vy);
+        }
+    }
+#endif
+
+#if defined(USE_SSE2)
+    {
+        const __m128 vStep = _mm_set1_ps(step);
+        const __m128 vGravity = _mm_set1_ps(gravity);
+        const __m128 vBounce = _mm_set1_ps(bounce);
+        const __m128 vZero = _mm_setzero_ps();
+        const __m128 vMaxX = _mm_set1_ps(maxX);
+        const __m128 vMaxY = _mm_set1_ps(maxY);
+        const __m128 vSign = _mm_set1_ps(-0.0f);
+
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(px + i);
+            __m128 y = _mm_loadu_ps(py + i);
+            __m128 vx = _mm_loadu_ps(pvx + i);
+            __m128 vy = _mm_loadu_ps(pvy + i);
+
+            // 1-2. Gravity and movement
+            vy = _mm_add_ps(vy, vGravity);
+            x = _mm_add_ps(x, _mm_mul_ps(vx, vStep));
+            y = _mm_add_ps(y, _mm_mul_ps(vy, vStep));
+
+            // 3. Walls: clamp and reflect
+            __m128 hitX = _mm_or_ps(_mm_cmplt_ps(x, vZero), _mm_cmpgt_ps(x, vMaxX));
+            __m128 hitFloor = _mm_cmpgt_ps(y, vMaxY);
+            __m128 hitY = _mm_or_ps(_mm_cmplt_ps(y, vZero), hitFloor);
+            x = _mm_min_ps(_mm_max_ps(x, vZero), vMaxX);
+            y = _mm_min_ps(_mm_max_ps(y, vZero), vMaxY);
+            vx = select_ps(hitX, _mm_mul_ps(vx, vBounce), vx);
+            vy = select_ps(hitY, _mm_mul_ps(vy, vBounce), vy);
+
+            // Floor rest: kill tiny bounces
+            __m128 rest = _mm_and_ps(hitFloor, _mm_cmplt_ps(_mm_andnot_ps(vSign, vy), vGravity));
+            vy = _mm_andnot_ps(rest, vy);
+
+            _mm_storeu_ps(px + i, x);
+            _mm_storeu_ps(py + i, y);
+            _mm_storeu_ps(pvx + i, vx);
+            _mm_storeu_ps(pvy + i, vy);
+        }
+    }
+#endif
+
+    // Scalar path for the remainder (or everything, without SIMD)
+    for (; i < end; ++i) {
+        float vy = pvy[i] + gravity;
+        float x = px[i] + pvx[i] * step;
+        float y = py[i] + vy * step;
+        float vx = pvx[i];
+
+        if (x < 0.0f || x > maxX) vx *= bounce;
+        bool hitFloor = y > maxY;
+        if (y < 0.0f || hitFloor) vy *= bounce;
+        if (hitFloor && std::abs(vy) < gravity) vy = 0.0f;
+        x = std::min(std::max(x, 0.0f), maxX);
+        y = std::min(std::max(y, 0.0f), maxY);
+
+        px[i] = x;
+        py[i] = y;
+        pvx[i] = vx;
+        pvy[i] = vy;
+    }
+}
+
+/**
+ * @brief Job wrappers for the parallel physics step.
+ */
+void integrate_balls_job(void*, int begin, int end) {
+    integrate_balls(begin, end);
+}
+
+void find_ball_pairs_job(void*, int begin, int end) {
+    int chunk = begin / gGrid.columns;
+    CollisionStats zero = {0, 0, 0};
+    gChunkStats[chunk] = zero;
+    gGrid.chunkPairs[chunk].clear();
+    grid_find_ball_pairs(begin, end, gGrid.chunkPairs[chunk], gChunkStats[chunk]);
+}
+
+/**
+ * @brief Advances every ball in the stress pool by one tick and resolves their
+ *        collisions. Also rebuilds the spatial grid, which the target check uses
+ *        too, so this runs every tick even without a pool.
+ */
+void update_ball_pool() {
+    int n = gBallPool.count;
+    parallel_for(integrate_balls_job, NULL, n, BALLS_PER_JOB);
+
+    grid_build();
+    gCollisionStats.bruteForcePairs += (gBallCollisions ? (long long)n * (n - 1) / 2 : 0) + (gState.platformLoss ? 0 : (long long)n * gState.playerCount) + 1;
+    if (n > 0) {
+        collide_ball_pool();
+    }
+
+    // The grabbed ball follows the cursor, like the main ball does
+    int held = gBallPool.grabbed;
+    if (held >= 0) {
+        float x = (float)(gState.mouseX + gState.cameraX - (BALL_WIDTH / 2));
+        float y = (float)(gState.mouseY + gState.cameraY - (BALL_HEIGHT / 2));
+        gBallPool.x[held] = std::min(std::max(x, 0.0f), (float)(gWorldWidth - BALL_WIDTH));
+        gBallPool.y[held] = std::min(std::max(y, 0.0f), (float)(gWorldHeight - BALL_HEIGHT));
+        gBallPool.velX[held] = 0.0f;
+        gBallPool.velY[held] = 0.0f;
+    }
+}
+
+/**
+ * @brief Allocates the particle pool: capacity particles, in one block split into
+ *        the arrays. Nothing is allocated per particle after this.
+ */
+bool particle_pool_create(int capacity) {
+    particle_pool_destroy();
+    float* storage = new (std::nothrow) float[(size_t)capacity * 5];
+    Uint8* colors = new (std::nothrow) Uint8[capacity];
+    if (storage == NULL || colors == NULL) {
+        std::cerr << "ERROR: Could not allocate " << capacity << " particles!" << std::endl;
+        delete[] storage;
+        delete[] colors;
+        return false;
+    }
+    gParticles.x = storage;
+    gParticles.y = storage + capacity;
+    gParticles.velX = storage + (size_t)capacity * 2;
+    gParticles.velY = storage + (size_t)capacity * 3;
+    gParticles.life = storage + (size_t)capacity * 4;
+    gParticles.color = colors;
+    gParticles.capacity = capacity;
+    gParticles.count = 0;
+    return true;
+}
+
+/**
+ * @brief Frees the particle pool.
+ */
+void particle_pool_destroy() {
+    delete[] gParticles.x;
+    delete[] gParticles.color;
+    gParticles.x = gParticles.y = gParticles.velX = gParticles.velY = gParticles.life = NULL;
+    gParticles.color = NULL;
+    gParticles.capacity = 0;
+    gParticles.count = 0;
+}
+
+/**
+ * @brief Random number in [-1, 1) from the particles' own xorshift state.
+ */
+float particle_random() {
+    Uint32& state = gParticles.random;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (float)(state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+/**
+ * @brief Spawns count particles at (x, y) in the world, moving at (velX, velY)
+ *        plus up to spread in each direction. What doesn't fit in the pool is
+ *        dropped.
+ */
+void emit_particles(float x, float y, int count, float velX, float velY, float spread, int color) {
+    if (gParticles.capacity == 0) return; // No pool (headless and benchmark runs)
+    int room = gParticles.capacity - gParticles.count;
+    int emitted = std::min(count, room);
+    gParticleStats.spawned += emitted;
+    gParticleStats.dropped += count - emitted;
+
+    for (int k = 0; k < emitted; ++k) {
+        int i = gParticles.count++;
+        gParticles.x[i] = x;
+        gParticles.y[i] = y;
+        gParticles.velX[i] = velX + particle_random() * spread;
+        gParticles.velY[i] = velY + particle_random() * spread;
+        gParticles.life[i] = PARTICLE_LIFE_TICKS * (0.8f + 0.2f * particle_random());
+        gParticles.color[i] = (Uint8)color;
+    }
+    gParticleStats.peak = std::max(gParticleStats.peak, gParticles.count);
+}
+
+/**
+ * @brief Moves every particle one tick (gravity, movement, aging), several at a
+ *        time, then replaces each dead particle with the last live one.
+ */
+void update_particles() {
+    int n = gParticles.count;
+    if (n == 0) return;
+    auto start = std::chrono::steady_clock::now();
+
+    const float step = (float)gTickScale;
+    const float gravity = PARTICLE_GRAVITY * step;
+    float* px = gParticles.x;
+    float* py = gParticles.y;
+    float* pvx = gParticles.velX;
+    float* pvy = gParticles.velY;
+    float* plife = gParticles.life;
+    int i = 0;
+
+    // 1. Integrate
+#if defined(USE_AVX2)
+    {
+        const __m256 vStep = _mm256_set1_ps(step);
+        const __m256 vGravity = _mm256_set1_ps(gravity);
+        for (; i + 8 <= n; i += 8) {
+            __m256 vy = _mm256_add_ps(_mm256_loadu_ps(pvy + i), vGravity);
+            _mm256_storeu_ps(px + i, _mm256_add_ps(_mm256_loadu_ps(px + i), _mm256_mul_ps(_mm256_loadu_ps(pvx + i), vStep)));
+            _mm256_storeu_ps(py + i, _mm256_add_ps(_mm256_loadu_ps(py + i), _mm256_mul_ps(vy, vStep)));
+            _mm256_storeu_ps(pvy + i, vy);
+            _mm256_storeu_ps(plife + i, _mm256_sub_ps(_mm256_loadu_ps(plife + i), vStep));
+        }
+    }
+#endif
+
+#if defined(USE_SSE2)
+    {
+        const __m128 vStep = _mm_set1_ps(step);
+        const __m128 vGravity = _mm_set1_ps(gravity);
+        for (; i + 4 <= n; i += 4) {
+            __m128 vy = _mm_add_ps(_mm_loadu_ps(pvy + i), vGravity);
+            _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(_mm_loadu_ps(pvx + i), vStep)));
+            _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(vy, vStep)));
+            _mm_storeu_ps(pvy + i, vy);
+            _mm_storeu_ps(plife + i, _mm_sub_ps(_mm_loadu_ps(plife + i), vStep));
+        }
+    }
+#endif
+
+    // Scalar path for the remainder (or everything, without SIMD)
+    for (; i < n; ++i) {
+        pvy[i] += gravity;
+        px[i] += pvx[i] * step;
+        py[i] += pvy[i] * step;
+        plife[i] -= step;
+    }
+
+    // 2. Remove the dead, keeping the live ones packed at the front
+    for (i = 0; i < n;) {
+        if (plife[i] > 0.0f) {
+            i++;
+            continue;
+        }
+        n--;
+        px[i] = px[n];
+        py[i] = py[n];
+        pvx[i] = pvx[n];
+        pvy[i] = pvy[n];
+        plife[i] = plife[n];
+        gParticles.color[i] = gParticles.color[n];
+    }
+    gParticles.count = n;
+
+    gParticleStats.updates++;
+    gParticleStats.updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Draws particles as small squares (PARTICLE_SIZE, then a dimmer single
+ *        pixel late in life) straight into a 32bpp target, interpolated like the
+ *        sprites. Beyond budget particles, only an evenly spread subset is drawn,
+ *        so the cost per frame stays bounded however many are alive.
+ * @param[out] area Screen area covered (w = 0 if nothing was drawn).
+ * @return Particles drawn.
+ */
+int draw_particles(SDL_Surface* target, const ParticlePool& particles, double alpha, int viewX, int viewY, int budget, SDL_Rect& area) {
+    SDL_Rect empty = {0, 0, 0, 0};
+    area = empty;
+    int n = particles.count;
+    if (n == 0) return 0;
+
+    // 1. This frame's colors, young and old, in the target's format
+    Uint32 colors[PARTICLE_COLOR_COUNT][2];
+    for (int c = 0; c < PARTICLE_COLOR_COUNT; ++c) {
+        const Uint8* rgb = PARTICLE_RGB[c];
+        colors[c][0] = SDL_MapRGB(target->format, rgb[0], rgb[1], rgb[2]);
+        colors[c][1] = SDL_MapRGB(target->format, rgb[0] / 2, rgb[1] / 2, rgb[2] / 2);
+    }
+    bool direct = target->format->BytesPerPixel == 4 && !SDL_MUSTLOCK(target);
+    const SDL_Rect& clip = target->clip_rect;
+    int left = SCREEN_WIDTH, top = SCREEN_HEIGHT, right = 0, bottom = 0;
+
+    // 2. Every particle, or every stride-th one when over budget
+    int stride = (n + budget - 1) / budget;
+    float back = (float)((alpha - 1.0) * gTickScale); // Interpolate back toward the previous tick
+    float oldLife = PARTICLE_LIFE_TICKS / 3.0f;
+    int drawn = 0;
+    for (int i = 0; i < n; i += stride) {
+        int x = (int)(particles.x[i] + particles.velX[i] * back) - viewX;
+        int y = (int)(particles.y[i] + particles.velY[i] * back) - viewY;
+        bool old = particles.life[i] < oldLife;
+        int size = old ? 1 : PARTICLE_SIZE;
+        int x1 = std::max(x, (int)clip.x);
+        int y1 = std::max(y, (int)clip.y);
+        int x2 = std::min(x + size, clip.x + clip.w);
+        int y2 = std::min(y + size, clip.y + clip.h);
+        if (x2 <= x1 || y2 <= y1) continue;
+
+        Uint32 color = colors[particles.color[i]][old ? 1 : 0];
+        if (direct) {
+            for (int row = y1; row < y2; ++row) {
+                Uint32* d = (Uint32*)((Uint8*)target->pixels + row * target->pitch);
+                for (int col = x1; col < x2; ++col) d[col] = color;
+            }
+        } else {
+            SDL_Rect dot = {(Sint16)x1, (Sint16)y1, (Uint16)(x2 - x1), (Uint16)(y2 - y1)};
+            SDL_FillRect(target, &dot, color);
+        }
+        left = std::min(left, x1);
+        top = std::min(top, y1);
+        right = std::max(right, x2);
+        bottom = std::max(bottom, y2);
+        drawn++;
+    }
+
+    if (drawn > 0) {
+        SDL_Rect covered = {(Sint16)left, (Sint16)top, (Uint16)(right - left), (Uint16)(bottom - top)};
+        area = covered;
+    }
+    return drawn;
+}
+
+/**
+ * @brief Grid column / row of a world coordinate, clamped to the grid. Objects
+ *        partly outside the world land in the edge cells.
+ */
+inline int grid_column(int x) {
+    return std::min(std::max((x - gGrid.left) / GRID_CELL_SIZE, 0), gGrid.columns - 1);
+}
+
+inline int grid_row(int y) {
+    return std::min(std::max((y - gGrid.top) / GRID_CELL_SIZE, 0), gGrid.rows - 1);
+}
+
+/**
+ * @brief Rebuilds the spatial grid from the player, the target and the pool balls.
+ *
+ * The grid spans the world cells the objects are in (anything sticking out of
+ * the world lands in the edge cells), so a world of any size spreads them out
+ * while the empty rest of it costs nothing. Every object goes into each cell
+ * its box touches. The build is a counting sort (count per cell, prefix sum,
+ * scatter), so entries end up grouped by cell and, within a cell, in the order
+ * player, target, then balls by index. The arrays only grow, so once the
+ * objects have spread out nothing is allocated.
+ */
+void grid_build() {
+    SpatialGrid& grid = gGrid;
+    int objectCount = 2 + gBallPool.count;
+
+    // 1. Stage every object's box
+    grid.objX.resize(objectCount);
+    grid.objY.resize(objectCount);
+    grid.objW.resize(objectCount);
+    grid.objH.resize(objectCount);
+    grid.objId.resize(objectCount);
+
+    grid.objX[0] = gState.players[0].x; grid.objY[0] = gState.players[0].y;
+    grid.objW[0] = PLAYER_WIDTH; grid.objH[0] = PLAYER_HEIGHT;
+    grid.objId[0] = GRID_ID_PLAYER;
+    grid.objX[1] = gState.targetX; grid.objY[1] = gState.targetY;
+    grid.objW[1] = TARGET_WIDTH; grid.objH[1] = TARGET_HEIGHT;
+    grid.objId[1] = GRID_ID_TARGET;
+    for (int i = 0; i < gBallPool.count; ++i) {
+        grid.objX[2 + i] = (int)gBallPool.x[i];
+        grid.objY[2 + i] = (int)gBallPool.y[i];
+        grid.objW[2 + i] = BALL_WIDTH;
+        grid.objH[2 + i] = BALL_HEIGHT;
+        grid.objId[2 + i] = i;
+    }
+
+    // 2. Size the grid to the cells they touch, clipped to the world
+    int minX = gWorldWidth - 1, minY = gWorldHeight - 1, maxX = 0, maxY = 0;
+    for (int o = 0; o < objectCount; ++o) {
+        minX = std::min(minX, std::max(grid.objX[o], 0));
+        minY = std::min(minY, std::max(grid.objY[o], 0));
+        maxX = std::max(maxX, std::min(grid.objX[o] + grid.objW[o] - 1, gWorldWidth - 1));
+        maxY = std::max(maxY, std::min(grid.objY[o] + grid.objH[o] - 1, gWorldHeight - 1));
+    }
+    maxX = std::max(maxX, minX);
+    maxY = std::max(maxY, minY);
+    grid.left = minX / GRID_CELL_SIZE * GRID_CELL_SIZE;
+    grid.top = minY / GRID_CELL_SIZE * GRID_CELL_SIZE;
+    grid.columns = (maxX - grid.left) / GRID_CELL_SIZE + 1;
+    grid.rows = (maxY - grid.top) / GRID_CELL_SIZE + 1;
+    int cells = grid.columns * grid.rows;
+    grid.chunkPairs.resize(grid.rows);
+    gChunkStats.resize(grid.rows);
+
+    // 3. Count entries per cell
+    grid.cellStart.assign(cells + 1, 0);
+    for (int o = 0; o < objectCount; ++o) {
+        int c0 = grid_column(grid.objX[o]), c1 = grid_column(grid.objX[o] + grid.objW[o] - 1);
+        int r0 = grid_row(grid.objY[o]), r1 = grid_row(grid.objY[o] + grid.objH[o] - 1);
+        for (int r = r0; r <= r1; ++r) {
+            for (int c = c0; c <= c1; ++c) {
+                grid.cellStart[r * grid.columns + c + 1]++;
+            }
+        }
+    }
+
+    // 4. Prefix sum into start offsets
+    for (int cell = 0; cell < cells; ++cell) {
+        grid.cellStart[cell + 1] += grid.cellStart[cell];
+    }
+    int entryCount = grid.cellStart[cells];
+    grid.x.resize(entryCount);
+    grid.y.resize(entryCount);
+    grid.w.resize(entryCount);
+    grid.h.resize(entryCount);
+    grid.id.resize(entryCount);
+    grid.first.resize(entryCount);
+
+    // 5. Scatter the objects into their cells
+    grid.cellFill.assign(grid.cellStart.begin(), grid.cellStart.end() - 1);
+    for (int o = 0; o < objectCount; ++o) {
+        int c0 = grid_column(grid.objX[o]), c1 = grid_column(grid.objX[o] + grid.objW[o] - 1);
+        int r0 = grid_row(grid.objY[o]), r1 = grid_row(grid.objY[o] + grid.objH[o] - 1);
+        for (int r = r0; r <= r1; ++r) {
+            for (int c = c0; c <= c1; ++c) {
+                int e = grid.cellFill[r * grid.columns + c]++;
+                grid.x[e] = grid.objX[o];
+                grid.y[e] = grid.objY[o];
+                grid.w[e] = grid.objW[o];
+                grid.h[e] = grid.objH[o];
+                grid.id[e] = grid.objId[o];
+                grid.first[e] = (Uint8)((c == c0 ? GRID_FIRST_COLUMN : 0) | (r == r0 ? GRID_FIRST_ROW : 0));
+            }
+        }
+    }
+}
+
+/**
+ * @brief Whether a grid entry id is what query looks for.
+ */
+inline bool grid_query_wants(GridQuery query, int id) {
+    return query == GRID_QUERY_BALLS ? id >= 0 : id == GRID_ID_TARGET;
+}
+
+/**
+ * @brief Calls visit(entry) once for every grid entry of the kind query looks for
+ *        whose box overlaps the given box. The cell contents go through
+ *        collide_box_batch() as the narrow phase. An object spanning several
+ *        cells is reported only in the cell that holds the top-left corner of its
+ *        overlap with the box, so the visitor never sees the same object twice.
+ *
+ * The statistics count each wanted object once per query (in the first of the
+ * query's cells it is in), like the brute-force figure counts each pair once.
+ */
+template <typename Visitor>
+void grid_query_overlaps(int bx, int by, int bw, int bh, GridQuery query, Visitor visit) {
+    const SpatialGrid& grid = gGrid;
+    int c0 = grid_column(bx), c1 = grid_column(bx + bw - 1);
+    int r0 = grid_row(by), r1 = grid_row(by + bh - 1);
+
+    for (int r = r0; r <= r1; ++r) {
+        for (int c = c0; c <= c1; ++c) {
+            int cell = r * grid.columns + c;
+            int end = grid.cellStart[cell + 1];
+            for (int first = grid.cellStart[cell]; first < end; first += 32) {
+                int count = std::min(32, end - first);
+                Uint32 hits = collide_box_batch(bx, by, bw, bh, &grid.x[first], &grid.y[first],
+                                                &grid.w[first], &grid.h[first], count);
+                int queryFirst = (c == c0 ? GRID_FIRST_COLUMN : 0) | (r == r0 ? GRID_FIRST_ROW : 0);
+                for (int e = first; e < first + count; ++e) {
+                    gCollisionStats.pairsTested += grid_query_wants(query, grid.id[e]) && (queryFirst | grid.first[e]) == GRID_FIRST_CELL;
+                }
+                while (hits != 0) {
+                    int e = first + lowest_bit_index(hits);
+                    hits &= hits - 1;
+                    if (!grid_query_wants(query, grid.id[e])) continue;
+                    if (grid_column(std::max(bx, grid.x[e])) != c || grid_row(std::max(by, grid.y[e])) != r) continue;
+                    visit(e);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Finds all overlapping ball-ball pairs in cells [cellBegin, cellEnd) and
+ *        appends them (lower index first) to pairs. Each ball is tested against
+ *        the rest of its cell 32 entries at a time with collide_box_batch(). A
+ *        pair of balls sharing several cells counts as tested in the first only.
+ */
+void grid_find_ball_pairs(int cellBegin, int cellEnd, std::vector<BallPair>& pairs, CollisionStats& stats) {
+    const SpatialGrid& grid = gGrid;
+
+    for (int cell = cellBegin; cell < cellEnd; ++cell) {
+        int c = cell % grid.columns;
+        int r = cell / grid.columns;
+        int end = grid.cellStart[cell + 1];
+
+        for (int a = grid.cellStart[cell]; a < end; ++a) {
+            if (grid.id[a] < 0) continue; // Player / target
+            int need = GRID_FIRST_CELL & ~grid.first[a]; // Flags b must bring for the pair to count here
+            for (int first = a + 1; first < end; first += 32) {
+                int count = std::min(32, end - first);
+                Uint32 hits = collide_box_batch(grid.x[a], grid.y[a], grid.w[a], grid.h[a], &grid.x[first],
+                                                &grid.y[first], &grid.w[first], &grid.h[first], count);
+                if (need == 0) {
+                    stats.pairsTested += count; // Entries after a ball in its cell are all balls
+                } else {
+                    for (int b = first; b < first + count; ++b) stats.pairsTested += (grid.first[b] & need) == need;
+                }
+                while (hits != 0) {
+                    int b = first + lowest_bit_index(hits);
+                    hits &= hits - 1;
+                    if (grid.id[b] < 0) continue;
+                    // Only the cell holding the overlap's top-left corner reports the pair
+                    if (grid_column(std::max(grid.x[a], grid.x[b])) != c || grid_row(std::max(grid.y[a], grid.y[b])) != r) continue;
+
+                    BallPair pair = {grid.id[a], grid.id[b]};
+                    pairs.push_back(pair);
+                    stats.pairsHit++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Pushes two overlapping pool balls apart along the axis of least overlap
+ *        and exchanges their velocities on that axis (equal masses), losing
+ *        energy by BOUNCE_FACTOR like a wall bounce.
+ */
+void resolve_ball_pair(int a, int b) {
+    float* px = gBallPool.x;
+    float* py = gBallPool.y;
+    float* pvx = gBallPool.velX;
+    float* pvy = gBallPool.velY;
+    const float bounce = (float)BOUNCE_FACTOR;
+
+    // An earlier pair may already have pushed these two apart
+    float overlapX = BALL_WIDTH - std::abs(px[b] - px[a]);
+    float overlapY = BALL_HEIGHT - std::abs(py[b] - py[a]);
+    if (overlapX <= 0.0f || overlapY <= 0.0f) return;
+
+    if (overlapX < overlapY) {
+        float push = (px[a] < px[b]) ? overlapX / 2 : -overlapX / 2;
+        px[a] -= push;
+        px[b] += push;
+        if ((pvx[b] - pvx[a]) * push < 0.0f) { // Only if they're moving towards each other
+            float velA = pvx[a];
+            pvx[a] = pvx[b] * bounce;
+            pvx[b] = velA * bounce;
+        }
+    } else {
+        float push = (py[a] < py[b]) ? overlapY / 2 : -overlapY / 2;
+        py[a] -= push;
+        py[b] += push;
+        if ((pvy[b] - pvy[a]) * push < 0.0f) {
+            float velA = pvy[a];
+            pvy[a] = pvy[b] * bounce;
+            pvy[b] = velA * bounce;
+        }
+    }
+
+    // Keep both in the world
+    const float maxX = (float)(gWorldWidth - BALL_WIDTH);
+    const float maxY = (float)(gWorldHeight - BALL_HEIGHT);
+    px[a] = std::min(std::max(px[a], 0.0f), maxX);
+    px[b] = std::min(std::max(px[b], 0.0f), maxX);
+    py[a] = std::min(std::max(py[a], 0.0f), maxY);
+    py[b] = std::min(std::max(py[b], 0.0f), maxY);
+}
+
+/**
+ * @brief Returns true if the player overlaps the target, found through the grid.
+ */
+bool grid_player_hits_target() {
+    bool hit = false;
+    grid_query_overlaps(gState.players[0].x, gState.players[0].y, PLAYER_WIDTH, PLAYER_HEIGHT, GRID_QUERY_TARGET, [&hit](int) {
+        gCollisionStats.pairsHit++;
+        hit = true;
+    });
+    return hit;
+}
+
+/**
+ * @brief Collision pass for the pool after integration: player bounces first
+ *        (player by player, in ball order), then the ball-ball pairs in the order
+ *        the grid found them.
+ */
+void collide_ball_pool() {
+    // 1. Ball vs. players (the partner too, like the main ball)
+    for (int p = 0; p < gState.playerCount && !gState.platformLoss; ++p) {
+        const PlayerState& player = gState.players[p];
+        gGrid.playerHits.clear();
+        grid_query_overlaps(player.x, player.y, PLAYER_WIDTH, PLAYER_HEIGHT, GRID_QUERY_BALLS, [](int e) {
+            gGrid.playerHits.push_back(gGrid.id[e]);
+        });
+        // Cells are visited row by row; sort so balls bounce in index order
+        std::sort(gGrid.playerHits.begin(), gGrid.playerHits.end());
+        for (size_t i = 0; i < gGrid.playerHits.size(); ++i) {
+            if (bounce_pool_ball_off_player(p, gGrid.playerHits[i])) gCollisionStats.pairsHit++;
+        }
+    }
+
+    // 2. Ball vs. ball: find pairs in parallel (one grid row per job), then resolve
+    //    them on this thread in row order, so any thread count gives the same result
+    if (!gBallCollisions) return;
+    parallel_for(find_ball_pairs_job, NULL, gGrid.columns * gGrid.rows, gGrid.columns);
+    for (int chunk = 0; chunk < gGrid.rows; ++chunk) {
+        gCollisionStats.pairsTested += gChunkStats[chunk].pairsTested;
+        gCollisionStats.pairsHit += gChunkStats[chunk].pairsHit;
+        const std::vector<BallPair>& pairs = gGrid.chunkPairs[chunk];
+        for (size_t i = 0; i < pairs.size(); ++i) {
+            resolve_ball_pair(pairs[i].a, pairs[i].b);
+        }
+    }
+}
+
+/**
+ * @brief Prints how well the broad phase pruned the collision pairs.
+ */
+void print_collision_stats() {
+    if (gCollisionStats.bruteForcePairs == 0) return;
+
+    std::cout << "Collision stats: " << gCollisionStats.pairsTested << " pairs tested, "
+              << gCollisionStats.pairsHit << " hit, "
+              << gCollisionStats.bruteForcePairs << " for brute force ("
+              << 100.0 * (1.0 - (double)gCollisionStats.pairsTested / gCollisionStats.bruteForcePairs)
+              << "% pruned)" << std::endl;
+}
+
+/**
+ * @brief FNV-1a hash over the pool's raw float bits; equal runs give equal hashes.
+ */
+Uint32 fnv1a(Uint32 hash, const void* data, size_t size) {
+    const Uint8* bytes = (const Uint8*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+Uint32 ball_pool_checksum() {
+    size_t size = (size_t)gBallPool.count * 4 * sizeof(float); // x, y, velX, velY are contiguous
+    return fnv1a(2166136261u, gBallPool.x, size);
+}
+
+/**
+ * @brief FNV-1a hash of the whole simulation state (pool included). Two runs with
+ *        the same hash ended in the same state.
+ */
+Uint32 game_state_checksum() {
+    Uint8 packed[GAME_STATE_PACK_MAX];
+    int size = pack_game_state(packed);
+    return fnv1a(ball_pool_checksum(), packed, size);
+}
+
+/**
+ * @brief Lays out the checksummed part of the game state as bytes (native byte
+ *        order): the first player and the world, then the partner, if any, then
+ *        any players' sub-pixel remainders, so single-player checksums are
+ *        unchanged.
+ * @param out At least GAME_STATE_PACK_MAX bytes.
+ * @return Bytes written.
+ */
+int pack_game_state(Uint8* out) {
+    const PlayerState& player = gState.players[0];
+    const int ints[] = {gState.score, player.x, player.y, player.direction, gState.targetX, gState.targetY,
+                        player.targetColliding, gState.gravityOn, gState.platformLoss, player.onGround, gState.ballGrabbed};
+    const double doubles[] = {gState.ballX, gState.ballY, gState.ballVelX, gState.ballVelY, player.velY};
+    int size = 0;
+    memcpy(out + size, ints, sizeof(ints));
+    size += sizeof(ints);
+    memcpy(out + size, doubles, sizeof(doubles));
+    size += sizeof(doubles);
+
+    for (int i = 1; i < gState.playerCount; ++i) {
+        const PlayerState& partner = gState.players[i];
+        const int partnerInts[] = {partner.x, partner.y, partner.direction, partner.targetColliding, partner.onGround};
+        memcpy(out + size, partnerInts, sizeof(partnerInts));
+        size += sizeof(partnerInts);
+        memcpy(out + size, &partner.velY, sizeof(partner.velY));
+        size += sizeof(partner.velY);
+    }
+
+    // Sub-pixel remainders, only where there are any (rates that don't divide 60
+    // evenly), so checksums at the other rates are unchanged
+    for (int i = 0; i < gState.playerCount; ++i) {
+        const PlayerState& player = gState.players[i];
+        if (player.subX == 0.0 && player.subY == 0.0) continue;
+        const double subs[] = {player.subX, player.subY};
+        memcpy(out + size, &i, sizeof(i));
+        size += sizeof(i);
+        memcpy(out + size, subs, sizeof(subs));
+        size += sizeof(subs);
+    }
+    return size;
+}
+
+/**
+ * @brief Returns the index of the topmost pool ball under (x, y), or -1.
+ */
+int find_pool_ball_at(int x, int y) {
+    SDL_Rect clickArea = {(Sint16)x, (Sint16)y, 1, 1};
+    // Later balls are drawn on top, so search from the back
+    for (int i = gBallPool.count - 1; i >= 0; --i) {
+        SDL_Rect ballBox = {(Sint16)gBallPool.x[i], (Sint16)gBallPool.y[i], (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT};
+        if (check_collision(ballBox, clickArea)) return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Takes a job for worker self: the newest job from its own queue, or else
+ *        the oldest job from another worker's queue (a steal).
+ */
+bool take_job(int self, Job& job) {
+    WorkerQueue& own = *gJobs.queues[self];
+    SDL_LockMutex(own.lock);
+    if (!own.jobs.empty()) {
+        job = own.jobs.back();
+        own.jobs.pop_back();
+        SDL_UnlockMutex(own.lock);
+        return true;
+    }
+    SDL_UnlockMutex(own.lock);
+
+    for (int k = 1; k < gJobs.threadCount; ++k) {
+        WorkerQueue& victim = *gJobs.queues[(self + k) % gJobs.threadCount];
+        SDL_LockMutex(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            SDL_UnlockMutex(victim.lock);
+            gJobs.steals++;
+            return true;
+        }
+        SDL_UnlockMutex(victim.lock);
+    }
+    return false;
+}
+
+/**
+ * @brief Runs jobs until none are left anywhere. Whoever finishes the last job of
+ *        a batch signals batchDone.
+ */
+void run_available_jobs(int self) {
+    Job job;
+    while (take_job(self, job)) {
+        job.fn(job.context, job.begin, job.end);
+        if (--gJobs.pending == 0) {
+            SDL_SemPost(gJobs.batchDone);
+        }
+    }
+}
+
+/**
+ * @brief Worker thread body: sleep until jobs are posted, then help drain them.
+ */
+int job_worker_main(void* data) {
+    int self = (int)(size_t)data;
+    while (true) {
+        SDL_SemWait(gJobs.wake);
+        if (gJobs.quit) break;
+        run_available_jobs(self);
+    }
+    return 0;
+}
+
+/**
+ * @brief Starts the job system with threadCount threads in total; the calling
+ *        (main) thread counts as worker 0. With one thread nothing is started and
+ *        parallel_for() simply runs the chunks in order.
+ */
+bool job_system_start(int threadCount) {
+    job_system_stop();
+
+    gJobs.threadCount = threadCount;
+    gJobs.quit = false;
+    gJobs.pending = 0;
+    gJobs.steals = 0;
+    if (threadCount <= 1) return true;
+
+    gJobs.wake = SDL_CreateSemaphore(0);
+    gJobs.batchDone = SDL_CreateSemaphore(0);
+    for (int i = 0; i < threadCount; ++i) {
+        WorkerQueue* queue = new WorkerQueue;
+        queue->lock = SDL_CreateMutex();
+        gJobs.queues.push_back(queue);
+    }
+    for (int i = 1; i < threadCount; ++i) {
+        SDL_Thread* thread = SDL_CreateThread(job_worker_main, (void*)(size_t)i);
+        if (thread == NULL) {
+            std::cerr << "ERROR: Could not start worker thread! SDL Error: " << SDL_GetError() << std::endl;
+            job_system_stop();
+            return false;
+        }
+        gJobs.threads.push_back(thread);
+    }
+    return true;
+}
+
+/**
+ * @brief Stops and joins the worker threads.
+ */
+void job_system_stop() {
+    gJobs.quit = true;
+    for (size_t i = 0; i < gJobs.threads.size(); ++i) {
+        SDL_SemPost(gJobs.wake);
+    }
+    for (size_t i = 0; i < gJobs.threads.size(); ++i) {
+        SDL_WaitThread(gJobs.threads[i], NULL);
+    }
+    gJobs.threads.clear();
+
+    for (size_t i = 0; i < gJobs.queues.size(); ++i) {
+        SDL_DestroyMutex(gJobs.queues[i]->lock);
+        delete gJobs.queues[i];
+    }
+    gJobs.queues.clear();
+
+    if (gJobs.wake != NULL) SDL_DestroySemaphore(gJobs.wake);
+    if (gJobs.batchDone != NULL) SDL_DestroySemaphore(gJobs.batchDone);
+    gJobs.wake = NULL;
+    gJobs.batchDone = NULL;
+    gJobs.threadCount = 1;
+}
+
+/**
+ * @brief Runs fn(context, begin, end) over [0, count) in chunks of chunkSize and
+ *        returns when all chunks are done. Chunks are dealt round-robin to the
+ *        worker queues; idle workers steal. Callers that need a deterministic
+ *        result write per-chunk output (chunk = begin / chunkSize) and merge it
+ *        in chunk order afterwards.
+ */
+void parallel_for(JobFunction fn, void* context, int count, int chunkSize) {
+    int chunks = (count + chunkSize - 1) / chunkSize;
+    if (gJobs.threadCount <= 1 || chunks <= 1) {
+        for (int begin = 0; begin < count; begin += chunkSize) {
+            fn(context, begin, std::min(begin + chunkSize, count));
+        }
+        return;
+    }
+
+    gJobs.pending = chunks;
+    for (int c = 0; c < chunks; ++c) {
+        Job job = {fn, context, c * chunkSize, std::min((c + 1) * chunkSize, count)};
+        WorkerQueue& queue = *gJobs.queues[c % gJobs.threadCount];
+        SDL_LockMutex(queue.lock);
+        queue.jobs.push_back(job);
+        SDL_UnlockMutex(queue.lock);
+    }
+    int wakeCount = std::min(gJobs.threadCount - 1, chunks - 1);
+    for (int i = 0; i < wakeCount; ++i) {
+        SDL_SemPost(gJobs.wake);
+    }
+
+    run_available_jobs(0);
+    SDL_SemWait(gJobs.batchDone);
+}
+
+/**
+ * @brief Puts every piece of simulation state back to how the game starts.
+ *        Used by the benchmarks so each run starts from the same place.
+ */
+void reset_game_state() {
+    gState.score = 0;
+    gState.followerX = SCREEN_WIDTH / 2;
+    gState.followerY = SCREEN_HEIGHT / 2;
+    gState.mouseDown = false;
+    gState.mouseX = SCREEN_WIDTH / 2;
+    gState.mouseY = SCREEN_HEIGHT / 2;
+    place_players(PLAYER_START_X, PLAYER_START_Y);
+    for (int i = 0; i < MAX_PLAYERS; ++i) {
+        gState.players[i].targetColliding = false;
+        gState.players[i].direction = PLAYER_FACING_RIGHT;
+    }
+    gState.targetX = SCREEN_WIDTH - 150;
+    gState.targetY = SCREEN_HEIGHT - 150;
+    gState.ballX = 300.0;
+    gState.ballY = 50.0;
+    gState.ballVelX = 3.0;
+    gState.ballVelY = 0.0;
+    gState.gravityOn = false;
+    gState.platformLoss = false;
+    gState.ballGrabbed = false;
+    update_camera();
+    save_previous_state();
+}
+
+/**
+ * @brief Remembers the current positions as the start point for render interpolation.
+ *        Called at the beginning of every simulation tick.
+ */
+void save_previous_state() {
+    for (int i = 0; i < MAX_PLAYERS; ++i) {
+        gPrevPlayerX[i] = gState.players[i].x;
+        gPrevPlayerY[i] = gState.players[i].y;
+    }
+    gPrevBallX = gState.ballX;
+    gPrevBallY = gState.ballY;
+    gPrevCameraX = gState.cameraX;
+    gPrevCameraY = gState.cameraY;
+}
+
+/**
+ * @brief Saves the state at the start of this tick in the rewind ring, over the
+ *        oldest one once the ring is full. One copy of a small struct per tick.
+ */
+void rewind_save() {
+    if (gRewind.capacity == 0) return;
+    if (++gRewind.newest >= gRewind.capacity) gRewind.newest = 0;
+    gRewind.states[gRewind.newest] = gState;
+    if (gRewind.count < gRewind.capacity) gRewind.count++;
+}
+
+/**
+ * @brief Goes back to the start of the latest saved tick and forgets it. The
+ *        cursor and the mouse button stay as the player has them now.
+ * @return false once there is nothing left to rewind.
+ */
+bool rewind_step() {
+    if (gRewind.count == 0) return false;
+    GameState live = gState;
+    gState = gRewind.states[gRewind.newest];
+    if (--gRewind.newest < 0) gRewind.newest = gRewind.capacity - 1;
+    gRewind.count--;
+    gRewind.rewound++;
+
+    gState.mouseX = live.mouseX;
+    gState.mouseY = live.mouseY;
+    gState.followerX = live.followerX;
+    gState.followerY = live.followerY;
+    gState.mouseDown = live.mouseDown;
+    if (!gState.mouseDown) gState.ballGrabbed = false; // Held back then, let go since
+    return true;
+}
+
+/**
+ * @brief Sets the simulation tick rate. Movement is scaled by the tick length, and
+ *        collisions are swept, so fewer, longer ticks don't let anything tunnel.
+ */
+void set_sim_rate(int hz) {
+    gSimHz = hz;
+    gTickMs = 1000.0 / hz;
+    gTickScale = (double)SIM_TICKS_PER_SECOND / hz;
+    gRewind.capacity = REWIND_SECONDS * hz;
+    gRewind.count = 0; // Saved ticks of another length can't be replayed backwards
+}
+
+/**
+ * @brief Sets the world size in pixels: at least the screen, at most MAX_WORLD_SIZE.
+ */
+void set_world_size(int width, int height) {
+    gWorldWidth = std::min(std::max(width, SCREEN_WIDTH), MAX_WORLD_SIZE);
+    gWorldHeight = std::min(std::max(height, SCREEN_HEIGHT), MAX_WORLD_SIZE);
+    update_camera();
+}
+
+/**
+ * @brief Centers the camera on the player, without showing anything outside the world.
+ */
+void update_camera() {
+    gState.cameraX = std::min(std::max(gState.players[0].x + PLAYER_WIDTH / 2 - SCREEN_WIDTH / 2, 0), gWorldWidth - SCREEN_WIDTH);
+    gState.cameraY = std::min(std::max(gState.players[0].y + PLAYER_HEIGHT / 2 - SCREEN_HEIGHT / 2, 0), gWorldHeight - SCREEN_HEIGHT);
+}
+
+/**
+ * @brief Linear interpolation between a and b (t in [0, 1]).
+ */
+double lerp(double a, double b, double t) {
+    return a + (b - a) * t;
+}
+
+/**
+ * @brief Whole pixels to move this tick at speed pixels per 60 Hz tick. The
+ *        fraction left over is kept in remainder for the next tick, so slow
+ *        per-tick moves at high --sim-hz still add up to the same distance per
+ *        second (walking at 60, 120 or 240 Hz moves whole pixels and keeps nothing).
+ */
+int scaled_move(double speed, double& remainder) {
+    double move = speed * gTickScale + remainder;
+    int pixels = (int)move;
+    remainder = move - pixels;
+    return pixels;
+}
+
+/**
+ * @brief Moves one player for this tick: walking in free-roam mode, or running,
+ *        jumping and landing in gravity mode, then keeps it inside the world.
+ * @param keys Which entries of keystates steer this player.
+ */
+void update_player(PlayerState& player, const PlayerKeys& keys, const Uint8* keystates) {
+    if (!gState.gravityOn) {
+        // ------------------------------------------------
+        // A. FREE-ROAM MODE (Existing Movement Logic)
+        // ------------------------------------------------
+        
+        bool isHorizontal = keystates[keys.left] || keystates[keys.right];
+        bool isVertical = keystates[keys.up] || keystates[keys.down];
+        double speedScale = (isHorizontal && isVertical) ? 0.707 : 1.0; 
+        
+        int moveX = 0;
+        int moveY = 0;
+
+        if (keystates[keys.up]) moveY -= PLAYER_VELOCITY;
+        if (keystates[keys.down]) moveY += PLAYER_VELOCITY;
+        
+        if (keystates[keys.left]) {
+            moveX -= PLAYER_VELOCITY;
+            player.direction = PLAYER_FACING_LEFT;
+        }
+        if (keystates[keys.right]) {
+            moveX += PLAYER_VELOCITY;
+            player.direction = PLAYER_FACING_RIGHT;
+        }
+
+        player.x += scaled_move((int)(moveX * speedScale), player.subX);
+        player.y += scaled_move((int)(moveY * speedScale), player.subY);
+        
+        // Reset platformer variables 
+        player.onGround = false;
+        player.velY = 0.0;
+        gState.platformLoss = false;
+        
+    } else {
+        // ------------------------------------------------
+        // B. PLATFORMER MODE (New Logic)
+        // ------------------------------------------------
+        
+        // If loss state is active, player movement is locked
+        if (!gState.platformLoss) {
+            // 1. Horizontal Movement (Left/Right)
+            int startX = player.x;
+            int walk = 0;
+            if (keystates[keys.left]) {
+                walk -= PLAYER_VELOCITY;
+                player.direction = PLAYER_FACING_LEFT;
+            }
+            if (keystates[keys.right]) {
+                walk += PLAYER_VELOCITY;
+                player.direction = PLAYER_FACING_RIGHT;
+            }
+            player.x += scaled_move(walk, player.subX);
+
+            // 2. Jumping (only if on ground)
+            if (keystates[keys.up] && player.onGround) {
+                player.velY = JUMP_VELOCITY; 
+                player.onGround = false;         
+            }
+            
+            // 3. Apply Player Gravity. The fall is exact for constant gravity over the
+            //    tick, which is what the 60 Hz steps trace, so every rate jumps as high
+            //    (the correction is 0 at 60 Hz); moveY includes the carried fraction.
+            player.velY += PLATFORM_GRAVITY * gTickScale;
+            double fallSpeed = player.velY + 0.5 * PLATFORM_GRAVITY * (1.0 - gTickScale);
+            double moveY = fallSpeed * gTickScale + player.subY;
+
+            // 4. Platform (or Level) and Floor Collision
+            SDL_Rect platformBox = {PLATFORM_X, PLATFORM_Y, PLATFORM_WIDTH, PLATFORM_HEIGHT};
+            double hitTime;
+            int normalX, normalY;
+
+            if (gLevel.width > 0 && level_collide_player(player, startX, moveY)) {
+                // Check 4a: Player vs. the level's tiles (only the ones it moves into)
+                player.subY = 0.0;
+            } else if (gLevel.width == 0 && moveY >= 0.0 && sweep_box(player.x, player.y, PLAYER_WIDTH, PLAYER_HEIGHT, 0.0, moveY, platformBox,
+                                                 hitTime, normalX, normalY) && normalY < 0) {
+                // Check 4a: Player vs. Platform, swept over this tick's fall. The platform is
+                // one-way: only touching its top while moving down lands (resting on it is
+                // a contact at time 0), so jumping up through it is fine.
+                player.y = platformBox.y - PLAYER_HEIGHT; // Land on the top
+                player.velY = 0.0;                       // Stop falling
+                player.subY = 0.0;
+                player.onGround = true;
+            } else {
+                // In the air, or walked off the platform (or a ledge)
+                player.y += scaled_move(fallSpeed, player.subY);
+                player.onGround = false;
+            }
+
+            // Check 4b: Player vs. Bottom of the World (Loss Condition)
+            if (player.y + PLAYER_HEIGHT >= gWorldHeight) {
+                player.y = gWorldHeight - PLAYER_HEIGHT; // Snap to floor
+                player.velY = 0.0;
+                player.subY = 0.0;
+                player.onGround = true;
+                
+                // Loss condition: player touches the lowest point (floor)
+                if (!gState.platformLoss) play_sound(SOUND_LOSS);
+                gState.platformLoss = true;
+            }
+        }
+    } // END PLATFORMER MODE
+
+    // --- World Boundary Check (Player) ---
+    if (player.x < 0 || player.x + PLAYER_WIDTH > gWorldWidth) {
+        player.x = std::min(std::max(player.x, 0), gWorldWidth - PLAYER_WIDTH);
+        player.subX = 0.0;
+    }
+    if (!gState.gravityOn && (player.y < 0 || player.y + PLAYER_HEIGHT > gWorldHeight)) {
+        player.y = std::min(std::max(player.y, 0), gWorldHeight - PLAYER_HEIGHT);
+        player.subY = 0.0;
+    }
+}
+
+/**
+ * @brief Updates the positions of all game objects and checks for collisions.
+ *        Runs exactly once per fixed simulation tick.
+ */
+void update_state(const Uint8* keystates) {
+    update_particles(); // Effects keep fading, even while rewinding
+    if (keystates[REWIND_KEY]) {
+        rewind_step(); // Everything holds still while the state runs backwards
+        return;
+    }
+    rewind_save();
+
+    for (int i = 0; i < gState.playerCount; ++i) {
+        update_player(gState.players[i], PLAYER_KEYS[i], keystates);
+    }
+    update_camera();
+    
+    // --- Ball Physics (Applies in both modes) ---
+    update_ball_physics();
+    update_ball_pool();
+    
+    // --- Target Collision & Scoring Check (applies in both modes) ---
+    // The target box uses the defined constants for collision area; the grid finds it
+    // for the first player (the partner isn't in the grid, one box test does)
+    for (int i = 0; i < gState.playerCount; ++i) {
+        PlayerState& player = gState.players[i];
+        bool wasColliding = player.targetColliding; 
+        if (i == 0) {
+            player.targetColliding = grid_player_hits_target();
+        } else {
+            SDL_Rect playerBox = {(Sint16)player.x, (Sint16)player.y, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
+            SDL_Rect targetBox = {(Sint16)gState.targetX, (Sint16)gState.targetY, (Uint16)TARGET_WIDTH, (Uint16)TARGET_HEIGHT};
+            player.targetColliding = check_collision(playerBox, targetBox);
+        }
+        
+        if (player.targetColliding && !wasColliding) { 
+            gState.score++;
+            play_sound(SOUND_SCORE);
+            emit_particles((float)(gState.targetX + TARGET_WIDTH / 2), (float)(gState.targetY + TARGET_HEIGHT / 2),
+                           PARTICLE_SCORE_BURST, 0.0f, -2.0f, PARTICLE_SCORE_SPREAD, PARTICLE_GOLD);
+            move_target_randomly(); 
+        }
+    }
+}
+
+/**
+ * @brief Draws everything that doesn't move: the black clear, sign, text, buttons
+ *        and (in gravity mode) the platform. restore_background() keeps the
+ *        result, so this only runs when one of those changes.
+ */
+void draw_background(const RenderSnapshot& frame) {
+    // 1. Clear the screen (Fill with black)
+    Uint32 black = SDL_MapRGB(gScreen->format, 0, 0, 0);
+    SDL_FillRect(gScreen, NULL, black);
+
+    // 2. Draw the Sign Image (Background element)
+    const SDL_Rect& sign = gRenderSprites[SPRITE_SIGN].source;
+    draw_sprite(SPRITE_SIGN, (SCREEN_WIDTH - sign.w) / 2, (SCREEN_HEIGHT - sign.h) / 2);
+
+    // 3. Draw the pre-rendered text image (e.g., "SDL 1998")
+    draw_sprite(SPRITE_TEXT, 20, 20);
+    
+    // 4. Draw the buttons (Gravity Toggle, Retry)
+    UiState ui = {frame.gravityOn, frame.platformLoss};
+    draw_widgets(ui);
+
+    // 5. Draw Platform (if Gravity is ON), or the level's tiles in its place
+    if (frame.gravityOn && gLevel.width > 0) {
+        draw_level_tiles(gScreen, gViewX, gViewY);
+    } else if (frame.gravityOn) {
+        int currentPlatform = SPRITE_PLATFORM;
+        if (frame.platformLoss && gRenderSprites[SPRITE_PLATFORM_LOSE].loaded) {
+            currentPlatform = SPRITE_PLATFORM_LOSE; // Switch to loss texture
+        }
+
+        // To visualize the new, larger collision area, we draw a filled rect as a placeholder:
+        SDL_Rect platformDest = {(Sint16)(PLATFORM_X - gViewX), (Sint16)(PLATFORM_Y - gViewY), PLATFORM_WIDTH, PLATFORM_HEIGHT};
+        Uint32 platformColor = SDL_MapRGB(gScreen->format, 100, 100, 100); // Dark gray fill
+        SDL_FillRect(gScreen, &platformDest, platformColor);
+        
+        // We draw the original platform image over the top-left of the filled rectangle for visual context.
+        draw_sprite(currentPlatform, PLATFORM_X - gViewX, PLATFORM_Y - gViewY);
+    }
+}
+
+/**
+ * @brief Puts the background back on screen, all of it or just one area, from
+ *        the cached copy. The cache is recomposed with draw_background() first
+ *        if the gravity or loss state changed, or sprites were swapped in, since
+ *        it was drawn.
+ */
+void restore_background(const RenderSnapshot& frame, const SDL_Rect* area) {
+    bool stale = !gBackground.valid || gBackground.gravityOn != frame.gravityOn || gBackground.platformLoss != frame.platformLoss ||
+                 gBackground.viewX != gViewX || gBackground.viewY != gViewY;
+    if (stale) {
+        if (gBackground.surface == NULL) {
+            const SDL_PixelFormat* format = gScreen->format;
+            gBackground.surface = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, format->BitsPerPixel,
+                                                       format->Rmask, format->Gmask, format->Bmask, format->Amask);
+        }
+        // Compose on the screen (whole), then keep a copy of it
+        SDL_SetClipRect(gScreen, NULL);
+        draw_background(frame);
+        gBackground.rebuilds++;
+        if (gBackground.surface == NULL) return; // No cache: draw_background(frame) every time
+        SDL_BlitSurface(gScreen, NULL, gBackground.surface, NULL);
+        gBackground.valid = true;
+        gBackground.gravityOn = frame.gravityOn;
+        gBackground.platformLoss = frame.platformLoss;
+        gBackground.viewX = gViewX;
+        gBackground.viewY = gViewY;
+        return;
+    }
+
+    // Same format, no color key: SDL copies the rows straight across
+    SDL_Rect source = area != NULL ? *area : gBackground.surface->clip_rect;
+    SDL_Rect dest = source;
+    SDL_BlitSurface(gBackground.surface, &source, gScreen, &dest);
+    gBackground.hits++;
+}
+
+/**
+ * @brief Draws the moving objects on top of the background.
+ * @param frame Snapshot to draw (its alpha interpolates between its two ticks).
+ * @param bounds Receives the screen area covered by each sprite (MAX_SPRITE_RECTS entries).
+ * @return Number of rectangles written to bounds.
+ */
+int draw_sprites(const RenderSnapshot& frame, SDL_Rect* bounds) {
+    int boundCount = 0;
+
+    // Interpolated draw positions for the moving objects, on the screen
+    Sint16 ballDrawX = (Sint16)(frame.ballX - gViewX);
+    Sint16 ballDrawY = (Sint16)(frame.ballY - gViewY);
+    if (!frame.ballGrabbed) { // A grabbed ball follows the cursor directly
+        ballDrawX = (Sint16)(lerp(frame.prevBallX, frame.ballX, frame.alpha) - gViewX);
+        ballDrawY = (Sint16)(lerp(frame.prevBallY, frame.ballY, frame.alpha) - gViewY);
+    }
+    Sint16 targetDrawX = (Sint16)(frame.targetX - gViewX);
+    Sint16 targetDrawY = (Sint16)(frame.targetY - gViewY);
+
+    // Late latch: the cursor (and a grabbed ball) use the mouse position as of now,
+    // not as of handle_events() one update and possibly a frame delay earlier
+    int followerX = frame.followerX;
+    int followerY = frame.followerY;
+    gCursorSampleTime = frame.inputTime;
+    if (frame.lateLatch && gRenderSprites[SPRITE_CURSOR].loaded) {
+        if (gPipeline.thread == NULL) SDL_PumpEvents(); // Video thread only; otherwise the main loop pumps
+        int mouseX, mouseY;
+        SDL_GetMouseState(&mouseX, &mouseY);
+        gCursorSampleTime = std::chrono::steady_clock::now();
+        followerX = mouseX - (gRenderSprites[SPRITE_CURSOR].source.w / 2);
+        followerY = mouseY - (gRenderSprites[SPRITE_CURSOR].source.h / 2);
+        if (frame.ballGrabbed) { // Same placement and clamping (in the world) as update_ball_physics()
+            ballDrawX = (Sint16)(std::max(0, std::min(gWorldWidth - BALL_WIDTH, mouseX + gViewX - BALL_WIDTH / 2)) - gViewX);
+            ballDrawY = (Sint16)(std::max(0, std::min(gWorldHeight - BALL_HEIGHT, mouseY + gViewY - BALL_HEIGHT / 2)) - gViewY);
+        }
+    }
+
+    // Sprites outside the view are culled before any blit is issued, so the cost of
+    // a frame depends on what's visible, not on the size of the world
+    long drawn = 0;
+    long culled = 0;
+
+    // 6. Draw Player Images based on direction (the partner's too, if any)
+    for (int i = 0; i < frame.playerCount; ++i) {
+        Sint16 playerDrawX = (Sint16)(lerp(frame.prevPlayerX[i], frame.playerX[i], frame.alpha) - gViewX);
+        Sint16 playerDrawY = (Sint16)(lerp(frame.prevPlayerY[i], frame.playerY[i], frame.alpha) - gViewY);
+        int currentSprite = frame.playerDirection[i] == PLAYER_FACING_LEFT ? SPRITE_PLAYER_LEFT : SPRITE_PLAYER_RIGHT;
+        
+        if (!on_screen(playerDrawX, playerDrawY, PLAYER_WIDTH, PLAYER_HEIGHT)) {
+            culled++;
+        } else if (draw_sprite(currentSprite, playerDrawX, playerDrawY)) {
+            bounds[boundCount++] = sprite_bounds(currentSprite, playerDrawX, playerDrawY);
+            drawn++;
+        } else {
+            SDL_Rect playerBox = {playerDrawX, playerDrawY, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
+            bounds[boundCount++] = playerBox;
+            Uint32 fallbackRed = SDL_MapRGB(gScreen->format, 255, 0, 0);
+            SDL_FillRect(gScreen, &playerBox, fallbackRed);
+        }
+    }
+
+
+    // 7. Draw Target Image (Replaces Blue/Yellow Box)
+    // Draw the target image. The collision area is still based on TARGET_WIDTH/HEIGHT constants.
+    if (!on_screen(targetDrawX, targetDrawY, TARGET_WIDTH, TARGET_HEIGHT)) {
+        culled++;
+    } else if (draw_sprite(SPRITE_TARGET, targetDrawX, targetDrawY)) {
+        bounds[boundCount++] = sprite_bounds(SPRITE_TARGET, targetDrawX, targetDrawY);
+        drawn++;
+    } else {
+        // Fallback (original blue box drawing) if the target image fails to load
+        SDL_Rect blueBox = {targetDrawX, targetDrawY, (Uint16)TARGET_WIDTH, (Uint16)TARGET_HEIGHT};
+        bounds[boundCount++] = blueBox;
+        Uint32 fallbackBlue = SDL_MapRGB(gScreen->format, 0, 0, 255);
+        SDL_FillRect(gScreen, &blueBox, fallbackBlue);
+    }
+    
+    // 8. Draw Beachball
+    if (gRenderSprites[SPRITE_BALL].loaded) {
+        if (!on_screen(ballDrawX, ballDrawY, BALL_WIDTH, BALL_HEIGHT)) {
+            culled++;
+        } else if (draw_sprite(SPRITE_BALL, ballDrawX, ballDrawY)) {
+            bounds[boundCount++] = sprite_bounds(SPRITE_BALL, ballDrawX, ballDrawY);
+            drawn++;
+        }
+
+        // Stress mode balls (drawn at their current tick position)
+        for (int i = 0; i < frame.poolCount; ++i) {
+            int x = (int)frame.poolX[i] - gViewX;
+            int y = (int)frame.poolY[i] - gViewY;
+            if (!on_screen(x, y, BALL_WIDTH, BALL_HEIGHT)) {
+                culled++;
+                continue;
+            }
+            draw_sprite(SPRITE_BALL, x, y);
+            drawn++;
+        }
+    } else {
+        // Fallback (orange box) until the beachball image has loaded
+        SDL_Rect ballBox = {ballDrawX, ballDrawY, (Uint16)BALL_WIDTH, (Uint16)BALL_HEIGHT};
+        bounds[boundCount++] = ballBox;
+        Uint32 fallbackOrange = SDL_MapRGB(gScreen->format, 255, 140, 0);
+        SDL_FillRect(gScreen, &ballBox, fallbackOrange);
+    }
+    
+
+    gRenderStats.spritesDrawn += drawn;
+    gRenderStats.spritesCulled += culled;
+
+    // 9. Particles, over everything in the world, tracked as one area
+    if (frame.particles.count > 0) {
+        auto start = std::chrono::steady_clock::now();
+        SDL_Rect area;
+        if (draw_particles(gScreen, frame.particles, frame.alpha, gViewX, gViewY, PARTICLE_DRAW_BUDGET, area) > 0) {
+            bounds[boundCount++] = area;
+        }
+        int stride = (frame.particles.count + PARTICLE_DRAW_BUDGET - 1) / PARTICLE_DRAW_BUDGET;
+        int considered = (frame.particles.count + stride - 1) / stride;
+        gParticleStats.frames++;
+        gParticleStats.drawn += considered;
+        gParticleStats.thinned += frame.particles.count - considered;
+        gParticleStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // 10. Draw the Cursor Follower (Foreground element)
+    // Select the cursor image based on whether the mouse button is down
+    int currentCursor = SPRITE_CURSOR;
+    if (frame.mouseDown && gRenderSprites[SPRITE_CURSOR_CLICK].loaded) {
+        currentCursor = SPRITE_CURSOR_CLICK;
+    }
+    
+    // The follower position is calculated to center the cursor image
+    if (draw_sprite(currentCursor, followerX, followerY)) {
+        bounds[boundCount++] = sprite_bounds(currentCursor, followerX, followerY);
+    }
+
+    return boundCount;
+}
+
+/**
+ * @brief Clips a rectangle to the screen. Returns false if nothing is left.
+ */
+bool clip_to_screen(SDL_Rect& rect) {
+    int x1 = std::max((int)rect.x, 0);
+    int y1 = std::max((int)rect.y, 0);
+    int x2 = std::min(rect.x + rect.w, SCREEN_WIDTH);
+    int y2 = std::min(rect.y + rect.h, SCREEN_HEIGHT);
+    if (x2 <= x1 || y2 <= y1) return false;
+
+    rect.x = (Sint16)x1;
+    rect.y = (Sint16)y1;
+    rect.w = (Uint16)(x2 - x1);
+    rect.h = (Uint16)(y2 - y1);
+    return true;
+}
+
+/**
+ * @brief Returns the smallest rectangle containing both A and B.
+ */
+SDL_Rect rect_union(const SDL_Rect& A, const SDL_Rect& B) {
+    int x1 = std::min(A.x, B.x);
+    int y1 = std::min(A.y, B.y);
+    int x2 = std::max(A.x + A.w, B.x + B.w);
+    int y2 = std::max(A.y + A.h, B.y + B.h);
+    SDL_Rect result = {(Sint16)x1, (Sint16)y1, (Uint16)(x2 - x1), (Uint16)(y2 - y1)};
+    return result;
+}
+
+/**
+ * @brief Copies everything the renderer needs out of the game state.
+ * @param copyPool Copy the stress pool positions and the particles too (needed
+ *        when the snapshot goes to the render thread); otherwise it points at
+ *        gBallPool and gParticles directly.
+ */
+void capture_snapshot(RenderSnapshot& frame, double alpha, bool copyPool) {
+    frame.alpha = alpha;
+    frame.playerCount = gState.playerCount;
+    for (int i = 0; i < gState.playerCount; ++i) {
+        frame.playerX[i] = gState.players[i].x;
+        frame.playerY[i] = gState.players[i].y;
+        frame.prevPlayerX[i] = gPrevPlayerX[i];
+        frame.prevPlayerY[i] = gPrevPlayerY[i];
+        frame.playerDirection[i] = gState.players[i].direction;
+    }
+    frame.ballX = gState.ballX;
+    frame.ballY = gState.ballY;
+    frame.prevBallX = gPrevBallX;
+    frame.prevBallY = gPrevBallY;
+    frame.ballGrabbed = gState.ballGrabbed;
+    frame.cameraX = gState.cameraX;
+    frame.cameraY = gState.cameraY;
+    frame.prevCameraX = gPrevCameraX;
+    frame.prevCameraY = gPrevCameraY;
+    frame.targetX = gState.targetX;
+    frame.targetY = gState.targetY;
+    frame.followerX = gState.followerX;
+    frame.followerY = gState.followerY;
+    frame.mouseDown = gState.mouseDown;
+    frame.gravityOn = gState.gravityOn;
+    frame.platformLoss = gState.platformLoss;
+    frame.score = gState.score;
+
+    frame.poolCount = gBallPool.count;
+    frame.poolX = gBallPool.x;
+    frame.poolY = gBallPool.y;
+    if (copyPool && gBallPool.count > 0) {
+        frame.poolCopyX.assign(gBallPool.x, gBallPool.x + gBallPool.count);
+        frame.poolCopyY.assign(gBallPool.y, gBallPool.y + gBallPool.count);
+        frame.poolX = &frame.poolCopyX[0];
+        frame.poolY = &frame.poolCopyY[0];
+    }
+    frame.particles = gParticles;
+    if (copyPool && gParticles.count > 0) {
+        int n = gParticles.count;
+        frame.particleCopy.resize((size_t)n * 5);
+        float* copy = &frame.particleCopy[0];
+        const float* arrays[] = {gParticles.x, gParticles.y, gParticles.velX, gParticles.velY, gParticles.life};
+        float** copies[] = {&frame.particles.x, &frame.particles.y, &frame.particles.velX, &frame.particles.velY, &frame.particles.life};
+        for (int a = 0; a < 5; ++a) {
+            memcpy(copy + (size_t)n * a, arrays[a], n * sizeof(float));
+            *copies[a] = copy + (size_t)n * a;
+        }
+        frame.particleColorCopy.assign(gParticles.color, gParticles.color + n);
+        frame.particles.color = &frame.particleColorCopy[0];
+    }
+
+    memcpy(frame.sprites, gSprites, sizeof(frame.sprites));
+    frame.spritesVersion = gSpritesVersion;
+    frame.showHud = gShowTimingHud;
+    frame.lateLatch = !gInputLog.replaying;
+}
+
+/**
+ * @brief Clears the screen and draws all game elements (and the timing HUD),
+ *        then works out what present_frame() has to push to the display.
+ * @param frame Snapshot of the game state to draw.
+ *
+ * In dirty-rect mode only the areas covered by sprites last frame and this frame
+ * are restored and pushed to the display with SDL_UpdateRects. A change of the UI
+ * state (gravity mode, loss state) falls back to a full redraw. The HUD is
+ * tracked like a sprite.
+ */
+void render_scene(const RenderSnapshot& frame) {
+    // Sprites swapped in since the last frame: take them, redraw everything
+    bool spritesChanged = frame.spritesVersion != gDrawnSpritesVersion;
+    if (spritesChanged) {
+        memcpy(gRenderSprites, frame.sprites, sizeof(gRenderSprites));
+        gDrawnSpritesVersion = frame.spritesVersion;
+        gBackground.valid = false;
+    }
+
+    // Interpolated camera for this frame; everything in the world is drawn relative to it
+    gViewX = (int)lerp(frame.prevCameraX, frame.cameraX, frame.alpha);
+    gViewY = (int)lerp(frame.prevCameraY, frame.cameraY, frame.alpha);
+
+    // (The stress pool has far too many sprites to track individually. A moving
+    // camera moves everything.)
+    bool fullRedraw = !gDirtyRectMode || spritesChanged || frame.poolCount > 0 ||
+                      gDrawnGravityOn != frame.gravityOn || gDrawnPlatformLoss != frame.platformLoss ||
+                      gDrawnViewX != gViewX || gDrawnViewY != gViewY;
+
+    if (fullRedraw) {
+        restore_background(frame, NULL);
+    } else {
+        // Restore last frame's sprite areas from the background
+        for (int i = 0; i < gLastSpriteRectCount; ++i) {
+            SDL_Rect area = gLastSpriteRects[i];
+            if (clip_to_screen(area)) restore_background(frame, &area);
+        }
+    }
+
+    SDL_Rect spriteRects[MAX_SPRITE_RECTS];
+    int spriteRectCount = draw_sprites(frame, spriteRects);
+    if (frame.showHud) {
+        spriteRects[spriteRectCount++] = draw_timing_hud();
+    }
+
+    // 11. Work out what to present
+    gRenderStats.frames++;
+    gPresentFull = fullRedraw;
+    gPresentRectCount = 0;
+    if (fullRedraw) {
+        gRenderStats.fullRedraws++;
+        gRenderStats.pixelsPresented += (double)SCREEN_WIDTH * SCREEN_HEIGHT;
+    } else {
+        // Present old and new sprite areas; merge the pair when they overlap
+        SDL_Rect updateRects[MAX_SPRITE_RECTS * 2];
+        int updateCount = 0;
+        for (int i = 0; i < spriteRectCount || i < gLastSpriteRectCount; ++i) {
+            bool hasNew = i < spriteRectCount;
+            bool hasOld = i < gLastSpriteRectCount;
+            if (hasNew && hasOld && check_collision(spriteRects[i], gLastSpriteRects[i])) {
+                updateRects[updateCount++] = rect_union(spriteRects[i], gLastSpriteRects[i]);
+            } else {
+                if (hasNew) updateRects[updateCount++] = spriteRects[i];
+                if (hasOld) updateRects[updateCount++] = gLastSpriteRects[i];
+            }
+        }
+
+        for (int i = 0; i < updateCount; ++i) {
+            if (clip_to_screen(updateRects[i])) {
+                gPresentRects[gPresentRectCount++] = updateRects[i];
+                gRenderStats.pixelsPresented += (double)updateRects[i].w * updateRects[i].h;
+            }
+        }
+    }
+
+    // Remember what we drew for the next frame
+    for (int i = 0; i < spriteRectCount; ++i) {
+        gLastSpriteRects[i] = spriteRects[i];
+    }
+    gLastSpriteRectCount = spriteRectCount;
+    gDrawnGravityOn = frame.gravityOn;
+    gDrawnPlatformLoss = frame.platformLoss;
+    gDrawnViewX = gViewX;
+    gDrawnViewY = gViewY;
+}
+
+/**
+ * @brief Pushes the frame drawn by render_scene() to the display.
+ */
+void present_frame() {
+    if (gPresentFull) {
+        if (SDL_Flip(gScreen) == -1) {
+            std::cerr << "SDL_Flip failed!" << std::endl;
+        }
+    } else {
+        SDL_UpdateRects(gScreen, gPresentRectCount, gPresentRects);
+    }
+}
+
+/**
+ * @brief Draws and presents one snapshot, finishes its phase timings and records
+ *        how long ago its input was read.
+ */
+void draw_frame(const RenderSnapshot& frame) {
+    float phaseMs[PHASE_COUNT];
+    phaseMs[PHASE_EVENTS] = frame.phaseMs[PHASE_EVENTS];
+    phaseMs[PHASE_UPDATE] = frame.phaseMs[PHASE_UPDATE];
+    std::chrono::steady_clock::time_point phaseMark = std::chrono::steady_clock::now();
+
+    render_scene(frame);
+    phaseMs[PHASE_RENDER] = lap_ms(phaseMark);
+    if (gPipeline.videoLock != NULL) SDL_LockMutex(gPipeline.videoLock);
+    present_frame();
+    if (gPipeline.videoLock != NULL) SDL_UnlockMutex(gPipeline.videoLock);
+    phaseMs[PHASE_PRESENT] = lap_ms(phaseMark);
+
+    if (gRenderStats.frames == 1) {
+        gStartupStats.firstFrameMs = std::chrono::duration<double, std::milli>(phaseMark - gLaunchTime).count();
+    }
+    gPipelineStats.latencyMs.push_back(std::chrono::duration<float, std::milli>(phaseMark - frame.inputTime).count());
+    gPipelineStats.cursorLatencyMs.push_back(std::chrono::duration<float, std::milli>(phaseMark - gCursorSampleTime).count());
+    record_frame_timings(phaseMs);
+}
+
+/**
+ * @brief Render thread body: draws the newest published snapshot each time one
+ *        arrives. Snapshots published while it was busy are skipped, not queued.
+ */
+int render_thread_main(void*) {
+    while (true) {
+        SDL_SemWait(gPipeline.published);
+        if (gPipeline.quit) break;
+        if ((gPipeline.ready & SNAPSHOT_FRESH) == 0) continue; // Taken already (one post per publish)
+        gPipeline.reading = gPipeline.ready.exchange(gPipeline.reading) & ~SNAPSHOT_FRESH;
+        draw_frame(gPipeline.slots[gPipeline.reading]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Moves drawing and presenting to a render thread (--render-thread).
+ */
+bool render_thread_start() {
+    gPipeline.writing = 0;
+    gPipeline.ready = 1;
+    gPipeline.reading = 2;
+    gPipeline.quit = false;
+    gPipeline.published = SDL_CreateSemaphore(0);
+    gPipeline.videoLock = SDL_CreateMutex();
+    gPipeline.thread = SDL_CreateThread(render_thread_main, NULL);
+    if (gPipeline.thread == NULL) {
+        std::cerr << "ERROR: Could not start the render thread! SDL Error: " << SDL_GetError() << std::endl;
+        render_thread_stop();
+        return false;
+    }
+    gPipelineStats.renderThread = true;
+    return true;
+}
+
+/**
+ * @brief Stops the render thread (if there is one) after its current frame.
+ */
+void render_thread_stop() {
+    if (gPipeline.thread != NULL) {
+        gPipeline.quit = true;
+        SDL_SemPost(gPipeline.published);
+        SDL_WaitThread(gPipeline.thread, NULL);
+        gPipeline.thread = NULL;
+    }
+    if (gPipeline.published != NULL) SDL_DestroySemaphore(gPipeline.published);
+    if (gPipeline.videoLock != NULL) SDL_DestroyMutex(gPipeline.videoLock);
+    gPipeline.published = NULL;
+    gPipeline.videoLock = NULL;
+}
+
+/**
+ * @brief Hands the snapshot in slots[writing] to the render thread and takes
+ *        back a free slot to fill next. Never blocks.
+ */
+void publish_snapshot() {
+    gPipeline.writing = gPipeline.ready.exchange(gPipeline.writing | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+    SDL_SemPost(gPipeline.published);
+}
+
+/**
+ * @brief Returns the milliseconds since mark and moves mark to now, so
+ *        consecutive calls time consecutive phases.
+ */
+float lap_ms(std::chrono::steady_clock::time_point& mark) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float ms = std::chrono::duration<float, std::milli>(now - mark).count();
+    mark = now;
+    return ms;
+}
+
+/**
+ * @brief Stores one frame's phase timings in the ring buffer (the total is
+ *        derived here).
+ */
+void record_frame_timings(const float* phaseMs) {
+    float* slot = gFrameTimings.ms[gFrameTimings.next];
+    float total = 0.0f;
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        slot[p] = phaseMs[p];
+        total += phaseMs[p];
+    }
+    slot[PHASE_TOTAL] = total;
+
+    gFrameTimings.next = (gFrameTimings.next + 1) % FRAME_HISTORY;
+    if (gFrameTimings.count < FRAME_HISTORY) gFrameTimings.count++;
+}
+
+/**
+ * @brief Current (latest), average and p99 of one column of the ring buffer.
+ */
+void timing_summary(int column, float& current, float& average, float& p99) {
+    static float scratch[FRAME_HISTORY]; // Reused, so the HUD never allocates
+    int count = gFrameTimings.count;
+    current = average = p99 = 0.0f;
+    if (count == 0) return;
+
+    float sum = 0.0f;
+    for (int i = 0; i < count; ++i) {
+        scratch[i] = gFrameTimings.ms[i][column];
+        sum += scratch[i];
+    }
+    current = gFrameTimings.ms[(gFrameTimings.next + FRAME_HISTORY - 1) % FRAME_HISTORY][column];
+    average = sum / count;
+    int index = (int)(0.99f * (count - 1) + 0.5f);
+    std::nth_element(scratch, scratch + index, scratch + count);
+    p99 = scratch[index];
+}
+
+/**
+ * @brief Draws a line of text with the built-in 3x5 HUD font. Characters not in
+ *        the font are left blank.
+ */
+void draw_hud_text(const char* text, int x, int y, Uint32 color) {
+    for (; *text != '\0'; ++text, x += HUD_CHAR_ADVANCE) {
+        const char* found = strchr(HUD_FONT_CHARS, toupper((unsigned char)*text));
+        if (*text == ' ' || found == NULL) continue;
+        int glyph = HUD_FONT_GLYPHS[found - HUD_FONT_CHARS];
+
+        for (int row = 0; row < 5; ++row) {
+            int bits = (glyph >> (3 * (4 - row))) & 7;
+            for (int col = 0; col < 3; ++col) {
+                if (bits & (4 >> col)) {
+                    SDL_Rect pixel = {(Sint16)(x + col * HUD_FONT_SCALE), (Sint16)(y + row * HUD_FONT_SCALE),
+                                      (Uint16)HUD_FONT_SCALE, (Uint16)HUD_FONT_SCALE};
+                    SDL_FillRect(gScreen, &pixel, color);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Draws the frame timing overlay: a table with the current, average and
+ *        p99 time of each phase, and a stacked graph of the recent frames with a
+ *        line at one sim tick. Returns the area it covered.
+ */
+SDL_Rect draw_timing_hud() {
+    SDL_Rect panel = {HUD_X, HUD_Y, HUD_WIDTH, HUD_HEIGHT};
+    SDL_FillRect(gScreen, &panel, SDL_MapRGB(gScreen->format, 16, 16, 24));
+
+    Uint32 colors[PHASE_COUNT + 1];
+    for (int p = 0; p <= PHASE_COUNT; ++p) {
+        colors[p] = SDL_MapRGB(gScreen->format, HUD_PHASE_RGB[p][0], HUD_PHASE_RGB[p][1], HUD_PHASE_RGB[p][2]);
+    }
+
+    // 1. Table: one row per phase plus the frame total, in the graph's colors
+    int textX = HUD_X + HUD_PADDING;
+    int textY = HUD_Y + HUD_PADDING;
+    draw_hud_text("MS        CUR   AVG   P99", textX, textY, colors[PHASE_TOTAL]);
+    char line[64];
+    for (int p = 0; p <= PHASE_COUNT; ++p) {
+        float current, average, p99;
+        timing_summary(p, current, average, p99);
+        snprintf(line, sizeof(line), "%-7s %5.2f %5.2f %5.2f", PHASE_NAMES[p], current, average, p99);
+        draw_hud_text(line, textX, textY + (p + 1) * HUD_LINE_HEIGHT, colors[p]);
+    }
+
+    // 2. Graph: newest frame on the right, one column per frame, phases stacked
+    int graphBottom = HUD_Y + HUD_HEIGHT - HUD_PADDING;
+    int graphX = HUD_X + HUD_PADDING;
+    int frames = std::min(gFrameTimings.count, HUD_GRAPH_WIDTH);
+    for (int i = 0; i < frames; ++i) {
+        const float* slot = gFrameTimings.ms[(gFrameTimings.next + FRAME_HISTORY - frames + i) % FRAME_HISTORY];
+        int stacked = 0;
+        for (int p = 0; p < PHASE_COUNT && stacked < HUD_GRAPH_HEIGHT; ++p) {
+            int height = std::min((int)(slot[p] * HUD_GRAPH_PIXELS_PER_MS + 0.5f), HUD_GRAPH_HEIGHT - stacked);
+            if (height <= 0) continue;
+            stacked += height;
+            SDL_Rect bar = {(Sint16)(graphX + HUD_GRAPH_WIDTH - frames + i), (Sint16)(graphBottom - stacked), 1, (Uint16)height};
+            SDL_FillRect(gScreen, &bar, colors[p]);
         }
+    }
+    SDL_Rect tickLine = {(Sint16)graphX, (Sint16)(graphBottom - (int)(gTickMs * HUD_GRAPH_PIXELS_PER_MS)), HUD_GRAPH_WIDTH, 1};
+    SDL_FillRect(gScreen, &tickLine, SDL_MapRGB(gScreen->format, 200, 60, 60));
+
+    return panel;
+}
+
+/**
+ * @brief Prints the per-phase frame timings of the last FRAME_HISTORY frames.
+ */
+void print_frame_timings() {
+    if (gFrameTimings.count == 0) return;
+
+    std::cout << "Frame phases (last " << gFrameTimings.count << " frames, ms avg / p99):" << std::endl;
+    for (int p = 0; p <= PHASE_COUNT; ++p) {
+        float current, average, p99;
+        timing_summary(p, current, average, p99);
+        std::cout << "  " << PHASE_NAMES[p] << ": " << average << " / " << p99 << std::endl;
+    }
+}
+
+/**
+ * @brief Prints the renderer statistics collected during the session.
+ */
+void print_render_stats() {
+    if (gRenderStats.frames == 0) return;
+
+    double fullFrame = (double)SCREEN_WIDTH * SCREEN_HEIGHT;
+    double avgPixels = gRenderStats.pixelsPresented / gRenderStats.frames;
+    std::cout << "Render stats: " << gRenderStats.frames << " frames, "
+              << gRenderStats.fullRedraws << " full redraws" << std::endl;
+    std::cout << "  sprites: " << gRenderStats.spritesDrawn << " drawn, " << gRenderStats.spritesCulled
+              << " culled outside the view" << std::endl;
+    std::cout << "  pixels presented/frame: " << (long)avgPixels
+              << " (" << 100.0 * avgPixels / fullFrame << "% of a full frame)" << std::endl;
+    long restores = gBackground.hits + gBackground.rebuilds;
+    std::cout << "  background cache: " << gBackground.hits << " hits, " << gBackground.rebuilds << " rebuilds ("
+              << (restores > 0 ? 100.0 * gBackground.hits / restores : 0.0) << "% hit rate)" << std::endl;
+}
+
+/**
+ * @brief Prints how many particles were spawned and what they cost to update
+ *        and draw.
+ */
+void print_particle_stats() {
+    if (gParticleStats.spawned == 0) return;
+    std::cout << "Particles: " << gParticleStats.spawned << " spawned, " << gParticleStats.dropped << " dropped (pool of "
+              << PARTICLE_CAPACITY << "), " << gParticleStats.peak << " alive at most" << std::endl;
+    if (gParticleStats.updates > 0) {
+        std::cout << "  update: " << gParticleStats.updateMs * 1000.0 / gParticleStats.updates << " us/tick" << std::endl;
+    }
+    if (gParticleStats.frames > 0) {
+        std::cout << "  draw: " << gParticleStats.drawMs * 1000.0 / gParticleStats.frames << " us/frame, "
+                  << gParticleStats.drawn / gParticleStats.frames << " drawn/frame, " << gParticleStats.thinned
+                  << " skipped over the budget of " << PARTICLE_DRAW_BUDGET << std::endl;
+    }
+}
 
-        gPlayerX += (int)(moveX * speedScale);
-        gPlayerY += (int)(moveY * speedScale);
-        
-        // Reset platformer variables 
-        gIsOnGround = false;
-        gPlayerVelY = 0.0;
-        gPlatformLoss = false;
-        
-    } else {
-        // ------------------------------------------------
-        // B. PLATFORMER MODE (New Logic)
-        // ------------------------------------------------
-        
-        // If loss state is active, player movement is locked
-        if (!gPlatformLoss) {
-            // 1. Horizontal Movement (Left/Right)
-            if (keystates[SDLK_LEFT]) {
-                gPlayerX -= PLAYER_VELOCITY;
-                gPlayerDirection = PLAYER_FACING_LEFT;
-            }
-            if (keystates[SDLK_RIGHT]) {
-                gPlayerX += PLAYER_VELOCITY;
-                gPlayerDirection = PLAYER_FACING_RIGHT;
-            }
+/**
+ * @brief Prints throughput (main loop and presented frames per second) next to
+ *        input-to-display latency, the two things the render thread trades.
+ */
+void print_pipeline_stats() {
+    std::vector<float>& latency = gPipelineStats.latencyMs;
+    if (latency.empty() || gPipelineStats.wallMs <= 0.0) return;
 
-            // 2. Jumping (only if on ground)
-            if (keystates[SDLK_UP] && gIsOnGround) {
-                gPlayerVelY = JUMP_VELOCITY; 
-                gIsOnGround = false;         
-            }
-            
-            // 3. Apply Player Gravity & Vertical Movement
-            gPlayerVelY += PLATFORM_GRAVITY;
-            gPlayerY += (int)gPlayerVelY;
+    double seconds = gPipelineStats.wallMs / 1000.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < latency.size(); ++i) sum += latency[i];
+    std::sort(latency.begin(), latency.end());
+    std::cout << "Pipeline (" << (gPipelineStats.renderThread ? "render thread" : "single thread") << "): "
+              << gPipelineStats.loops / seconds << " loops/s, " << gRenderStats.frames / seconds << " frames/s presented" << std::endl;
+    std::cout << "  input to display: avg " << sum / latency.size() << " ms, p50 " << latency[latency.size() / 2]
+              << " ms, p99 " << latency[(latency.size() - 1) * 99 / 100] << " ms" << std::endl;
 
-            // 4. Platform and Floor Collision
-            
-            // Rectangles for collision checks
-            SDL_Rect playerBox = {(Sint16)gPlayerX, (Sint16)gPlayerY, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
-            SDL_Rect platformBox = {PLATFORM_X, PLATFORM_Y, PLATFORM_WIDTH, PLATFORM_HEIGHT};
+    // The cursor used to be drawn from the position read with the input (the line
+    // above); it's late-latched now when the mouse is live
+    std::vector<float>& cursor = gPipelineStats.cursorLatencyMs;
+    double cursorSum = 0.0;
+    for (size_t i = 0; i < cursor.size(); ++i) cursorSum += cursor[i];
+    std::sort(cursor.begin(), cursor.end());
+    std::cout << "  cursor to display: avg " << cursorSum / cursor.size() << " ms, p50 " << cursor[cursor.size() / 2]
+              << " ms, p99 " << cursor[(cursor.size() - 1) * 99 / 100] << " ms" << std::endl;
+    if (gPipelineStats.motionEvents > 0) {
+        std::cout << "  mouse motion: " << gPipelineStats.motionEvents << " events collapsed into "
+                  << gPipelineStats.motionUpdates << " updates" << std::endl;
+    }
+}
 
-            // Check 4a: Player vs. Platform
-            if (check_collision(playerBox, platformBox) && gPlayerY + PLAYER_HEIGHT < platformBox.y + PLAYER_VELOCITY) { 
-                // Collision from above (player is falling slowly or resting)
-                if (gPlayerVelY >= 0.0) {
-                    gPlayerY = platformBox.y - PLAYER_HEIGHT; // Snap to the top
-                    gPlayerVelY = 0.0;                       // Stop falling
-                    gIsOnGround = true;
-                }
-            } else if (gIsOnGround) {
-                // Check if player walked off the platform
-                gIsOnGround = false;
+// --- Headless Input Script ---
+// Stands in for the keyboard and mouse when running headless. The sequence loops:
+// roam around, switch gravity on, fall and lose, retry, jump, end up on the
+// floor again, retry and switch gravity back off, so every branch of
+// update_state() is exercised.
+enum {
+    SCRIPT_NONE = 0,
+    SCRIPT_LEFT = 1 << 0,
+    SCRIPT_RIGHT = 1 << 1,
+    SCRIPT_UP = 1 << 2,
+    SCRIPT_DOWN = 1 << 3,
+    SCRIPT_CLICK_TOGGLE = 1 << 4, // Click fires on the first tick of the step
+    SCRIPT_CLICK_RETRY = 1 << 5
+};
+
+struct ScriptStep {
+    int ticks; // How many ticks this step lasts
+    int input; // SCRIPT_* flags
+};
+
+const ScriptStep HEADLESS_SCRIPT[] = {
+    {120, SCRIPT_RIGHT},
+    {60,  SCRIPT_RIGHT | SCRIPT_DOWN},
+    {90,  SCRIPT_LEFT | SCRIPT_UP},
+    {45,  SCRIPT_NONE},
+    {1,   SCRIPT_CLICK_TOGGLE},       // Gravity on: the player falls past the platform
+    {90,  SCRIPT_RIGHT},
+    {1,   SCRIPT_CLICK_RETRY},        // Respawn above the platform
+    {30,  SCRIPT_NONE},
+    {20,  SCRIPT_RIGHT | SCRIPT_UP},  // Jump (if we landed)
+    {120, SCRIPT_RIGHT},              // Walk off the edge onto the floor
+    {1,   SCRIPT_CLICK_RETRY},
+    {10,  SCRIPT_LEFT},
+    {1,   SCRIPT_CLICK_TOGGLE}        // Gravity off again (while still airborne)
+};
+const int HEADLESS_SCRIPT_LENGTH = sizeof(HEADLESS_SCRIPT) / sizeof(HEADLESS_SCRIPT[0]);
+
+/**
+ * @brief Turns a script step's SCRIPT_* flags into a tick's input. Clicks (press
+ *        and release on the button) happen on the first tick of their step.
+ */
+TickInput script_input(int script, bool firstTick) {
+    TickInput input = {0, 0, 0};
+    if (script & SCRIPT_LEFT) input.flags |= INPUT_LEFT;
+    if (script & SCRIPT_RIGHT) input.flags |= INPUT_RIGHT;
+    if (script & SCRIPT_UP) input.flags |= INPUT_UP;
+    if (script & SCRIPT_DOWN) input.flags |= INPUT_DOWN;
+
+    if (firstTick && (script & SCRIPT_CLICK_TOGGLE)) {
+        input.flags |= INPUT_PRESS | INPUT_RELEASE;
+        input.mouseX = TOGGLE_BUTTON_X + TOGGLE_BUTTON_WIDTH / 2;
+        input.mouseY = TOGGLE_BUTTON_Y + TOGGLE_BUTTON_HEIGHT / 2;
+    }
+    if (firstTick && (script & SCRIPT_CLICK_RETRY)) {
+        input.flags |= INPUT_PRESS | INPUT_RELEASE;
+        input.mouseX = RETRY_BUTTON_X + RETRY_BUTTON_WIDTH / 2;
+        input.mouseY = RETRY_BUTTON_Y + RETRY_BUTTON_HEIGHT / 2;
+    }
+    return input;
+}
+
+/**
+ * @brief Returns the p-th percentile (0..100) of an already sorted sample set.
+ */
+long long percentile(const std::vector<long long>& sorted, double p) {
+    size_t index = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+/**
+ * @brief Runs the simulation without video for the given number of ticks, as fast as
+ *        possible, feeding it the scripted input. Prints throughput and per-tick timings.
+ */
+int run_headless(long ticks) {
+    Uint8 keystates[SDLK_LAST];
+    memset(keystates, 0, sizeof(keystates));
+
+    std::vector<long long> tickNs(ticks); // Per-tick duration in nanoseconds
+    int step = 0;
+    int stepTick = 0;
+
+    std::cout << "Headless run: " << ticks << " ticks";
+    if (gBallPool.count > 0) std::cout << ", " << gBallPool.count << " pool balls";
+    std::cout << std::endl;
+
+    auto runStart = std::chrono::steady_clock::now();
+    for (long t = 0; t < ticks; ++t) {
+        // 1. Feed the scripted (or replayed) input
+        TickInput input;
+        if (gInputLog.replaying) {
+            if (!input_log_read(input)) {
+                ticks = t;
+                tickNs.resize(t);
+                break;
             }
+        } else {
+            input = script_input(HEADLESS_SCRIPT[step].input, stepTick == 0);
+        }
+        if (gInputLog.recording) input_log_write(input);
+        apply_tick_input(input, keystates);
 
-            // Check 4b: Player vs. Bottom of Screen (Loss Condition)
-            if (gPlayerY + PLAYER_HEIGHT >= SCREEN_HEIGHT) {
-                gPlayerY = SCREEN_HEIGHT - PLAYER_HEIGHT; // Snap to floor
-                gPlayerVelY = 0.0;
-                gIsOnGround = true;
-                
-                // Loss condition: player touches the lowest point (floor)
-                gPlatformLoss = true;
+        // 2. Run one timed tick
+        auto tickStart = std::chrono::steady_clock::now();
+        save_previous_state();
+        update_state(keystates);
+        auto tickEnd = std::chrono::steady_clock::now();
+        tickNs[t] = std::chrono::duration_cast<std::chrono::nanoseconds>(tickEnd - tickStart).count();
+
+        // 3. Advance the script
+        if (++stepTick >= HEADLESS_SCRIPT[step].ticks) {
+            stepTick = 0;
+            step = (step + 1) % HEADLESS_SCRIPT_LENGTH;
+        }
+    }
+    auto runEnd = std::chrono::steady_clock::now();
+    if (ticks == 0) {
+        input_log_close(0);
+        return 1;
+    }
+
+    double seconds = std::chrono::duration<double>(runEnd - runStart).count();
+    long long totalNs = 0;
+    for (long t = 0; t < ticks; ++t) totalNs += tickNs[t];
+    std::sort(tickNs.begin(), tickNs.end());
+
+    std::cout << "  wall time:  " << seconds << " s" << std::endl;
+    std::cout << "  ticks/sec:  " << (long long)(ticks / seconds) << std::endl;
+    std::cout << "  ns/tick:    mean " << totalNs / ticks
+              << "  p50 " << percentile(tickNs, 50)
+              << "  p90 " << percentile(tickNs, 90)
+              << "  p99 " << percentile(tickNs, 99)
+              << "  p99.9 " << percentile(tickNs, 99.9)
+              << "  max " << tickNs.back() << std::endl;
+    std::cout << "  final state: score " << gState.score
+              << ", player (" << gState.players[0].x << ", " << gState.players[0].y << ")"
+              << ", ball (" << gState.ballX << ", " << gState.ballY << ")" << std::endl;
+    if (gBallPool.count > 0) {
+        std::cout << "  pool checksum: " << std::hex << ball_pool_checksum() << std::dec << std::endl;
+    }
+    std::cout << "  state checksum: " << std::hex << game_state_checksum() << std::dec << std::endl;
+    print_collision_stats();
+    return input_log_close(game_state_checksum()) ? 0 : 1;
+}
+
+/**
+ * @brief Stress sweep: doubles the pool size until a tick no longer fits in the
+ *        gTickMs budget, and reports the largest ball count that still does.
+ */
+int run_stress_sweep() {
+#if defined(USE_AVX2)
+    const char* integrator = "AVX2";
+#elif defined(USE_SSE2)
+    const char* integrator = "SSE2";
+#else
+    const char* integrator = "scalar";
+#endif
+    std::cout << "Stress sweep (" << integrator << " integrator, ball collisions "
+              << (gBallCollisions ? "on" : "off") << "), tick budget "
+              << gTickMs << " ms at " << gSimHz << " Hz" << std::endl;
+
+    Uint8 keystates[SDLK_LAST];
+    memset(keystates, 0, sizeof(keystates));
+    std::vector<long long> tickNs;
+    tickNs.reserve(STRESS_SWEEP_TICKS);
+    int sustained = 0;
+
+    for (int count = STRESS_SWEEP_START; count <= STRESS_MAX_BALLS; count *= 2) {
+        seed_game_random(HEADLESS_SEED);
+        if (!ball_pool_create(count)) break;
+
+        // Stop early once the run as a whole can no longer fit the budget
+        double budgetNs = gTickMs * 1e6 * STRESS_SWEEP_TICKS;
+        double spentNs = 0.0;
+        bool overBudget = false;
+        tickNs.clear();
+        for (int t = 0; t < STRESS_SWEEP_TICKS && !overBudget; ++t) {
+            auto tickStart = std::chrono::steady_clock::now();
+            update_state(keystates);
+            auto tickEnd = std::chrono::steady_clock::now();
+            tickNs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(tickEnd - tickStart).count());
+            spentNs += tickNs.back();
+            overBudget = spentNs > budgetNs;
+        }
+        std::sort(tickNs.begin(), tickNs.end());
+
+        double p99Ms = percentile(tickNs, 99) / 1e6;
+        std::cout << "  " << count << " balls: p50 " << percentile(tickNs, 50) / 1e6
+                  << " ms, p99 " << p99Ms << " ms, "
+                  << percentile(tickNs, 50) / (double)count << " ns/ball" << std::endl;
+        if (overBudget || p99Ms > gTickMs) break;
+        sustained = count;
+    }
+    ball_pool_destroy();
+
+    std::cout << "Sustains " << gSimHz << " Hz with " << sustained << " pool balls";
+    if (sustained == STRESS_MAX_BALLS) std::cout << " (sweep limit)";
+    std::cout << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Queues random streams of mouse motion mixed with button and key events
+ *        (up to two batches' worth) and checks that handle_events() leaves the
+ *        last queued position in gPendingInput, flags the move, and takes every
+ *        event.
+ * @return 0 if it always does, 1 otherwise.
+ */
+int run_motion_check() {
+    // The dummy video driver gives SDL an event queue without opening a window
+    SDL_putenv("SDL_VIDEODRIVER=dummy");
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        std::cerr << "ERROR: SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+    srand(HEADLESS_SEED);
+
+    int failures = 0;
+    for (int round = 0; round < MOTION_CHECK_ROUNDS; ++round) {
+        TickInput start = {0, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2};
+        gPendingInput = start;
+        int expectedX = start.mouseX;
+        int expectedY = start.mouseY;
+        bool expectMoved = false;
+
+        // 1. Queue the stream; presses carry a position too, releases and keys don't
+        int count = round % (2 * EVENT_BATCH) + 1;
+        for (int i = 0; i < count; ++i) {
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            int kind = rand() % 4;
+            if (kind == 0) {
+                event.type = SDL_MOUSEBUTTONDOWN;
+                event.button.button = SDL_BUTTON_LEFT;
+                event.button.x = (Uint16)(rand() % SCREEN_WIDTH);
+                event.button.y = (Uint16)(rand() % SCREEN_HEIGHT);
+                expectedX = event.button.x;
+                expectedY = event.button.y;
+            } else if (kind == 1) {
+                event.type = (i % 2 == 0) ? SDL_MOUSEBUTTONUP : SDL_KEYDOWN;
+                event.button.button = SDL_BUTTON_LEFT;
+                event.key.keysym.sym = SDLK_a;
+            } else {
+                event.type = SDL_MOUSEMOTION;
+                event.motion.x = (Uint16)(rand() % SCREEN_WIDTH);
+                event.motion.y = (Uint16)(rand() % SCREEN_HEIGHT);
+                expectedX = event.motion.x;
+                expectedY = event.motion.y;
+                expectMoved = true;
             }
+            SDL_PushEvent(&event);
         }
-    } // END PLATFORMER MODE
 
-    // --- Screen Boundary Check (Player) ---
-    if (gPlayerX < 0) gPlayerX = 0;
-    else if (gPlayerX + PLAYER_WIDTH > SCREEN_WIDTH) gPlayerX = SCREEN_WIDTH - PLAYER_WIDTH;
-    if (!gGravityOn) {
-        if (gPlayerY < 0) gPlayerY = 0;
-        else if (gPlayerY + PLAYER_HEIGHT > SCREEN_HEIGHT) gPlayerY = SCREEN_HEIGHT - PLAYER_HEIGHT;
+        // 2. One frame's worth of event handling must take all of it
+        bool running = true;
+        handle_events(running);
+        SDL_Event left;
+        bool moved = (gPendingInput.flags & INPUT_MOUSE_MOVED) != 0;
+        if (gPendingInput.mouseX != expectedX || gPendingInput.mouseY != expectedY || moved != expectMoved ||
+            SDL_PeepEvents(&left, 1, SDL_PEEKEVENT, SDL_ALLEVENTS) != 0) {
+            failures++;
+        }
     }
-    
-    // --- Ball Physics (Applies in both modes) ---
-    update_ball_physics();
-    
-    // --- Target Collision & Scoring Check (applies in both modes) ---
-    SDL_Rect playerBox = {(Sint16)gPlayerX, (Sint16)gPlayerY, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
-    // The target box uses the defined constants for collision area
-    SDL_Rect targetBox = {(Sint16)gTargetX, (Sint16)gTargetY, (Uint16)TARGET_WIDTH, (Uint16)TARGET_HEIGHT}; 
-    
-    bool wasColliding = gTargetColliding; 
-    gTargetColliding = check_collision(playerBox, targetBox);
-    
-    if (gTargetColliding && !wasColliding) { 
-        gScore++;
-        move_target_randomly(); 
+    SDL_Quit();
+
+    std::cout << "Mouse motion: " << MOTION_CHECK_ROUNDS << " queued event streams handled, "
+              << failures << " ended with a stale position or events left over" << std::endl;
+    if (failures != 0) {
+        std::cerr << "ERROR: handle_events() loses queued mouse motion!" << std::endl;
+        return 1;
     }
+    return 0;
 }
 
 /**
- * @brief Clears the screen and draws all game elements.
+ * @brief Jumps once off the platform in gravity mode at each of JUMP_CHECK_RATES
+ *        and checks that every jump peaks within 1 px of the first rate's and
+ *        lands back on the platform.
+ * @return 0 if they all do, 1 otherwise.
  */
-void render_scene() {
-    // 1. Clear the screen (Fill with black)
-    Uint32 black = SDL_MapRGB(gScreen->format, 0, 0, 0);
-    SDL_FillRect(gScreen, NULL, black);
+int run_jump_check() {
+    const int rateCount = sizeof(JUMP_CHECK_RATES) / sizeof(JUMP_CHECK_RATES[0]);
+    const PlayerKeys& keys = PLAYER_KEYS[0];
+    PlayerState& player = gState.players[0];
+    int firstPeak = 0;
+    bool agree = true;
+    std::cout << "Jump height by --sim-hz:" << std::endl;
+    for (int r = 0; r < rateCount; ++r) {
+        int hz = JUMP_CHECK_RATES[r];
+        set_sim_rate(hz);
+        gState.gravityOn = true;
+        gState.platformLoss = false;
+        place_players(PLATFORM_X, PLATFORM_Y - PLAYER_HEIGHT);
+        player.onGround = true;
 
-    // 2. Draw the Sign Image (Background element)
-    if (gSignSurface != NULL) {
-        SDL_Rect destRect = {(Sint16)((SCREEN_WIDTH - gSignSurface->w) / 2), (Sint16)((SCREEN_HEIGHT - gSignSurface->h) / 2), 0, 0}; 
-        SDL_BlitSurface(gSignSurface, NULL, gScreen, &destRect);
+        // Up for the first tick only, then fall until landed (a second at most)
+        Uint8 keystates[SDLK_LAST];
+        memset(keystates, 0, sizeof(keystates));
+        keystates[keys.up] = 1;
+        int startY = player.y;
+        int top = player.y;
+        for (int tick = 0; tick < hz; ++tick) {
+            update_player(player, keys, keystates);
+            keystates[keys.up] = 0;
+            top = std::min(top, player.y);
+            if (player.onGround) break;
+        }
+        int peak = startY - top;
+        bool landed = player.onGround && player.y == startY;
+        if (r == 0) firstPeak = peak;
+        if (std::abs(peak - firstPeak) > 1 || !landed) agree = false;
+        std::cout << "  " << hz << " Hz: " << peak << " px" << (landed ? "" : ", did not land back on the platform") << std::endl;
     }
+    set_sim_rate(SIM_TICKS_PER_SECOND);
 
-    // 3. Draw the pre-rendered text image (e.g., "SDL 1998")
-    if (gTextSurface != NULL) {
-        SDL_Rect destRect = {20, 20, 0, 0}; 
-        SDL_BlitSurface(gTextSurface, NULL, gScreen, &destRect);
+    if (!agree) {
+        std::cerr << "ERROR: Jumps differ by more than 1 px between simulation rates!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Makes a random box for the collision benchmark, partly off screen at times.
+ */
+SDL_Rect random_box() {
+    SDL_Rect box = {(Sint16)(rand() % 800 - 100), (Sint16)(rand() % 640 - 100),
+                    (Uint16)(rand() % 121), (Uint16)(rand() % 121)};
+    return box;
+}
+
+/**
+ * @brief Checks collide_box_batch() against check_collision() on random boxes
+ *        (every batch size from 1 to 32), then times both on the same data.
+ * @return 0 if the two agree everywhere, 1 otherwise.
+ */
+int run_collision_bench() {
+#if defined(USE_AVX2)
+    const char* kernel = "AVX2";
+#elif defined(USE_SSE2)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    srand(HEADLESS_SEED);
+
+    std::vector<SDL_Rect> rects(COLLISION_BENCH_BOXES);
+    std::vector<int> x(COLLISION_BENCH_BOXES), y(COLLISION_BENCH_BOXES);
+    std::vector<int> w(COLLISION_BENCH_BOXES), h(COLLISION_BENCH_BOXES);
+    for (int i = 0; i < COLLISION_BENCH_BOXES; ++i) {
+        rects[i] = random_box();
+        x[i] = rects[i].x;
+        y[i] = rects[i].y;
+        w[i] = rects[i].w;
+        h[i] = rects[i].h;
     }
-    
-    // 4. Draw Gravity Button and Retry Button
 
-    if (gGravityOn && gPlatformLoss) {
-        // Draw the Retry Button only if gravity is on AND we lost
-        if (gButtonRetrySurface != NULL) {
-            SDL_Rect retryDest = {RETRY_BUTTON_X, RETRY_BUTTON_Y, 0, 0}; // Dimensions handled by blit
-            SDL_BlitSurface(gButtonRetrySurface, NULL, gScreen, &retryDest);
+    // 1. Cross-check against the scalar reference
+    long long checked = 0;
+    long long mismatches = 0;
+    for (int trial = 0; trial < COLLISION_BENCH_ROUNDS; ++trial) {
+        SDL_Rect a = random_box();
+        int count = trial % 32 + 1;
+        for (int first = 0; first + count <= COLLISION_BENCH_BOXES; first += count) {
+            Uint32 mask = collide_box_batch(a.x, a.y, a.w, a.h, &x[first], &y[first], &w[first], &h[first], count);
+            for (int i = 0; i < 32; ++i) {
+                bool expected = i < count && check_collision(a, rects[first + i]);
+                if (expected != (((mask >> i) & 1) != 0)) mismatches++;
+            }
+            checked += count;
         }
     }
-    
-    // Draw the Toggle Button (but only if NOT in loss state, so player must retry first)
-    if (!gPlatformLoss) {
-        SDL_Surface* currentButton = gGravityOn ? gButtonOnSurface : gButtonOffSurface;
-        if (currentButton != NULL) {
-            // Use the new TOGGLE button constants for drawing
-            SDL_Rect buttonDest = {TOGGLE_BUTTON_X, TOGGLE_BUTTON_Y, 0, 0}; 
-            SDL_BlitSurface(currentButton, NULL, gScreen, &buttonDest);
+    std::cout << "Collision kernel (" << kernel << "): " << checked << " pairs cross-checked against check_collision, "
+              << mismatches << " mismatches" << std::endl;
+
+    // 2. Time one box against the whole array, scalar vs. batched
+    SDL_Rect probe = random_box();
+    long long scalarHits = 0;
+    auto scalarStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < COLLISION_BENCH_ROUNDS; ++round) {
+        probe.x = (Sint16)(round % 640);
+        for (int i = 0; i < COLLISION_BENCH_BOXES; ++i) {
+            scalarHits += check_collision(probe, rects[i]);
+        }
+    }
+    auto scalarEnd = std::chrono::steady_clock::now();
+
+    long long batchHits = 0;
+    auto batchStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < COLLISION_BENCH_ROUNDS; ++round) {
+        probe.x = (Sint16)(round % 640);
+        for (int first = 0; first < COLLISION_BENCH_BOXES; first += 32) {
+            Uint32 mask = collide_box_batch(probe.x, probe.y, probe.w, probe.h, &x[first], &y[first], &w[first], &h[first], 32);
+            while (mask != 0) {
+                batchHits++;
+                mask &= mask - 1;
+            }
         }
     }
+    auto batchEnd = std::chrono::steady_clock::now();
+
+    double pairs = (double)COLLISION_BENCH_ROUNDS * COLLISION_BENCH_BOXES;
+    double scalarNs = std::chrono::duration<double, std::nano>(scalarEnd - scalarStart).count() / pairs;
+    double batchNs = std::chrono::duration<double, std::nano>(batchEnd - batchStart).count() / pairs;
+    std::cout << "  check_collision:   " << scalarNs << " ns/pair (" << scalarHits << " hits)" << std::endl;
+    std::cout << "  collide_box_batch: " << batchNs << " ns/pair (" << batchHits << " hits), "
+              << scalarNs / batchNs << "x faster" << std::endl;
+
+    if (mismatches != 0 || scalarHits != batchHits) {
+        std::cerr << "ERROR: collide_box_batch disagrees with check_collision!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Draws the sprites at random, partly off-screen spots under random clip
+ *        rects with both SDL_BlitSurface and blit_colorkey_32() and checks the
+ *        two results match pixel for pixel, then times both on a full sprite set.
+ * @return 0 if the two agree everywhere, 1 otherwise.
+ */
+int run_blit_bench() {
+#if defined(USE_AVX2)
+    const char* kernel = "AVX2";
+#elif defined(USE_SSE2)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    srand(HEADLESS_SEED);
 
+    // Two screen-sized targets in the display layout, and the sprites on atlas pages
+    SDL_Surface* sdlTarget = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, 32, ASSET_PACK_RMASK, ASSET_PACK_GMASK, ASSET_PACK_BMASK, 0);
+    SDL_Surface* fastTarget = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, 32, ASSET_PACK_RMASK, ASSET_PACK_GMASK, ASSET_PACK_BMASK, 0);
+    if (sdlTarget == NULL || fastTarget == NULL) return 1;
+    Uint32 colorKey = SDL_MapRGB(sdlTarget->format, TRANSPARENCY_R, TRANSPARENCY_G, TRANSPARENCY_B);
 
-    // 5. Draw Platform (if Gravity is ON)
-    if (gGravityOn) {
-        SDL_Surface* currentPlatform = gPlatformSurface;
-        if (gPlatformLoss && gPlatformLoseSurface != NULL) {
-            currentPlatform = gPlatformLoseSurface; // Switch to loss texture
+    Atlas atlas;
+    memset(&atlas, 0, sizeof(atlas));
+    atlas.openPage = -1;
+    Sprite sprites[SPRITE_COUNT];
+    long long spritePixels = 0;
+    for (int id = 0; id < SPRITE_COUNT; ++id) {
+        const SpriteSource& source = SPRITE_SOURCES[id];
+        SDL_Surface* loaded = SDL_LoadBMP(source.file);
+        SDL_Surface* converted = loaded != NULL ? SDL_ConvertSurface(loaded, sdlTarget->format, SDL_SWSURFACE) : NULL;
+        if (loaded != NULL) SDL_FreeSurface(loaded);
+        Uint32 spriteKey = SDL_MapRGB(sdlTarget->format, source.keyR, source.keyG, source.keyB);
+        bool added = converted != NULL && atlas_add(atlas, converted, spriteKey, colorKey, sprites[id].page, sprites[id].source);
+        if (converted != NULL) SDL_FreeSurface(converted);
+        if (!added) {
+            std::cerr << "ERROR: Failed to load " << source.file << " for the blit benchmark!" << std::endl;
+            atlas_free(atlas);
+            SDL_FreeSurface(sdlTarget);
+            SDL_FreeSurface(fastTarget);
+            return 1;
         }
+        spritePixels += sprites[id].source.w * sprites[id].source.h;
+    }
 
-        // To visualize the new, larger collision area, we draw a filled rect as a placeholder:
-        SDL_Rect platformDest = {PLATFORM_X, PLATFORM_Y, PLATFORM_WIDTH, PLATFORM_HEIGHT};
-        Uint32 platformColor = SDL_MapRGB(gScreen->format, 100, 100, 100); // Dark gray fill
-        SDL_FillRect(gScreen, &platformDest, platformColor);
-        
-        if (currentPlatform != NULL) {
-            // We draw the original platform image over the top-left of the filled rectangle for visual context.
-            SDL_Rect imageDest = {PLATFORM_X, PLATFORM_Y, 0, 0};
-            SDL_BlitSurface(currentPlatform, NULL, gScreen, &imageDest);
+    // 1. Cross-check against SDL on the same noisy background
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        Uint32* row = (Uint32*)((Uint8*)sdlTarget->pixels + y * sdlTarget->pitch);
+        for (int x = 0; x < SCREEN_WIDTH; ++x) row[x] = ((Uint32)rand() << 8 ^ (Uint32)rand()) & 0x00FFFFFF;
+        memcpy((Uint8*)fastTarget->pixels + y * fastTarget->pitch, row, SCREEN_WIDTH * 4);
+    }
+    long long fallbacks = 0;
+    for (int trial = 0; trial < BLIT_BENCH_PLACEMENTS; ++trial) {
+        const Sprite& sprite = sprites[trial % SPRITE_COUNT];
+        int x = rand() % (SCREEN_WIDTH + sprite.source.w) - sprite.source.w;
+        int y = rand() % (SCREEN_HEIGHT + sprite.source.h) - sprite.source.h;
+        if (trial % 4 == 0) {
+            // Dirty rect rendering draws under a clip rect
+            SDL_Rect clip = {(Sint16)(rand() % SCREEN_WIDTH), (Sint16)(rand() % SCREEN_HEIGHT),
+                             (Uint16)(rand() % SCREEN_WIDTH), (Uint16)(rand() % SCREEN_HEIGHT)};
+            SDL_SetClipRect(sdlTarget, &clip);
+            SDL_SetClipRect(fastTarget, &clip);
         }
+        SDL_Rect source = sprite.source;
+        SDL_Rect dest = {(Sint16)x, (Sint16)y, 0, 0};
+        SDL_BlitSurface(atlas.pages[sprite.page], &source, sdlTarget, &dest);
+        if (!blit_colorkey_32(atlas.pages[sprite.page], sprite.source, fastTarget, x, y)) fallbacks++;
+        SDL_SetClipRect(sdlTarget, NULL);
+        SDL_SetClipRect(fastTarget, NULL);
+    }
+    long long mismatches = 0;
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        const Uint32* a = (const Uint32*)((const Uint8*)sdlTarget->pixels + y * sdlTarget->pitch);
+        const Uint32* b = (const Uint32*)((const Uint8*)fastTarget->pixels + y * fastTarget->pitch);
+        for (int x = 0; x < SCREEN_WIDTH; ++x) mismatches += a[x] != b[x];
     }
+    std::cout << "Colorkey blitter (" << kernel << "): " << BLIT_BENCH_PLACEMENTS << " clipped blits compared against SDL_BlitSurface, "
+              << mismatches << " pixels differ" << std::endl;
 
-    // 6. Draw Player Image based on direction
-    SDL_Surface* currentSurface = NULL;
-    if (gPlayerDirection == PLAYER_FACING_RIGHT && gPlayerRightSurface != NULL) {
-        currentSurface = gPlayerRightSurface;
-    } else if (gPlayerDirection == PLAYER_FACING_LEFT && gPlayerLeftSurface != NULL) {
-        currentSurface = gPlayerLeftSurface;
+    // 2. Time the whole sprite set, drawn on screen, with each blitter
+    auto sdlStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < BLIT_BENCH_ROUNDS; ++round) {
+        for (int id = 0; id < SPRITE_COUNT; ++id) {
+            SDL_Rect source = sprites[id].source;
+            SDL_Rect dest = {(Sint16)(round % 16), (Sint16)(round % 16), 0, 0};
+            SDL_BlitSurface(atlas.pages[sprites[id].page], &source, sdlTarget, &dest);
+        }
     }
-    
-    if (currentSurface != NULL) {
-        SDL_Rect playerDest = {(Sint16)gPlayerX, (Sint16)gPlayerY, 0, 0};
-        SDL_BlitSurface(currentSurface, NULL, gScreen, &playerDest);
-    } else {
-        SDL_Rect playerBox = {(Sint16)gPlayerX, (Sint16)gPlayerY, (Uint16)PLAYER_WIDTH, (Uint16)PLAYER_HEIGHT};
-        Uint32 fallbackRed = SDL_MapRGB(gScreen->format, 255, 0, 0);
-        SDL_FillRect(gScreen, &playerBox, fallbackRed);
+    auto sdlEnd = std::chrono::steady_clock::now();
+
+    auto fastStart = std::chrono::steady_clock::now();
+    for (int round = 0; round < BLIT_BENCH_ROUNDS; ++round) {
+        for (int id = 0; id < SPRITE_COUNT; ++id) {
+            blit_colorkey_32(atlas.pages[sprites[id].page], sprites[id].source, fastTarget, round % 16, round % 16);
+        }
     }
+    auto fastEnd = std::chrono::steady_clock::now();
 
+    double pixels = (double)BLIT_BENCH_ROUNDS * spritePixels;
+    double sdlNs = std::chrono::duration<double, std::nano>(sdlEnd - sdlStart).count() / pixels;
+    double fastNs = std::chrono::duration<double, std::nano>(fastEnd - fastStart).count() / pixels;
+    std::cout << "  SDL_BlitSurface:  " << sdlNs << " ns/pixel" << std::endl;
+    std::cout << "  blit_colorkey_32: " << fastNs << " ns/pixel, " << sdlNs / fastNs << "x faster" << std::endl;
 
-    // 7. Draw Target Image (Replaces Blue/Yellow Box)
-    if (gTargetSurface != NULL) {
-        // Draw the target image. The collision area is still based on TARGET_WIDTH/HEIGHT constants.
-        SDL_Rect targetDest = {(Sint16)gTargetX, (Sint16)gTargetY, 0, 0};
-        SDL_BlitSurface(gTargetSurface, NULL, gScreen, &targetDest);
-        
-    } else {
-        // Fallback (original blue box drawing) if the target image fails to load
-        SDL_Rect blueBox = {(Sint16)gTargetX, (Sint16)gTargetY, (Uint16)TARGET_WIDTH, (Uint16)TARGET_HEIGHT};
-        Uint32 fallbackBlue = SDL_MapRGB(gScreen->format, 0, 0, 255);
-        SDL_FillRect(gScreen, &blueBox, fallbackBlue);
+    atlas_free(atlas);
+    SDL_FreeSurface(sdlTarget);
+    SDL_FreeSurface(fastTarget);
+    if (mismatches != 0 || fallbacks != 0) {
+        std::cerr << "ERROR: blit_colorkey_32 disagrees with SDL_BlitSurface!" << std::endl;
+        return 1;
     }
-    
-    // 8. Draw Beachball
-    if (gBallSurface != NULL) {
-        SDL_Rect ballDest = {(Sint16)gBallX, (Sint16)gBallY, 0, 0};
-        SDL_BlitSurface(gBallSurface, NULL, gScreen, &ballDest);
+    return 0;
+}
+
+/**
+ * @brief Keeps the particle pool full and times the update per particle, then
+ *        draws a full pool into an off-screen target with and without the
+ *        per-frame budget.
+ */
+int run_particle_bench() {
+#if defined(USE_AVX2)
+    const char* kernel = "AVX2";
+#elif defined(USE_SSE2)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    SDL_Surface* target = SDL_CreateRGBSurface(SDL_SWSURFACE, SCREEN_WIDTH, SCREEN_HEIGHT, 32, ASSET_PACK_RMASK, ASSET_PACK_GMASK, ASSET_PACK_BMASK, 0);
+    if (target == NULL || !particle_pool_create(PARTICLE_CAPACITY)) return 1;
+    gParticles.random = HEADLESS_SEED;
+
+    // 1. Update, topping the pool up with bursts all over the screen before each tick
+    long long updated = 0;
+    double updateMs = 0.0;
+    for (int tick = 0; tick < PARTICLE_BENCH_TICKS; ++tick) {
+        while (gParticles.count < gParticles.capacity) {
+            float x = (particle_random() * 0.5f + 0.5f) * SCREEN_WIDTH;
+            float y = (particle_random() * 0.5f + 0.5f) * SCREEN_HEIGHT;
+            emit_particles(x, y, PARTICLE_SCORE_BURST, 0.0f, -2.0f, PARTICLE_SCORE_SPREAD, tick % PARTICLE_COLOR_COUNT);
+        }
+        updated += gParticles.count;
+        auto start = std::chrono::steady_clock::now();
+        update_particles();
+        updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
     }
-    
+    std::cout << "Particle update (" << kernel << "): " << updateMs * 1e6 / updated << " ns/particle, "
+              << updateMs * 1000.0 / PARTICLE_BENCH_TICKS << " us/tick for " << gParticles.capacity << " particles" << std::endl;
 
-    // 9. Draw the Cursor Follower (Foreground element)
-    SDL_Surface* currentCursor = NULL;
-    
-    // Select the cursor image based on whether the mouse button is down
-    if (gIsMouseDown && gCursorClickSurface != NULL) {
-        currentCursor = gCursorClickSurface;
-    } else if (gCursorSurface != NULL) {
-        currentCursor = gCursorSurface;
+    // 2. Draw the last state, all of it and within the budget
+    const int budgets[] = {gParticles.count, PARTICLE_DRAW_BUDGET};
+    for (int b = 0; b < 2; ++b) {
+        SDL_Rect area;
+        long long drawn = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < PARTICLE_BENCH_FRAMES; ++frame) {
+            drawn += draw_particles(target, gParticles, 0.5, 0, 0, budgets[b], area);
+        }
+        double frameUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / PARTICLE_BENCH_FRAMES;
+        std::cout << "  draw " << gParticles.count << " alive, budget " << budgets[b] << ": " << frameUs << " us/frame ("
+                  << drawn / PARTICLE_BENCH_FRAMES << " drawn)" << std::endl;
     }
-    
-    if (currentCursor != NULL) {
-        // gFollowerX/Y are calculated to center the cursor image
-        SDL_Rect followerDest = {(Sint16)gFollowerX, (Sint16)gFollowerY, 0, 0}; 
-        SDL_BlitSurface(currentCursor, NULL, gScreen, &followerDest);
+
+    particle_pool_destroy();
+    SDL_FreeSurface(target);
+    return 0;
+}
+
+/**
+ * @brief Runs the same stress scene with 1..maxThreads physics threads, timing
+ *        each and checking that every thread count ends in the same pool state.
+ * @return 0 if all runs matched the single-threaded result bit for bit.
+ */
+int run_thread_bench(int maxThreads, int balls) {
+    std::cout << "Thread scaling: " << balls << " pool balls, ball collisions "
+              << (gBallCollisions ? "on" : "off") << ", " << STRESS_SWEEP_TICKS << " ticks" << std::endl;
+
+    Uint8 keystates[SDLK_LAST];
+    memset(keystates, 0, sizeof(keystates));
+    double baseMs = 0.0;
+    Uint32 baseChecksum = 0;
+    bool allMatch = true;
+
+    for (int threads = 1; threads <= maxThreads; ++threads) {
+        reset_game_state();
+        seed_game_random(HEADLESS_SEED);
+        if (!ball_pool_create(balls) || !job_system_start(threads)) return 1;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < STRESS_SWEEP_TICKS; ++t) {
+            save_previous_state();
+            update_state(keystates);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / STRESS_SWEEP_TICKS;
+
+        Uint32 checksum = ball_pool_checksum();
+        if (threads == 1) {
+            baseMs = ms;
+            baseChecksum = checksum;
+        }
+        bool match = checksum == baseChecksum;
+        allMatch = allMatch && match;
+        std::cout << "  " << threads << " thread(s): " << ms << " ms/tick, " << baseMs / ms << "x, "
+                  << gJobs.steals << " steals, checksum " << std::hex << checksum << std::dec
+                  << (match ? "" : " MISMATCH") << std::endl;
+        job_system_stop();
+    }
+    ball_pool_destroy();
+
+    if (!allMatch) {
+        std::cerr << "ERROR: multi-threaded physics diverged from the single-threaded result!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints how long the simulation ticks took during the session.
+ */
+void print_sim_stats() {
+    if (gSimStats.ticks == 0) return;
+
+    std::cout << "Sim stats: " << gSimStats.ticks << " ticks";
+    if (gBallPool.count > 0) std::cout << " with " << gBallPool.count << " pool balls";
+    std::cout << ", avg " << gSimStats.totalMs / gSimStats.ticks << " ms/tick, worst "
+              << gSimStats.worstMs << " ms (budget " << gTickMs << " ms at " << gSimHz << " Hz)" << std::endl;
+    std::cout << "  rewind ring: " << gRewind.capacity << " x " << sizeof(GameState) << "-byte states ("
+              << REWIND_SECONDS << " s), " << gRewind.rewound << " ticks rewound" << std::endl;
+}
+
+/**
+ * @brief Parses the command line. Returns false (after printing usage) on bad input.
+ */
+bool parse_args(int argc, char* args[], LaunchOptions& options) {
+    options.headless = false;
+    options.headlessTicks = HEADLESS_DEFAULT_TICKS;
+    options.dirtyRects = false;
+    options.looseAssets = false;
+    options.buildPack = false;
+    options.stressBalls = 0;
+    options.stressSweep = false;
+    options.ballCollisions = true;
+    options.collisionBench = false;
+    options.blitBench = false;
+    options.motionCheck = false;
+    options.jumpCheck = false;
+    options.renderThread = false;
+    options.noAudio = false;
+    options.threads = 1;
+    options.simHz = SIM_TICKS_PER_SECOND;
+    options.threadBench = false;
+    options.recordPath = NULL;
+    options.replayPath = NULL;
+    options.levelPath = NULL;
+    options.buildLevelPath = NULL;
+    options.levelBench = false;
+    options.particleBench = false;
+    options.hotReload = false;
+    options.hostPort = 0;
+    options.joinAddress = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = args[i];
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--ticks" && i + 1 < argc) {
+            options.headlessTicks = atol(args[++i]);
+        } else if (arg == "--dirty-rects") {
+            options.dirtyRects = true;
+        } else if (arg == "--loose-assets") {
+            options.looseAssets = true;
+        } else if (arg == "--build-pack") {
+            options.buildPack = true;
+        } else if (arg == "--stress" && i + 1 < argc) {
+            options.stressBalls = atoi(args[++i]);
+        } else if (arg == "--stress-sweep") {
+            options.stressSweep = true;
+        } else if (arg == "--no-ball-collisions") {
+            options.ballCollisions = false;
+        } else if (arg == "--collision-bench") {
+            options.collisionBench = true;
+        } else if (arg == "--blit-bench") {
+            options.blitBench = true;
+        } else if (arg == "--motion-check") {
+            options.motionCheck = true;
+        } else if (arg == "--jump-check") {
+            options.jumpCheck = true;
+        } else if (arg == "--render-thread") {
+            options.renderThread = true;
+        } else if (arg == "--no-audio") {
+            options.noAudio = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = atoi(args[++i]);
+        } else if (arg == "--sim-hz" && i + 1 < argc) {
+            options.simHz = atoi(args[++i]);
+        } else if (arg == "--thread-bench") {
+            options.threadBench = true;
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.recordPath = args[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            options.replayPath = args[++i];
+        } else if (arg == "--level" && i + 1 < argc) {
+            options.levelPath = args[++i];
+        } else if (arg == "--build-level" && i + 1 < argc) {
+            options.buildLevelPath = args[++i];
+        } else if (arg == "--level-bench") {
+            options.levelBench = true;
+        } else if (arg == "--particle-bench") {
+            options.particleBench = true;
+        } else if (arg == "--hot-reload") {
+            options.hotReload = true;
+        } else if (arg == "--host" && i + 1 < argc) {
+            options.hostPort = atoi(args[++i]);
+            if (options.hostPort <= 0 || options.hostPort > 65535) {
+                std::cerr << "--host needs a UDP port between 1 and 65535" << std::endl;
+                return false;
+            }
+        } else if (arg == "--join" && i + 1 < argc) {
+            options.joinAddress = args[++i];
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            std::cerr << "Usage: game_core [--dirty-rects] [--render-thread] [--no-audio] [--loose-assets] [--hot-reload] [--build-pack] [--level FILE] [--build-level FILE] [--stress BALLS [--no-ball-collisions]] [--headless [--ticks N]] [--record FILE | --replay FILE] [--host PORT | --join ADDRESS:PORT] [--threads N] [--sim-hz N] [--stress-sweep] [--collision-bench] [--blit-bench] [--motion-check] [--jump-check] [--level-bench] [--particle-bench] [--thread-bench]" << std::endl;
+            return false;
+        }
     }
 
-    // 10. Update the Screen
-    if (SDL_Flip(gScreen) == -1) {
-        std::cerr << "SDL_Flip failed!" << std::endl;
+    if (options.headlessTicks <= 0) {
+        std::cerr << "--ticks must be positive" << std::endl;
+        return false;
+    }
+    if (options.stressBalls < 0 || options.stressBalls > STRESS_MAX_BALLS) {
+        std::cerr << "--stress must be between 0 and " << STRESS_MAX_BALLS << std::endl;
+        return false;
+    }
+    if (options.threads < 1 || options.threads > MAX_WORKER_THREADS) {
+        std::cerr << "--threads must be between 1 and " << MAX_WORKER_THREADS << std::endl;
+        return false;
+    }
+    if (options.simHz < MIN_SIM_HZ || options.simHz > MAX_SIM_HZ) {
+        std::cerr << "--sim-hz must be between " << MIN_SIM_HZ << " and " << MAX_SIM_HZ << std::endl;
+        return false;
+    }
+    if (options.recordPath != NULL && options.replayPath != NULL) {
+        std::cerr << "--record and --replay can't be combined" << std::endl;
+        return false;
+    }
+    bool networked = options.hostPort != 0 || options.joinAddress != NULL;
+    if (options.hostPort != 0 && options.joinAddress != NULL) {
+        std::cerr << "--host and --join can't be combined" << std::endl;
+        return false;
+    }
+    if (networked && (options.headless || options.recordPath != NULL || options.replayPath != NULL)) {
+        std::cerr << "--host and --join can't be combined with --headless, --record or --replay" << std::endl;
+        return false;
     }
+    return true;
 }
 
 int main(int argc, char* args[]) {
-    srand(time(NULL)); 
+    LaunchOptions options;
+    if (!parse_args(argc, args, options)) {
+        return 1;
+    }
+
+    // A replay brings its own seed and simulation options, and so does the host
+    Uint32 seed = options.headless ? HEADLESS_SEED : (Uint32)time(NULL);
+    if (options.replayPath != NULL) {
+        if (!input_log_replay(options.replayPath, options)) return 1;
+        seed = gInputLog.seed;
+    }
+    if (options.hostPort != 0 || options.joinAddress != NULL) {
+        if (!net_connect(options, seed)) {
+            net_close();
+            return 1;
+        }
+    }
+
+    gBallCollisions = options.ballCollisions;
+    set_sim_rate(options.simHz);
+    register_widgets();
+    if (options.buildPack) {
+        return build_asset_pack(ASSET_PACK_FILE);
+    }
+    if (options.collisionBench) {
+        return run_collision_bench();
+    }
+    if (options.blitBench) {
+        return run_blit_bench();
+    }
+    if (options.motionCheck) {
+        return run_motion_check();
+    }
+    if (options.jumpCheck) {
+        return run_jump_check();
+    }
+    if (options.buildLevelPath != NULL) {
+        return build_synthetic_level(options.buildLevelPath, LEVEL_BUILD_WIDTH, LEVEL_BUILD_HEIGHT) ? 0 : 1;
+    }
+    if (options.levelBench) {
+        return run_level_bench();
+    }
+    if (options.particleBench) {
+        return run_particle_bench();
+    }
+    if (options.threadBench) {
+        int maxThreads = options.threads > 1 ? options.threads : THREAD_BENCH_DEFAULT_MAX;
+        int balls = options.stressBalls > 0 ? options.stressBalls : THREAD_BENCH_DEFAULT_BALLS;
+        return run_thread_bench(maxThreads, balls);
+    }
+    if (!job_system_start(options.threads)) {
+        return 1;
+    }
+    if (options.stressSweep) {
+        int result = run_stress_sweep();
+        job_system_stop();
+        return result;
+    }
+
+    seed_game_random(seed);
+    if (options.recordPath != NULL && !input_log_record(options.recordPath, seed, options)) {
+        return 1;
+    }
+
+    if (options.levelPath != NULL) {
+        if (!level_open(options.levelPath)) return 1;
+        set_world_size(gLevel.width * TILE_SIZE, gLevel.height * TILE_SIZE);
+    }
+
+    if (options.headless) {
+        if (!ball_pool_create(options.stressBalls)) return 1;
+        int result = run_headless(options.headlessTicks);
+        ball_pool_destroy();
+        job_system_stop();
+        level_close();
+        return result;
+    }
+
+    gDirtyRectMode = options.dirtyRects;
+    if (!ball_pool_create(options.stressBalls) || !particle_pool_create(PARTICLE_CAPACITY)) {
+        return 1;
+    }
 
     if (!init()) {
         return 1;
     }
     
-    if (!load_media()) {
+    if (!start_asset_loader(options.looseAssets)) {
+        clean_up();
+        return 1;
+    }
+    if (options.hotReload) {
+        start_hot_reload(); // Without a watcher the game just runs without reloads
+    }
+    if (!options.noAudio) {
+        audio_start(); // Without a device the game just runs silent
+    }
+    if (options.renderThread && !render_thread_start()) {
         clean_up();
         return 1;
     }
 
     bool isRunning = true;
+    Uint32 previousTicks = SDL_GetTicks();
+    double accumulator = 0.0; // Real time not yet consumed by simulation ticks (ms)
+    Uint8 keystates[SDLK_LAST]; // What update_state() sees; filled by apply_tick_input()
+    memset(keystates, 0, sizeof(keystates));
+    bool mediaFailed = false;
+    std::chrono::steady_clock::time_point loopStart = std::chrono::steady_clock::now();
 
     // --- Main Game Loop ---
+    // Fixed-timestep simulation: the sim always advances in gTickMs steps,
+    // independent of how long rendering takes. Rendering interpolates between ticks.
     while (isRunning) {
+        Uint32 frameStart = SDL_GetTicks();
+        double frameMs = frameStart - previousTicks;
+        previousTicks = frameStart;
+        if (frameMs > MAX_FRAME_MS) frameMs = MAX_FRAME_MS;
+        accumulator += frameMs;
+
+        RenderSnapshot& frame = gPipeline.slots[gPipeline.writing];
+        std::chrono::steady_clock::time_point phaseMark = std::chrono::steady_clock::now();
+        frame.inputTime = phaseMark;
+
+        // Swap in the sprites the loader finished since the last frame
+        if (!poll_asset_loader()) {
+            std::cerr << "FATAL: One or more required images failed to load." << std::endl;
+            mediaFailed = true;
+            break;
+        }
+        poll_hot_reload();
+        if (gNet.active && !net_poll()) break;
+        if (gPipeline.videoLock != NULL) SDL_LockMutex(gPipeline.videoLock);
         handle_events(isRunning);
-        update_state(); 
-        SDL_Delay(10); 
-        render_scene();
+        if (gPipeline.videoLock != NULL) SDL_UnlockMutex(gPipeline.videoLock);
+        frame.phaseMs[PHASE_EVENTS] = lap_ms(phaseMark);
+
+        while (accumulator >= gTickMs) {
+            // Live, replayed or networked input for this tick
+            TickInput input;
+            TickInput partner;
+            if (gNet.active) {
+                if (!net_take_inputs(input, partner)) {
+                    accumulator = std::min(accumulator, gTickMs); // Don't race to catch up afterwards
+                    break;
+                }
+                apply_partner_input(partner, keystates);
+            } else if (gInputLog.replaying) {
+                if (!input_log_read(input)) {
+                    isRunning = false; // End of the recording
+                    break;
+                }
+            } else {
+                input = take_live_input(SDL_GetKeyState(NULL));
+                if (gInputLog.recording) input_log_write(input);
+            }
+            apply_tick_input(input, keystates);
+
+            auto tickStart = std::chrono::steady_clock::now();
+            save_previous_state();
+            update_state(keystates);
+            if (gNet.active) net_end_tick();
+            accumulator -= gTickMs;
+
+            double tickMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tickStart).count();
+            gSimStats.ticks++;
+            gSimStats.totalMs += tickMs;
+            gSimStats.worstMs = std::max(gSimStats.worstMs, tickMs);
+        }
+        frame.phaseMs[PHASE_UPDATE] = lap_ms(phaseMark);
+
+        // Draw now, or hand the frame over and go on with the next ticks
+        capture_snapshot(frame, accumulator / gTickMs, gPipeline.thread != NULL);
+        if (gPipeline.thread != NULL) {
+            publish_snapshot();
+        } else {
+            draw_frame(frame);
+        }
+        gPipelineStats.loops++;
+
+        // Don't render faster than needed; give the CPU back instead
+        Uint32 frameTime = SDL_GetTicks() - frameStart;
+        if (frameTime < 1000 / MAX_FRAMES_PER_SECOND) {
+            SDL_Delay(1000 / MAX_FRAMES_PER_SECOND - frameTime);
+        }
     }
 
+    gPipelineStats.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loopStart).count();
+    render_thread_stop();
+    stop_hot_reload();
+    stop_asset_loader();
+    print_startup_stats();
+    print_sim_stats();
+    print_collision_stats();
+    print_render_stats();
+    print_particle_stats();
+    print_pipeline_stats();
+    print_audio_stats();
+    print_frame_timings();
+    print_net_stats();
+    bool replayMatched = input_log_close(game_state_checksum());
+    bool inSync = gNet.desyncs == 0;
     clean_up();
-    return 0;
+    return (replayMatched && inSync && !mediaFailed) ? 0 : 1;
 }